@@ -25,9 +25,14 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 #if defined(HAVE_SYS_SENDFILE_H)
 #include <sys/sendfile.h>
 #endif
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -41,7 +46,30 @@
 #include <chunk-private.h>
 #include "chunkd.h"
 
-#define BE_FS_OBJ_MAGIC		"CHU1"
+#define BE_FS_OBJ_MAGIC		"CHU2"	/* value starts on a page */
+#define BE_FS_OBJ_MAGIC_V1	"CHU1"	/* value right after csum table */
+
+#define FS_CVT_PFX		".cvt-"	/* fs_obj_convert() copy in progress */
+
+enum {
+	FS_N_PREFIX		= 1 << (PREFIX_LEN * 4),	/* hex digits */
+
+	/* "<prefix>/<rest>" at the end of an object pathname */
+	FS_OBJ_RELNAME_LEN	= (SHA256_DIGEST_LENGTH * 2) + 1,
+
+	FS_VALUE_ALIGN		= 4096,		/* CHU2 value offset */
+
+	FS_DROP_STEP		= 1024 * 1024,	/* nocache read granularity */
+
+	FS_CSUM_EAGER_MAX	= 16 * 1024,	/* larger tables load lazily */
+	FS_CSUM_WINDOW		= 1024,		/* lazy csums read at once */
+};
+
+/* an open table directory, and which of its prefix subdirs exist */
+struct fs_tbl_dir {
+	int			fd;
+	unsigned char		have_pfx[FS_N_PREFIX / 8];
+};
 
 struct fs_obj {
 	struct backend_obj	bo;
@@ -49,11 +77,13 @@ struct fs_obj {
 	int			out_fd;
 	char			*out_fn;
 	uint64_t		written_bytes;
+	uint64_t		wb_pos;		/* value handed to writeback */
 
 	int			in_fd;
 	char			*in_fn;
 	off_t			in_pos;
 	off_t			sendfile_ofs;
+	uint64_t		verified_pos;	/* data csum'd for sendfile */
 
 	off_t			value_ofs;
 
@@ -65,8 +95,26 @@ struct fs_obj {
 	unsigned int		csum_idx;
 	void			*csum_tbl;
 	size_t			csum_tbl_sz;
+	bool			csum_lazy;	/* csum_tbl is a window */
+	off_t			csum_ofs;	/* ... of the table here */
+	unsigned int		csum_first;	/* first blk in window */
+	unsigned int		csum_n;		/* blks in window */
+	void			*bounce;	/* one blk, for partial reads */
+
+	uint32_t		table_id;
 
 	unsigned int		n_blk;
+
+	struct fdcache_ent	*fde;		/* in_fd is shared, if set */
+
+	void			*pack_buf;	/* value of a new packed obj */
+	bool			pack_claimed;	/* ... whose key we hold */
+	bool			in_packed;	/* in_fd is a pack segment */
+
+	bool			nocache;	/* drop pages behind us */
+	off_t			drop_pos;	/* file ofs dropped up to */
+
+	uint8_t			digest;		/* of an opened obj */
 };
 
 struct be_fs_obj_hdr {
@@ -74,18 +122,164 @@ struct be_fs_obj_hdr {
 	uint32_t		key_len;
 	uint64_t		value_len;
 	uint32_t		n_blk;
+	uint8_t			digest;		/* enum chd_obj_digest */
 
-	char			reserved[12];
+	char			reserved[11];
 
 	unsigned char		hash[CHD_CSUM_SZ];
 	char			owner[128];
 } __attribute__ ((packed));
 
+/* 2 for CHU2, 1 for CHU1, 0 if not an object header at all */
+static int fs_hdr_version(const struct be_fs_obj_hdr *hdr)
+{
+	if (!memcmp(hdr->magic, BE_FS_OBJ_MAGIC, strlen(BE_FS_OBJ_MAGIC)))
+		return 2;
+	if (!memcmp(hdr->magic, BE_FS_OBJ_MAGIC_V1,
+		    strlen(BE_FS_OBJ_MAGIC_V1)))
+		return 1;
+	return 0;
+}
+
+/*
+ * Offset of the value in an object record.  CHU2 pads the metadata
+ * area so that the value, and every 64k csum block of it, starts on a
+ * page boundary, as O_DIRECT and page-granular mappings want.  Packed
+ * records stay unpadded CHU1.
+ */
+static off_t fs_value_ofs(int version, size_t key_len, size_t csum_len)
+{
+	off_t ofs = sizeof(struct be_fs_obj_hdr) + key_len + csum_len;
+
+	if (version >= 2)
+		ofs = (ofs + FS_VALUE_ALIGN - 1) & ~((off_t) FS_VALUE_ALIGN - 1);
+	return ofs;
+}
+
+/*
+ * Note which prefix subdirs a table directory has, and keep the
+ * directory open for openat().  Called with tbl_dirs_lock held.
+ */
+static struct fs_tbl_dir *__fs_tbl_dir_open(uint32_t table_id)
+{
+	struct fs_tbl_dir *td;
+	struct dirent *de;
+	char *path, *end;
+	unsigned long pfx;
+	DIR *d;
+	int fd;
+
+	if (asprintf(&path, MDB_TPATH_FMT, chunkd_srv.vol_path, table_id) < 0)
+		return NULL;
+
+	td = calloc(1, sizeof(*td));
+	if (!td)
+		goto err_out;
+
+	td->fd = open(path, O_RDONLY | O_DIRECTORY);
+	if (td->fd < 0) {
+		syslogerr(path);
+		goto err_out_td;
+	}
+
+	fd = dup(td->fd);
+	d = (fd < 0) ? NULL : fdopendir(fd);
+	if (!d) {
+		syslogerr(path);
+		if (fd >= 0)
+			close(fd);
+		goto err_out_fd;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (strlen(de->d_name) != PREFIX_LEN)
+			continue;
+		pfx = strtoul(de->d_name, &end, 16);
+		if (*end || pfx >= FS_N_PREFIX)
+			continue;
+		td->have_pfx[pfx / 8] |= 1 << (pfx % 8);
+	}
+	closedir(d);
+
+	g_hash_table_insert(chunkd_srv.tbl_dirs, GUINT_TO_POINTER(table_id),
+			    td);
+
+	free(path);
+	return td;
+
+err_out_fd:
+	close(td->fd);
+err_out_td:
+	free(td);
+err_out:
+	free(path);
+	return NULL;
+}
+
+/*
+ * The open directory of a table, with prefix subdir pfx made to exist
+ * if creat.  Once both are known this costs no syscalls.
+ */
+static int fs_tbl_dirfd(uint32_t table_id, unsigned int pfx, bool creat)
+{
+	struct fs_tbl_dir *td;
+	char name[PREFIX_LEN + 1];
+	int fd = -1;
+
+	g_mutex_lock(chunkd_srv.tbl_dirs_lock);
+
+	td = g_hash_table_lookup(chunkd_srv.tbl_dirs,
+				 GUINT_TO_POINTER(table_id));
+	if (!td)
+		td = __fs_tbl_dir_open(table_id);
+	if (!td)
+		goto out;
+
+	if (creat && !(td->have_pfx[pfx / 8] & (1 << (pfx % 8)))) {
+		sprintf(name, "%0*x", PREFIX_LEN, pfx);
+		if (mkdirat(td->fd, name, 0777) < 0 && errno != EEXIST) {
+			applog(LOG_ERR, "mkdir(%s) in table %u failed: %s",
+			       name, table_id, strerror(errno));
+			goto out;
+		}
+		td->have_pfx[pfx / 8] |= 1 << (pfx % 8);
+	}
+
+	fd = td->fd;
+
+out:
+	g_mutex_unlock(chunkd_srv.tbl_dirs_lock);
+	return fd;
+}
+
+/* a new table gets all of its prefix subdirs up front */
+static int fs_tbl_dir_populate(uint32_t table_id)
+{
+	unsigned int pfx;
+
+	for (pfx = 0; pfx < FS_N_PREFIX; pfx++)
+		if (fs_tbl_dirfd(table_id, pfx, true) < 0)
+			return -EIO;
+
+	return 0;
+}
+
+static void fs_tbl_dir_free(gpointer key, gpointer val, gpointer user_data)
+{
+	struct fs_tbl_dir *td = val;
+
+	close(td->fd);
+	free(td);
+}
+
 int fs_open(void)
 {
 	TCHDB *hdb;
 	char *db_fn = NULL;
 	int rc = 0, omode;
+	void *kbuf;
+	uint32_t *val_p;
+	int klen, vlen;
 
 	if (asprintf(&db_fn, "%s/master.tch", chunkd_srv.vol_path) < 0)
 		return -ENOMEM;
@@ -108,6 +302,34 @@ int fs_open(void)
 
 	chunkd_srv.tbl_master = hdb;
 
+	chunkd_srv.tbl_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+	chunkd_srv.tbl_index_lock = g_mutex_new();
+	chunkd_srv.tbl_dirs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	chunkd_srv.tbl_dirs_lock = g_mutex_new();
+	chunkd_srv.tbl_packs = g_hash_table_new(g_direct_hash, g_direct_equal);
+	chunkd_srv.tbl_packs_lock = g_mutex_new();
+
+	/*
+	 * open, and if need be build, the key index of every table now,
+	 * rather than on a client's first LIST.  Failures are retried
+	 * on first use.
+	 */
+	tchdbiterinit(hdb);
+	while ((kbuf = tchdbiternext(hdb, &klen)) != NULL) {
+		val_p = NULL;
+		if (klen != strlen(MDB_TABLE_ID) + 1 ||
+		    memcmp(kbuf, MDB_TABLE_ID, klen))
+			val_p = tchdbget(hdb, kbuf, klen, &vlen);
+		if (val_p && vlen == sizeof(uint32_t)) {
+			fs_index_open(GUINT32_FROM_LE(*val_p), false);
+
+			/* scan for prefix subdirs now, not on first use */
+			fs_tbl_dirfd(GUINT32_FROM_LE(*val_p), 0, false);
+		}
+		free(val_p);
+		free(kbuf);
+	}
+
 	free(db_fn);
 	return 0;
 
@@ -121,6 +343,15 @@ out:
 
 void fs_close(void)
 {
+	fs_index_close_all();
+	fs_pack_close_all();
+
+	g_mutex_lock(chunkd_srv.tbl_dirs_lock);
+	g_hash_table_foreach(chunkd_srv.tbl_dirs, fs_tbl_dir_free, NULL);
+	g_hash_table_destroy(chunkd_srv.tbl_dirs);
+	chunkd_srv.tbl_dirs = NULL;
+	g_mutex_unlock(chunkd_srv.tbl_dirs_lock);
+
 	tchdbclose(chunkd_srv.tbl_master);
 }
 
@@ -128,6 +359,12 @@ void fs_free(void)
 {
 	if (chunkd_srv.tbl_master)
 		tchdbdel(chunkd_srv.tbl_master);
+	if (chunkd_srv.tbl_index_lock)
+		g_mutex_free(chunkd_srv.tbl_index_lock);
+	if (chunkd_srv.tbl_dirs_lock)
+		g_mutex_free(chunkd_srv.tbl_dirs_lock);
+	if (chunkd_srv.tbl_packs_lock)
+		g_mutex_free(chunkd_srv.tbl_packs_lock);
 }
 
 bool fs_table_open(const char *user, const void *kbuf, size_t klen,
@@ -198,6 +435,13 @@ bool fs_table_open(const char *user, const void *kbuf, size_t klen,
 		goto out_close;
 	}
 
+	/* so that no object operation ever has to check for them */
+	if (fs_tbl_dir_populate(next_num) < 0)
+		goto out_close;
+
+	if (fs_index_open(next_num, true) < 0)
+		goto out_close;
+
 	/* finally, store in table_name->table_id map */
 	if (!tchdbput(hdb, kbuf, klen, &table_id_le, sizeof(table_id_le)))
 		goto out_close;
@@ -228,11 +472,14 @@ static struct fs_obj *fs_obj_alloc(void)
 	return obj;
 }
 
+/*
+ * Pathname of an object file.  No syscalls: the prefix subdirectory is
+ * made sure of by fs_obj_dirfd() instead.
+ */
 static char *fs_obj_pathname(uint32_t table_id,const void *key, size_t key_len)
 {
 	char *s = NULL;
 	char prefix[PREFIX_LEN + 1] = "";
-	struct stat st;
 	size_t slen;
 	unsigned char md[SHA256_DIGEST_LENGTH];
 	char mdstr[(SHA256_DIGEST_LENGTH * 2) + 1];
@@ -253,37 +500,45 @@ static char *fs_obj_pathname(uint32_t table_id,const void *key, size_t key_len)
 	if (!s)
 		return NULL;
 
-	sprintf(s, MDB_TPATH_FMT "/%s", chunkd_srv.vol_path, table_id, prefix);
-
-	/* create subdir on the fly, if not already exists */
-	if (stat(s, &st) < 0) {
-		if (errno == ENOENT) {
-			if (mkdir(s, 0777) < 0) {
-				syslogerr(s);
-
-				/* Directory already exists, perhaps
-				 * because we raced with another thread.
-				 */
-				if (errno != EEXIST)
-					goto err_out;
-			}
-		} else {
-			syslogerr(s);
-			goto err_out;
-		}
-	} else if (!S_ISDIR(st.st_mode)) {
-		applog(LOG_WARNING, "%s: not a dir, fs_obj_pathname go boom", s);
-		goto err_out;
-	}
-
 	sprintf(s, MDB_TPATH_FMT "/%s/%s", chunkd_srv.vol_path, table_id,
 		prefix, mdstr + PREFIX_LEN);
 
 	return s;
+}
 
-err_out:
-	free(s);
-	return NULL;
+/*
+ * Directory to openat() object file fn in, and the name relative to it
+ * ("<prefix>/<rest>").  With creat, the prefix subdir is created if
+ * need be.
+ */
+static int fs_obj_dirfd(uint32_t table_id, const char *fn, bool creat,
+			const char **relp)
+{
+	char prefix[PREFIX_LEN + 1];
+	const char *rel;
+
+	rel = fn + strlen(fn) - FS_OBJ_RELNAME_LEN;
+	memcpy(prefix, rel, PREFIX_LEN);
+	prefix[PREFIX_LEN] = 0;
+
+	*relp = rel;
+	return fs_tbl_dirfd(table_id, strtoul(prefix, NULL, 16), creat);
+}
+
+/* a descriptor of the prefix subdir holding object file fn */
+static int fs_obj_pfx_dir_open(uint32_t table_id, const char *fn)
+{
+	char prefix[PREFIX_LEN + 1];
+	const char *rel;
+	int dir_fd;
+
+	dir_fd = fs_obj_dirfd(table_id, fn, false, &rel);
+	if (dir_fd < 0)
+		return -1;
+
+	memcpy(prefix, rel, PREFIX_LEN);
+	prefix[PREFIX_LEN] = 0;
+	return openat(dir_fd, prefix, O_RDONLY | O_DIRECTORY);
 }
 
 static char *fs_obj_badname(unsigned long tag)
@@ -346,6 +601,36 @@ static unsigned int fs_blk_count(uint64_t data_len)
 	return (unsigned int) n_blk;
 }
 
+/*
+ * The csum table of a large object is not read at open: a ranged read
+ * of a huge object would pay for all of it.  Reads load the entries
+ * they need instead, see fs_obj_csums().
+ */
+static bool fs_csum_lazy(unsigned int n_blk)
+{
+	return (size_t) n_blk * CHD_CSUM_SZ > FS_CSUM_EAGER_MAX;
+}
+
+/*
+ * Reserve the blocks of a new object file before its data arrives, so
+ * that concurrent uploads do not interleave their extents.  The file
+ * size still grows with each write.  Filesystems without fallocate(2)
+ * are left to allocate as they go.
+ */
+static int fs_obj_prealloc(int fd, const char *fn, off_t len)
+{
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len) < 0) {
+		if (errno == EOPNOTSUPP || errno == ENOSYS)
+			return 0;
+		applog(LOG_ERR, "fallocate(%s, %llu) failed: %s",
+		       fn, (unsigned long long) len, strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}
+
 struct backend_obj *fs_obj_new(uint32_t table_id,
 			       const void *key, size_t key_len,
 			       uint64_t data_len,
@@ -353,9 +638,13 @@ struct backend_obj *fs_obj_new(uint32_t table_id,
 {
 	struct fs_obj *obj;
 	char *fn = NULL;
+	const char *rel;
+	int dir_fd;
 	size_t csum_bytes;
 	enum chunk_errcode erc = che_InternalError;
 	off_t skip_len;
+	bool pack;
+	int rc;
 
 	if (!key_valid(key, key_len)) {
 		*err_code = che_InvalidKey;
@@ -377,27 +666,58 @@ struct backend_obj *fs_obj_new(uint32_t table_id,
 	obj->tail_pos = data_len & ~(CHUNK_BLK_SZ - 1);
 	obj->tail_len = data_len & (CHUNK_BLK_SZ - 1);
 
+	obj->bo.key = g_memdup(key, key_len);
+	if (!obj->bo.key)
+		goto err_out;
+	obj->bo.key_len = key_len;
+	obj->table_id = table_id;
+
+	pack = (data_len < chunkd_srv.pack_threshold);
+
 	/* build local fs pathname */
 	fn = fs_obj_pathname(table_id, key, key_len);
 	if (!fn)
 		goto err_out;
 
-	obj->out_fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, 0600);
-	if (obj->out_fd < 0) {
-		if (errno != EEXIST)
-			syslogerr(fn);
-		else
+	dir_fd = fs_obj_dirfd(table_id, fn, !pack, &rel);
+	if (dir_fd < 0)
+		goto err_out;
+
+	/*
+	 * A key is either packed or has a file of its own, never both.
+	 * A small object claims its key until it is appended to a pack
+	 * at commit, while a large one creates its file right away.
+	 */
+	rc = fs_pack_claim(table_id, key, key_len, dir_fd, rel, pack,
+			   &obj->out_fd);
+	if (rc < 0) {
+		if (rc == -EEXIST)
 			erc = che_KeyExists;
+		else if (!pack)
+			applog(LOG_ERR, "%s: %s", fn, strerror(-rc));
 		goto err_out;
 	}
 
+	/* small: the value is kept here until then */
+	if (pack) {
+		obj->pack_claimed = true;
+
+		obj->pack_buf = malloc(data_len ? data_len : 1);
+		if (!obj->pack_buf)
+			goto err_out;
+
+		free(fn);
+		fn = NULL;
+		goto out;
+	}
+
 	/* we cannot set ->out_fn immediately, because fs_obj_free +
 	 * an error may trigger an erroneous unlink
 	 */
 	obj->out_fn = fn;
 
 	/* calculate size of front-of-file metadata area */
-	skip_len = sizeof(struct be_fs_obj_hdr) + key_len + csum_bytes;
+	skip_len = fs_value_ofs(2, key_len, csum_bytes);
 	obj->value_ofs = skip_len;
 
 	/* position file pointer where object data (as in, not metadata)
@@ -410,10 +730,10 @@ struct backend_obj *fs_obj_new(uint32_t table_id,
 		goto err_out;
 	}
 
-	obj->bo.key = g_memdup(key, key_len);
-	if (!obj->bo.key)
+	if (fs_obj_prealloc(obj->out_fd, fn, skip_len + data_len) < 0)
 		goto err_out;
-	obj->bo.key_len = key_len;
+
+out:
 	obj->bo.size = data_len;
 
 	*err_code = che_Success;
@@ -427,89 +747,113 @@ err_out:
 	return NULL;
 }
 
-struct backend_obj *fs_obj_open(uint32_t table_id, const char *user,
-				const void *key, size_t key_len,
-				enum chunk_errcode *err_code)
+/*
+ * Set up an opened object from its cached header and csum table,
+ * taking over csum_tbl, which is NULL for a lazy table.  The caller has
+ * made sure that the open file is the one described by meta.
+ */
+static bool fs_obj_open_cached(struct fs_obj *obj,
+			       const void *key, size_t key_len,
+			       const struct metacache_meta *meta,
+			       void *csum_tbl, size_t csum_len)
 {
-	struct fs_obj *obj;
-	struct stat st;
-	struct be_fs_obj_hdr hdr;
-	ssize_t rrc;
-	uint64_t value_len, tmp64;
-	size_t csum_bytes;
-	enum chunk_errcode erc = che_InternalError;
-	struct iovec iov[2];
-	size_t total_rd_len;
+	obj->bo.key = g_memdup(key, key_len);
+	if (!obj->bo.key)
+		return false;
+	obj->bo.key_len = key_len;
 
-	if (!key_valid(key, key_len)) {
-		*err_code = che_InvalidKey;
-		return NULL;
-	}
+	obj->n_blk = fs_blk_count(meta->size);
+	obj->tail_pos = meta->size & ~(CHUNK_BLK_SZ - 1);
+	obj->tail_len = meta->size & (CHUNK_BLK_SZ - 1);
+	obj->value_ofs = meta->value_ofs;
+	obj->csum_tbl = csum_tbl;
+	obj->csum_tbl_sz = csum_len;
+	obj->csum_ofs = sizeof(struct be_fs_obj_hdr) + key_len;
+	obj->csum_lazy = fs_csum_lazy(obj->n_blk);
 
-	obj = fs_obj_alloc();
-	if (!obj) {
-		*err_code = che_InternalError;
-		return NULL;
-	}
+	memcpy(obj->bo.hash, meta->hash, sizeof(obj->bo.hash));
+	obj->digest = meta->digest;
+	obj->bo.size = meta->size;
+	obj->bo.mtime = meta->mtime;
 
-	/* build local fs pathname */
-	obj->in_fn = fs_obj_pathname(table_id, key, key_len);
-	if (!obj->in_fn)
-		goto err_out;
+	return true;
+}
 
-	obj->in_fd = open(obj->in_fn, O_RDONLY);
-	if (obj->in_fd < 0) {
-		applog(LOG_ERR, "open obj(%s) failed: %s",
-		       obj->in_fn, strerror(errno));
-		if (errno == ENOENT)
-			erc = che_NoSuchKey;
-		goto err_out;
-	}
+/* is the file we have open the one the cached header describes? */
+static bool fs_obj_cache_match(const struct stat *st,
+			       const struct metacache_meta *meta)
+{
+	return st->st_ino == meta->ino && st->st_mtime == meta->mtime &&
+	       st->st_size >= meta->value_ofs + meta->size;
+}
 
-	if (fstat(obj->in_fd, &st) < 0) {
-		applog(LOG_ERR, "fstat obj(%s) failed: %s", obj->in_fn,
-			strerror(errno));
-		goto err_out;
-	}
+/* hand a validated descriptor over to the fd cache, to share */
+static void fs_obj_fd_cache(struct fs_obj *obj, uint32_t table_id,
+			    const void *key, size_t key_len,
+			    uint64_t ino, unsigned long gen)
+{
+	if (obj->fde)
+		return;
+
+	/* without memory for an entry, the object keeps its own fd */
+	obj->fde = fdcache_add(&chunkd_srv.fds, table_id, key, key_len,
+			       obj->in_fd, ino, obj->in_fn, gen);
+}
+
+/*
+ * Read and check the header, key and csum table of the object record at
+ * offset base of in_fd, which has avail bytes from there on: the whole
+ * file, or one record of a pack segment.  The descriptor may be shared
+ * through the fd cache, so all reads are positioned.
+ */
+static bool fs_obj_read_hdr(struct fs_obj *obj, off_t base, uint64_t avail,
+			    const char *user, const void *key, size_t key_len,
+			    enum chunk_errcode *err_code)
+{
+	struct be_fs_obj_hdr hdr;
+	struct iovec iov[2];
+	size_t total_rd_len, csum_bytes;
+	uint64_t value_len;
+	ssize_t rrc;
+	int version;
 
 	/* read object fixed-length header */
-	rrc = read(obj->in_fd, &hdr, sizeof(hdr));
+	rrc = pread(obj->in_fd, &hdr, sizeof(hdr), base);
 	if (rrc != sizeof(hdr)) {
 		applog(LOG_ERR, "read hdr obj(%s) failed: %s",
 			obj->in_fn,
 			(rrc < 0) ? strerror(errno) : "<unknown reasons>");
-		goto err_out;
+		return false;
 	}
 
-	/* verify magic number in header */
-	if (G_UNLIKELY(memcmp(hdr.magic, BE_FS_OBJ_MAGIC,
-		       strlen(BE_FS_OBJ_MAGIC)))) {
+	/* verify magic number in header; both formats are read */
+	version = fs_hdr_version(&hdr);
+	if (G_UNLIKELY(!version)) {
 		applog(LOG_ERR, "obj(%s) hdr magic corrupted", obj->in_fn);
-		goto err_out;
+		return false;
 	}
 
 	/* authenticated user must own this object */
 	if (strcmp(hdr.owner, user)) {
-		erc = che_AccessDenied;
-		goto err_out;
+		*err_code = che_AccessDenied;
+		return false;
 	}
 
 	/* verify object key length matches input key length */
 	if (G_UNLIKELY(GUINT32_FROM_LE(hdr.key_len) != key_len))
-		goto err_out;
+		return false;
 
 	value_len = GUINT64_FROM_LE(hdr.value_len);
 	obj->n_blk = GUINT32_FROM_LE(hdr.n_blk);
 	csum_bytes = obj->n_blk * CHD_CSUM_SZ;
 	obj->tail_pos = value_len & ~(CHUNK_BLK_SZ - 1);
 	obj->tail_len = value_len & (CHUNK_BLK_SZ - 1);
-	obj->value_ofs = sizeof(hdr) + key_len + csum_bytes;
+	obj->value_ofs = base + fs_value_ofs(version, key_len, csum_bytes);
 
-	/* verify file size large enough to contain value */
-	tmp64 = obj->value_ofs + value_len;
-	if (G_UNLIKELY(st.st_size < tmp64)) {
+	/* verify record large enough to contain value */
+	if (G_UNLIKELY(avail < obj->value_ofs - base + value_len)) {
 		applog(LOG_ERR, "obj(%s) size error, too small", obj->in_fn);
-		goto err_out;
+		return false;
 	}
 
 	/* verify expected size of checksum table */
@@ -517,18 +861,24 @@ struct backend_obj *fs_obj_open(uint32_t table_id, const char *user,
 		applog(LOG_ERR, "obj(%s) unexpected blk count "
 		       "(%u from val sz, %u from hdr)",
 		       obj->in_fn, fs_blk_count(value_len), obj->n_blk);
-		goto err_out;
+		return false;
 	}
 
-	obj->csum_tbl = malloc(csum_bytes);
+	/* a large table is left on disk until reads need it */
+	obj->csum_ofs = base + sizeof(hdr) + key_len;
+	obj->csum_lazy = fs_csum_lazy(obj->n_blk);
+	if (obj->csum_lazy)
+		csum_bytes = 0;
+
+	obj->csum_tbl = malloc(csum_bytes ? csum_bytes : 1);
 	if (!obj->csum_tbl)
-		goto err_out;
+		return false;
 	obj->csum_tbl_sz = csum_bytes;
 
 	obj->bo.key = malloc(key_len);
 	obj->bo.key_len = key_len;
 	if (!obj->bo.key)
-		goto err_out;
+		return false;
 
 	/* init additional header segment list */
 	iov[0].iov_base = obj->bo.key;
@@ -538,27 +888,200 @@ struct backend_obj *fs_obj_open(uint32_t table_id, const char *user,
 	total_rd_len = iov[0].iov_len + iov[1].iov_len;
 
 	/* read additional header segments (key, checksum table) */
-	rrc = readv(obj->in_fd, iov, ARRAY_SIZE(iov));
+	rrc = preadv(obj->in_fd, iov, ARRAY_SIZE(iov), base + sizeof(hdr));
 	if ((rrc != total_rd_len) || (memcmp(key, obj->bo.key, key_len))) {
 		applog(LOG_ERR, "read addnl hdrs(%s) failed: %s",
 			obj->in_fn,
 			(rrc < 0) ? strerror(errno) : "<unknown reasons>");
-		goto err_out;
+		return false;
 	}
 
 	memcpy(obj->bo.hash, hdr.hash, sizeof(obj->bo.hash));
+	obj->digest = hdr.digest;
 	obj->bo.size = value_len;
+
+	return true;
+}
+
+struct backend_obj *fs_obj_open(uint32_t table_id, const char *user,
+				const void *key, size_t key_len,
+				enum chunk_errcode *err_code)
+{
+	struct fs_obj *obj;
+	struct stat st;
+	enum chunk_errcode erc = che_InternalError;
+	struct metacache_meta meta;
+	struct fs_pack_loc loc;
+	void *cached_tbl;
+	size_t cached_tbl_len;
+	unsigned long gen, fd_gen;
+	bool cached, have_tbl;
+	const char *rel;
+	int dir_fd, rc;
+
+	if (!key_valid(key, key_len)) {
+		*err_code = che_InvalidKey;
+		return NULL;
+	}
+
+	obj = fs_obj_alloc();
+	if (!obj) {
+		*err_code = che_InternalError;
+		return NULL;
+	}
+
+	cached = metacache_get(&chunkd_srv.metas, table_id, key, key_len,
+			       &meta, &cached_tbl, &cached_tbl_len, &gen);
+	if (cached && strcmp(meta.owner, user)) {
+		erc = che_AccessDenied;
+		goto err_out;
+	}
+
+	/*
+	 * the cached header is only enough with the whole csum table,
+	 * unless the table is a lazy one anyway
+	 */
+	have_tbl = cached &&
+		   (cached_tbl_len == fs_blk_count(meta.size) * CHD_CSUM_SZ ||
+		    fs_csum_lazy(fs_blk_count(meta.size)));
+
+	/* a cached descriptor spares building the path and opening it */
+	obj->fde = fdcache_get(&chunkd_srv.fds, table_id, key, key_len,
+			       &fd_gen);
+	if (obj->fde) {
+		obj->in_fd = obj->fde->fd;
+		obj->in_fn = obj->fde->name;
+
+		/* both caches are invalidated together; nothing to check */
+		if (have_tbl && obj->fde->ino == meta.ino)
+			goto out_cached;
+	} else {
+		/* small objects live in pack segments */
+		rc = fs_pack_lookup(table_id, key, key_len, &loc,
+				    &obj->in_fd, &obj->in_fn);
+		if (rc < 0)
+			goto err_out;
+		if (rc > 0)
+			goto out_packed;
+
+		/* build local fs pathname */
+		obj->in_fn = fs_obj_pathname(table_id, key, key_len);
+		if (!obj->in_fn)
+			goto err_out;
+
+		dir_fd = fs_obj_dirfd(table_id, obj->in_fn, false, &rel);
+		if (dir_fd < 0)
+			goto err_out;
+
+		obj->in_fd = openat(dir_fd, rel, O_RDONLY);
+		if (obj->in_fd < 0) {
+			applog(LOG_ERR, "open obj(%s) failed: %s",
+			       obj->in_fn, strerror(errno));
+			if (errno == ENOENT)
+				erc = che_NoSuchKey;
+			goto err_out;
+		}
+	}
+
+	if (fstat(obj->in_fd, &st) < 0) {
+		applog(LOG_ERR, "fstat obj(%s) failed: %s", obj->in_fn,
+			strerror(errno));
+		goto err_out;
+	}
+
+	/* with the csum table cached too, the header need not be read */
+	if (have_tbl &&
+	    fs_obj_cache_match(&st, &meta))
+		goto out_cached;
+	free(cached_tbl);
+	cached_tbl = NULL;
+
+	if (!fs_obj_read_hdr(obj, 0, st.st_size, user, key, key_len, &erc))
+		goto err_out;
+
 	obj->bo.mtime = st.st_mtime;
 
+	memset(&meta, 0, sizeof(meta));
+	meta.size = obj->bo.size;
+	meta.mtime = st.st_mtime;
+	meta.ino = st.st_ino;
+	meta.value_ofs = obj->value_ofs;
+	memcpy(meta.hash, obj->bo.hash, sizeof(meta.hash));
+	meta.digest = obj->digest;
+	strncpy(meta.owner, user, sizeof(meta.owner) - 1);
+	metacache_put(&chunkd_srv.metas, table_id, key, key_len, &meta,
+		      obj->csum_tbl, obj->csum_tbl_sz, gen);
+
+	fs_obj_fd_cache(obj, table_id, key, key_len, st.st_ino, fd_gen);
+
+	*err_code = che_Success;
+	return &obj->bo;
+
+out_cached:
+	if (!fs_obj_open_cached(obj, key, key_len, &meta,
+				cached_tbl, cached_tbl_len))
+		goto err_out;
+
+	fs_obj_fd_cache(obj, table_id, key, key_len, meta.ino, fd_gen);
+
+	*err_code = che_Success;
+	return &obj->bo;
+
+out_packed:
+	free(cached_tbl);
+	cached_tbl = NULL;
+	obj->in_packed = true;
+
+	/* in_fd is our own descriptor of the segment */
+	if (!fs_obj_read_hdr(obj, loc.ofs, loc.len, user, key, key_len, &erc))
+		goto err_out;
+
+	obj->bo.mtime = loc.mtime;
+
 	*err_code = che_Success;
 	return &obj->bo;
 
 err_out:
+	free(cached_tbl);
 	fs_obj_free(&obj->bo);
 	*err_code = erc;
 	return NULL;
 }
 
+/*
+ * For a nocache object being read, drop the pages up to file offset pos
+ * from the page cache, once there is a step's worth of them.
+ */
+static void fs_obj_drop_behind(struct fs_obj *obj, off_t pos, bool all)
+{
+#ifdef HAVE_POSIX_FADVISE
+	if (!obj->nocache || pos <= obj->drop_pos ||
+	    (!all && pos - obj->drop_pos < FS_DROP_STEP))
+		return;
+
+	posix_fadvise(obj->in_fd, obj->drop_pos, pos - obj->drop_pos,
+		      POSIX_FADV_DONTNEED);
+	obj->drop_pos = pos;
+#endif
+}
+
+/*
+ * Keep a large streaming object out of the page cache, so that it does
+ * not evict the working set of everyone else: its pages are dropped
+ * behind the read position, or once written back during a PUT.  Pack
+ * segments are shared by many small objects and are left alone.
+ */
+void fs_obj_nocache(struct backend_obj *bo)
+{
+	struct fs_obj *obj = bo->private;
+
+	if (obj->pack_buf || obj->in_packed)
+		return;
+
+	obj->nocache = true;
+	obj->drop_pos = obj->value_ofs;
+}
+
 void fs_obj_free(struct backend_obj *bo)
 {
 	struct fs_obj *obj;
@@ -569,6 +1092,10 @@ void fs_obj_free(struct backend_obj *bo)
 	obj = bo->private;
 	g_assert(obj != NULL);
 
+	/* an aborted small PUT lets others have the key */
+	if (obj->pack_claimed)
+		fs_pack_unclaim(obj->table_id, bo->key, bo->key_len);
+
 	free(bo->key);
 
 	if (obj->out_fn) {
@@ -579,11 +1106,22 @@ void fs_obj_free(struct backend_obj *bo)
 	if (obj->out_fd >= 0)
 		close(obj->out_fd);
 
-	free(obj->in_fn);
-	if (obj->in_fd >= 0)
-		close(obj->in_fd);
+	/* whatever of a bulk object is left in the cache goes too */
+	if (obj->nocache && obj->in_fd >= 0)
+		fs_obj_drop_behind(obj, obj->value_ofs + bo->size, true);
+
+	/* a cached descriptor is shared; the cache closes it */
+	if (obj->fde)
+		fdcache_put(&chunkd_srv.fds, obj->fde);
+	else {
+		free(obj->in_fn);
+		if (obj->in_fd >= 0)
+			close(obj->in_fd);
+	}
 
+	free(obj->pack_buf);
 	free(obj->csum_tbl);
+	free(obj->bounce);
 	free(obj);
 }
 
@@ -624,35 +1162,171 @@ static bool can_csum_range(struct fs_obj *obj, size_t len)
 int fs_obj_seek(struct backend_obj *bo, uint64_t rel_ofs)
 {
 	struct fs_obj *obj = bo->private;
-	uint64_t abs_ofs64 = obj->value_ofs + rel_ofs;
-	off_t abs_ofs = abs_ofs64;
-	off_t rc;
 
-	rc = lseek(obj->in_fd, abs_ofs, SEEK_SET);
-	if (rc == (off_t)-1) {
-		applog(LOG_ERR, "obj seek(%s, %llu + %llu, SEEK_SET) failed: %s",
-		       obj->in_fn,
-		       (unsigned long long) obj->value_ofs,
-		       (unsigned long long) rel_ofs,
-		       strerror(errno));
-		return -errno;
+	/* reads are positioned, so this only moves our own cursor */
+	if (rel_ofs > bo->size) {
+		applog(LOG_ERR, "obj seek(%s, %llu) beyond size %llu",
+		       obj->in_fn, (unsigned long long) rel_ofs,
+		       (unsigned long long) bo->size);
+		return -EINVAL;
 	}
 
-	obj->in_pos = rc - obj->value_ofs;
+	obj->in_pos = rel_ofs;
+
+	/* sendfile starts there too, verifying from its block on */
+	obj->sendfile_ofs = obj->value_ofs + rel_ofs;
+	obj->verified_pos = rel_ofs & ~CHUNK_BLK_MASK;
 
 	return 0;
 }
 
+/*
+ * The csum entries of blocks blk..blk+n-1 of an object being read.  A
+ * lazy table is read from disk a window at a time, and the window is
+ * kept for the reads that follow.  NULL if the entries cannot be read.
+ */
+static const unsigned char *fs_obj_csums(struct fs_obj *obj,
+					 unsigned long blk, unsigned long n)
+{
+	unsigned long want;
+	size_t len;
+	void *tbl;
+	ssize_t rrc;
+
+	if (!obj->csum_lazy)
+		return obj->csum_tbl + (blk * CHD_CSUM_SZ);
+
+	if (blk >= obj->csum_first && blk + n <= obj->csum_first + obj->csum_n)
+		return obj->csum_tbl + ((blk - obj->csum_first) * CHD_CSUM_SZ);
+
+	want = MIN(MAX(n, FS_CSUM_WINDOW), obj->n_blk - blk);
+	if (want < n)
+		return NULL;
+	len = want * CHD_CSUM_SZ;
+
+	if (len > obj->csum_tbl_sz) {
+		tbl = realloc(obj->csum_tbl, len);
+		if (!tbl)
+			return NULL;
+		obj->csum_tbl = tbl;
+		obj->csum_tbl_sz = len;
+	}
+
+	rrc = pread(obj->in_fd, obj->csum_tbl, len,
+		    obj->csum_ofs + (blk * CHD_CSUM_SZ));
+	if (rrc != len) {
+		applog(LOG_ERR, "obj(%s) csum read @ %lu blk failed: %s",
+		       obj->in_fn, blk,
+		       (rrc < 0) ? strerror(errno) : "<short read>");
+		obj->csum_n = 0;
+		return NULL;
+	}
+
+	obj->csum_first = blk;
+	obj->csum_n = want;
+	return obj->csum_tbl;
+}
+
+/*
+ * Copy the csums of blocks blk..blk+n-1 of an object being read to out,
+ * for a reply that carries them.
+ */
+int fs_obj_csum_copy(struct backend_obj *bo, unsigned long blk,
+		     unsigned long n, void *out)
+{
+	struct fs_obj *obj = bo->private;
+	const unsigned char *csums;
+	unsigned long step;
+
+	if (blk + n > obj->n_blk)
+		return -EINVAL;
+
+	while (n > 0) {
+		step = MIN(n, FS_CSUM_WINDOW);
+		csums = fs_obj_csums(obj, blk, step);
+		if (!csums)
+			return -EIO;
+
+		memcpy(out, csums, step * CHD_CSUM_SZ);
+		out += step * CHD_CSUM_SZ;
+		blk += step;
+		n -= step;
+	}
+
+	return 0;
+}
+
+/*
+ * Serve a read that covers only part of the block at in_pos, the head
+ * or the tail of a ranged read: the whole block is read into a bounce
+ * buffer and verified, and the part wanted copied out of it.
+ */
+static ssize_t fs_obj_read_partial(struct fs_obj *obj, void *ptr, size_t len)
+{
+	uint64_t blk_pos = obj->in_pos & ~CHUNK_BLK_MASK;
+	size_t blk_len = MIN(CHUNK_BLK_SZ, obj->bo.size - blk_pos);
+	size_t skip = obj->in_pos - blk_pos;
+	const unsigned char *csums;
+	ssize_t rc;
+
+	if (!obj->bounce) {
+		obj->bounce = malloc(CHUNK_BLK_SZ);
+		if (!obj->bounce)
+			return -ENOMEM;
+	}
+
+	rc = pread(obj->in_fd, obj->bounce, blk_len, obj->value_ofs + blk_pos);
+	if (rc != blk_len) {
+		applog(LOG_ERR, "obj read(%s) failed: %s", obj->in_fn,
+		       (rc < 0) ? strerror(errno) : "<short read>");
+		return -EIO;
+	}
+
+	csums = fs_obj_csums(obj, blk_pos >> CHUNK_BLK_ORDER, 1);
+	if (!csums)
+		return -EIO;
+	if (csum_verify_blocks(obj->bounce, blk_len, CHUNK_BLK_SZ, csums) >= 0) {
+		applog(LOG_WARNING, "obj(%s) csum failed @ %llu blk",
+		       obj->in_fn,
+		       (unsigned long long) (blk_pos >> CHUNK_BLK_ORDER));
+		return -EIO;
+	}
+
+	len = MIN(len, blk_len - skip);
+	memcpy(ptr, obj->bounce + skip, len);
+	obj->in_pos += len;
+
+	return len;
+}
+
 ssize_t fs_obj_read(struct backend_obj *bo, void *ptr, size_t len)
 {
 	struct fs_obj *obj = bo->private;
 	ssize_t rc;
-	unsigned int cur_blk, blk_idx, blk_cnt, last_blk;
-	void *tmp_p;
-	bool have_tail;
+	unsigned long cur_blk;
+	const unsigned char *csums;
+	uint64_t end;
+	long bad_blk;
+
+	/* in a pack segment, other records follow the value */
+	if (len > bo->size - obj->in_pos)
+		len = bo->size - obj->in_pos;
+
+	/*
+	 * After a seek, reads may start or end within a block; those
+	 * partial blocks are verified on their own, the rest as is.
+	 */
+	end = obj->in_pos + len;
+	if (len && (obj->in_pos & CHUNK_BLK_MASK))
+		return fs_obj_read_partial(obj, ptr, len);
+	if ((end & CHUNK_BLK_MASK) && end != bo->size) {
+		if (len < CHUNK_BLK_SZ)
+			return fs_obj_read_partial(obj, ptr, len);
+		len = (end & ~CHUNK_BLK_MASK) - obj->in_pos;
+	}
 
-	/* read data from local storage */
-	rc = read(obj->in_fd, ptr, len);
+	/* read data from local storage; the fd may be shared */
+	rc = pread(obj->in_fd, ptr, len, obj->value_ofs + obj->in_pos);
 	if (rc == 0) {
 		applog(LOG_WARNING, "obj read(%s) reached end of file: %s",
 		       obj->in_fn);
@@ -671,40 +1345,28 @@ ssize_t fs_obj_read(struct backend_obj *bo, void *ptr, size_t len)
 		goto out;
 	}
 
-	have_tail = (obj->tail_len > 0);
 	cur_blk = fs_blk_count(obj->in_pos);
-	last_blk = obj->n_blk - 1;
-	blk_cnt = fs_blk_count(rc);
-	tmp_p = ptr;
-
-	/* verify checksum for each block read from local storage */
-	for (blk_idx = cur_blk; blk_idx < (cur_blk + blk_cnt); blk_idx++) {
-		unsigned char md[CHD_CSUM_SZ];
-		unsigned int blk_len;
-		int cmprc;
-
-		if ((blk_idx == last_blk) && have_tail)
-			blk_len = obj->tail_len;
-		else
-			blk_len = CHUNK_BLK_SZ;
-
-		SHA1(tmp_p, blk_len, md);
 
-		cmprc = memcmp(md, obj->csum_tbl + (blk_idx * CHD_CSUM_SZ),
-			       CHD_CSUM_SZ);
-
-		if (cmprc) {
-			applog(LOG_WARNING, "obj(%s) csum failed @ %u blk",
-			       obj->in_fn, blk_idx);
-			return -EIO;
-		}
-
-		tmp_p += blk_len;
+	/*
+	 * verify checksum for each block read from local storage;
+	 * the blocks are independent, so they are hashed side by side
+	 */
+	csums = fs_obj_csums(obj, cur_blk, fs_blk_count(rc));
+	if (!csums)
+		return -EIO;
+
+	bad_blk = csum_verify_blocks(ptr, rc, CHUNK_BLK_SZ, csums);
+	if (bad_blk >= 0) {
+		applog(LOG_WARNING, "obj(%s) csum failed @ %lu blk",
+		       obj->in_fn, cur_blk + bad_blk);
+		return -EIO;
 	}
 
 out:
 	obj->in_pos += rc;
 
+	fs_obj_drop_behind(obj, obj->value_ofs + obj->in_pos, false);
+
 	return rc;
 }
 
@@ -728,6 +1390,42 @@ static void obj_flush_csum(struct backend_obj *bo)
 	SHA1_Init(&obj->checksum);
 }
 
+/*
+ * Start writeback of each WriteBehindMB step of a new object as soon as
+ * it is complete, and wait for the step before it, so that a large PUT
+ * keeps at most two steps dirty and leaves little for the final flush.
+ * Errors are left for that flush to report.
+ */
+static void fs_obj_write_behind(struct fs_obj *obj)
+{
+#ifdef HAVE_SYNC_FILE_RANGE
+	size_t step = chunkd_srv.write_behind;
+	off_t ofs;
+
+	while (step && obj->written_bytes - obj->wb_pos >= step) {
+		ofs = obj->value_ofs + obj->wb_pos;
+
+		sync_file_range(obj->out_fd, ofs, step,
+				SYNC_FILE_RANGE_WRITE);
+		if (obj->wb_pos >= step) {
+			sync_file_range(obj->out_fd, ofs - step, step,
+					SYNC_FILE_RANGE_WAIT_BEFORE |
+					SYNC_FILE_RANGE_WRITE |
+					SYNC_FILE_RANGE_WAIT_AFTER);
+
+			/* written back, so the pages are clean to drop */
+#ifdef HAVE_POSIX_FADVISE
+			if (obj->nocache)
+				posix_fadvise(obj->out_fd, ofs - step, step,
+					      POSIX_FADV_DONTNEED);
+#endif
+		}
+
+		obj->wb_pos += step;
+	}
+#endif
+}
+
 ssize_t fs_obj_write(struct backend_obj *bo, const void *ptr, size_t len)
 {
 	struct fs_obj *obj = bo->private;
@@ -739,7 +1437,18 @@ ssize_t fs_obj_write(struct backend_obj *bo, const void *ptr, size_t len)
 
 		unchecked = CHUNK_BLK_SZ - obj->checked_bytes;
 
-		wrc = write(obj->out_fd, ptr, MIN(unchecked, len));
+		if (obj->pack_buf) {
+			wrc = MIN(MIN(unchecked, len),
+				  obj->bo.size - obj->written_bytes);
+			if (!wrc) {
+				applog(LOG_ERR, "packed obj write beyond "
+				       "size %llu",
+				       (unsigned long long) obj->bo.size);
+				return -EINVAL;
+			}
+			memcpy(obj->pack_buf + obj->written_bytes, ptr, wrc);
+		} else
+			wrc = write(obj->out_fd, ptr, MIN(unchecked, len));
 		if (wrc < 0) {
 			applog(LOG_ERR, "obj write(%s) failed: %s",
 			       obj->out_fn, strerror(errno));
@@ -754,12 +1463,170 @@ ssize_t fs_obj_write(struct backend_obj *bo, const void *ptr, size_t len)
 		ptr += wrc;
 		len -= wrc;
 
-		/* if at end of 64k block, update csum table with new csum */
-		if (obj->checked_bytes == CHUNK_BLK_SZ)
-			obj_flush_csum(bo);
+		/* if at end of 64k block, update csum table with new csum */
+		if (obj->checked_bytes == CHUNK_BLK_SZ)
+			obj_flush_csum(bo);
+	}
+
+	if (!obj->pack_buf)
+		fs_obj_write_behind(obj);
+
+	return total_written;
+}
+
+/*
+ * Move len bytes of value from in to out inside the kernel: share the
+ * extents where the filesystem can (FICLONERANGE; it wants both offsets
+ * block-aligned, so CHU1 sources do not qualify), copy_file_range(2)
+ * otherwise.  -EOPNOTSUPP, with nothing written, if neither works here.
+ */
+static int fs_obj_copy_data(struct fs_obj *in, struct fs_obj *out,
+			    uint64_t len)
+{
+#if defined(HAVE_COPY_FILE_RANGE)
+	loff_t src_ofs = in->value_ofs, dst_ofs = out->value_ofs;
+	ssize_t rc;
+#endif
+
+	if (!len)
+		return 0;
+
+#if defined(FICLONERANGE)
+	{
+		struct file_clone_range fcr;
+
+		fcr.src_fd = in->in_fd;
+		fcr.src_offset = in->value_ofs;
+		fcr.src_length = len;
+		fcr.dest_offset = out->value_ofs;
+		if (ioctl(out->out_fd, FICLONERANGE, &fcr) == 0)
+			return 0;
+	}
+#endif
+
+#if defined(HAVE_COPY_FILE_RANGE)
+	while (len > 0) {
+		rc = copy_file_range(in->in_fd, &src_ofs, out->out_fd,
+				     &dst_ofs, len, 0);
+		if (rc < 0 && dst_ofs == out->value_ofs &&
+		    (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+		     errno == EOPNOTSUPP))
+			return -EOPNOTSUPP;
+		if (rc <= 0) {
+			applog(LOG_ERR, "obj copy(%s) failed: %s",
+			       out->out_fn,
+			       (rc < 0) ? strerror(errno) : "<short copy>");
+			return -EIO;
+		}
+
+		len -= rc;
+	}
+
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * Fill a new object with the whole value of an open one, for CP.  The
+ * data does not pass through user space, and is not hashed again: the
+ * copy takes over the source's csum table, and its digest, returned in
+ * *digest for fs_obj_write_commit() along with in_bo->hash.  Damage to
+ * the source thus carries over, as it would to anyone reading it; it
+ * is the selfcheck that finds it.
+ *
+ * Returns -EOPNOTSUPP, with out_bo untouched, where this cannot be
+ * done: for packed objects on either side, or without kernel support.
+ * The caller then copies through fs_obj_read() and fs_obj_write().
+ */
+int fs_obj_copy(struct backend_obj *out_bo, struct backend_obj *in_bo,
+		enum chd_obj_digest *digest)
+{
+	struct fs_obj *out = out_bo->private, *in = in_bo->private;
+	int rc;
+
+	if (out->pack_buf || in->in_packed)
+		return -EOPNOTSUPP;
+	if (G_UNLIKELY(out_bo->size != in_bo->size ||
+		       out->n_blk != in->n_blk || out->written_bytes))
+		return -EINVAL;
+
+	rc = fs_obj_copy_data(in, out, in_bo->size);
+	if (rc)
+		return rc;
+
+	if (fs_obj_csum_copy(in_bo, 0, in->n_blk, out->csum_tbl))
+		return -EIO;
+
+	out->written_bytes = out_bo->size;
+	out->csum_idx = out->n_blk;
+	out->checked_bytes = 0;
+
+	*digest = in->digest;
+	return 0;
+}
+
+/*
+ * Verify the data blocks sendfile(2) is about to transmit, up to value
+ * offset 'want', against the checksum table.  The blocks are hashed
+ * through a temporary read-only mapping, so there is no copy, and the
+ * pages faulted in here are the same ones sendfile then transmits from
+ * the page cache.
+ */
+static int fs_obj_verify_to(struct fs_obj *obj, uint64_t want)
+{
+	uint64_t end = obj->tail_pos + obj->tail_len;
+	uint64_t pos = obj->verified_pos;
+	unsigned long blk_idx;
+	const unsigned char *csums;
+	long bad_blk;
+	off_t map_ofs;
+	size_t map_len;
+	void *map;
+	unsigned char *p;
+	int rc = 0;
+
+	/* checksums cover whole blocks; always verify up to a block end */
+	want = (want + CHUNK_BLK_MASK) & ~CHUNK_BLK_MASK;
+	if (want > end)
+		want = end;
+	if (pos >= want)
+		return 0;
+
+	map_ofs = (obj->value_ofs + pos) & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+	map_len = obj->value_ofs + want - map_ofs;
+
+	map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, obj->in_fd, map_ofs);
+	if (map == MAP_FAILED) {
+		rc = -errno;
+		applog(LOG_ERR, "obj mmap(%s) failed: %s",
+		       obj->in_fn, strerror(errno));
+		return rc;
+	}
+
+	p = map + (obj->value_ofs + pos - map_ofs);
+	blk_idx = pos >> CHUNK_BLK_ORDER;
+
+	csums = fs_obj_csums(obj, blk_idx, fs_blk_count(want - pos));
+	if (!csums) {
+		rc = -EIO;
+		goto out;
 	}
 
-	return total_written;
+	bad_blk = csum_verify_blocks(p, want - pos, CHUNK_BLK_SZ, csums);
+	if (bad_blk >= 0) {
+		applog(LOG_WARNING, "obj(%s) csum failed @ %lu blk",
+		       obj->in_fn, blk_idx + bad_blk);
+		rc = -EIO;
+		goto out;
+	}
+
+	obj->verified_pos = want;
+
+out:
+	munmap(map, map_len);
+	return rc;
 }
 
 #if defined(HAVE_SENDFILE) && defined(__linux__)
@@ -770,15 +1637,21 @@ ssize_t fs_obj_sendfile(struct backend_obj *bo, int out_fd, size_t len)
 	ssize_t rc;
 
 	if (obj->sendfile_ofs == 0)
-		obj->sendfile_ofs =
-			sizeof(struct be_fs_obj_hdr) +
-			bo->key_len +
-			obj->csum_tbl_sz;
+		obj->sendfile_ofs = obj->value_ofs;
+
+	if (chunkd_srv.sendfile_verify) {
+		rc = fs_obj_verify_to(obj,
+				obj->sendfile_ofs - obj->value_ofs + len);
+		if (rc)
+			return rc;
+	}
 
 	rc = sendfile(out_fd, obj->in_fd, &obj->sendfile_ofs, len);
 	if (rc < 0)
 		applog(LOG_ERR, "obj sendfile(%s) failed: %s",
 		       obj->in_fn, strerror(errno));
+	else
+		fs_obj_drop_behind(obj, obj->sendfile_ofs, false);
 
 	return rc;
 }
@@ -792,10 +1665,14 @@ ssize_t fs_obj_sendfile(struct backend_obj *bo, int out_fd, size_t len)
 	off_t sbytes = 0;
 
 	if (obj->sendfile_ofs == 0)
-		obj->sendfile_ofs =
-			sizeof(struct be_fs_obj_hdr) +
-			bo->key_len +
-			obj->csum_tbl_sz;
+		obj->sendfile_ofs = obj->value_ofs;
+
+	if (chunkd_srv.sendfile_verify) {
+		rc = fs_obj_verify_to(obj,
+				obj->sendfile_ofs - obj->value_ofs + len);
+		if (rc)
+			return rc;
+	}
 
 	rc = sendfile(obj->in_fd, out_fd, obj->sendfile_ofs, len,
 		      NULL, &sbytes, 0);
@@ -807,6 +1684,8 @@ ssize_t fs_obj_sendfile(struct backend_obj *bo, int out_fd, size_t len)
 
 	obj->sendfile_ofs += sbytes;
 
+	fs_obj_drop_behind(obj, obj->sendfile_ofs, false);
+
 	return sbytes;
 }
 
@@ -820,11 +1699,59 @@ ssize_t fs_obj_sendfile(struct backend_obj *bo, int out_fd, size_t len)
 
 #endif /* HAVE_SENDFILE && HAVE_SYS_SENDFILE_H */
 
+/* append a small object, header and all, to a pack segment */
+static bool fs_obj_pack_commit(struct fs_obj *obj,
+			       const struct be_fs_obj_hdr *hdr,
+			       const char *user, const unsigned char *md,
+			       struct flush_req *sync)
+{
+	struct backend_obj *bo = &obj->bo;
+	struct iovec iov[4];
+	time_t mtime = time(NULL);
+	int rc;
+
+	iov[0].iov_base = (void *) hdr;
+	iov[0].iov_len = sizeof(*hdr);
+	iov[1].iov_base = bo->key;
+	iov[1].iov_len = bo->key_len;
+	iov[2].iov_base = obj->csum_tbl;
+	iov[2].iov_len = obj->csum_tbl_sz;
+	iov[3].iov_base = obj->pack_buf;
+	iov[3].iov_len = obj->written_bytes;
+
+	if (sync)
+		sync->pack_table = obj->table_id;
+
+	rc = fs_pack_append(obj->table_id, bo->key, bo->key_len,
+			    iov, ARRAY_SIZE(iov), mtime,
+			    sync ? &sync->fd : NULL);
+	if (rc < 0)
+		return false;
+
+	/* the index entry took over our claim */
+	obj->pack_claimed = false;
+
+	fs_obj_uncache(obj->table_id, bo->key, bo->key_len);
+
+	/* as with object files, an index failure is not fatal */
+	fs_index_put(obj->table_id, bo->key, bo->key_len, user, md,
+		     obj->written_bytes, mtime);
+
+	free(obj->pack_buf);
+	obj->pack_buf = NULL;
+
+	obj->written_bytes = 0;
+
+	return true;
+}
+
 bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
-			 unsigned char *md, bool sync_data)
+			 enum chd_obj_digest digest, unsigned char *md,
+			 struct flush_req *sync)
 {
 	struct fs_obj *obj = bo->private;
 	struct be_fs_obj_hdr hdr;
+	struct stat st;
 	ssize_t wrc;
 	size_t total_wr_len;
 	struct iovec iov[3];
@@ -837,14 +1764,6 @@ bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
 		return false;
 	}
 
-	memset(&hdr, 0, sizeof(hdr));
-	memcpy(hdr.magic, BE_FS_OBJ_MAGIC, strlen(BE_FS_OBJ_MAGIC));
-	memcpy(hdr.hash, md, sizeof(hdr.hash));
-	strncpy(hdr.owner, user, sizeof(hdr.owner));
-	hdr.key_len = GUINT32_TO_LE(bo->key_len);
-	hdr.value_len = GUINT64_TO_LE(obj->written_bytes);
-	hdr.n_blk = GUINT32_TO_LE(obj->n_blk);
-
 	/* update checksum table with final csum, if necessary */
 	if (obj->checked_bytes > 0)
 		obj_flush_csum(bo);
@@ -857,6 +1776,34 @@ bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
 
 	obj->csum_idx = 0;
 
+	/* the table is complete, so the tree digest is one small SHA1 */
+	if (digest == CHD_DIGEST_TREE)
+		SHA1(obj->csum_tbl, obj->csum_tbl_sz, md);
+
+	memset(&hdr, 0, sizeof(hdr));
+	if (obj->pack_buf)
+		memcpy(hdr.magic, BE_FS_OBJ_MAGIC_V1,
+		       strlen(BE_FS_OBJ_MAGIC_V1));
+	else
+		memcpy(hdr.magic, BE_FS_OBJ_MAGIC, strlen(BE_FS_OBJ_MAGIC));
+	memcpy(hdr.hash, md, sizeof(hdr.hash));
+	strncpy(hdr.owner, user, sizeof(hdr.owner));
+	hdr.key_len = GUINT32_TO_LE(bo->key_len);
+	hdr.value_len = GUINT64_TO_LE(obj->written_bytes);
+	hdr.n_blk = GUINT32_TO_LE(obj->n_blk);
+	hdr.digest = digest;
+
+	/* the key index is synced along with the object */
+	if (sync) {
+		sync->fd = -1;
+		sync->dir_fd = -1;
+		sync->pack_table = 0;
+		sync->index_table = obj->table_id;
+	}
+
+	if (obj->pack_buf)
+		return fs_obj_pack_commit(obj, &hdr, user, md, sync);
+
 	/* go back to beginning of file */
 	if (lseek(obj->out_fd, 0, SEEK_SET) < 0) {
 		applog(LOG_ERR, "lseek(%s) failed: %s",
@@ -881,18 +1828,38 @@ bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
 		return false;
 	}
 
-	/* sync data to disk, if requested */
-	if (sync_data && fsync(obj->out_fd) < 0) {
-		applog(LOG_ERR, "fsync(%s) failed: %s",
+	if (fstat(obj->out_fd, &st) < 0) {
+		applog(LOG_ERR, "fstat(%s) failed: %s",
 		       obj->out_fn, strerror(errno));
 		return false;
 	}
 
-	if (close(obj->out_fd) < 0)
+	/*
+	 * A durable write is flushed with others, by the flusher, along
+	 * with the directory entry of the new file.
+	 */
+	if (sync) {
+		sync->dir_fd = fs_obj_pfx_dir_open(obj->table_id, obj->out_fn);
+		if (sync->dir_fd < 0) {
+			applog(LOG_ERR, "open directory of %s failed: %s",
+			       obj->out_fn, strerror(errno));
+			return false;
+		}
+		sync->fd = obj->out_fd;
+	} else if (close(obj->out_fd) < 0)
 		applog(LOG_WARNING, "close(%s) failed: %s",
 		       obj->out_fn, strerror(errno));
 	obj->out_fd = -1;
 
+	fs_obj_uncache(obj->table_id, bo->key, bo->key_len);
+
+	/*
+	 * The object is complete on disk.  An index failure is not
+	 * fatal; selfcheck re-adds objects missing from the index.
+	 */
+	fs_index_put(obj->table_id, bo->key, bo->key_len, user, md,
+		     obj->written_bytes, st.st_mtime);
+
 	free(obj->out_fn);
 	obj->out_fn = NULL;
 
@@ -901,12 +1868,106 @@ bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
 	return true;
 }
 
+/*
+ * Drop whatever is cached about an object being created or removed.
+ */
+void fs_obj_uncache(uint32_t table_id, const void *key, size_t key_len)
+{
+	metacache_invalidate(&chunkd_srv.metas, table_id, key, key_len);
+	fdcache_invalidate(&chunkd_srv.fds, table_id, key, key_len);
+}
+
+/*
+ * Size, mtime and hash of an object from the metadata cache alone, if it
+ * is there and owned by user.  Never touches the disk, so it is cheap
+ * enough to call from a network thread.
+ */
+bool fs_obj_meta_cached(uint32_t table_id, const char *user,
+			const void *key, size_t key_len,
+			struct backend_obj *bo)
+{
+	struct metacache_meta meta;
+	unsigned long gen;
+
+	if (!key_valid(key, key_len))
+		return false;
+
+	if (!metacache_get(&chunkd_srv.metas, table_id, key, key_len,
+			   &meta, NULL, NULL, &gen))
+		return false;
+
+	/* leave the error, if any, to the usual path */
+	if (strcmp(meta.owner, user))
+		return false;
+
+	bo->size = meta.size;
+	bo->mtime = meta.mtime;
+	memcpy(bo->hash, meta.hash, sizeof(bo->hash));
+	return true;
+}
+
+/*
+ * Delete a packed object.  Returns 1 if done, 0 if the key is not
+ * packed, or -1 with *err_code set.
+ */
+static int fs_obj_delete_packed(uint32_t table_id, const char *user,
+				const void *key, size_t key_len,
+				enum chunk_errcode *err_code)
+{
+	struct fs_pack_loc loc;
+	struct be_fs_obj_hdr hdr;
+	ssize_t rrc;
+	char *fn;
+	int fd, rc;
+
+	rc = fs_pack_lookup(table_id, key, key_len, &loc, &fd, &fn);
+	if (rc <= 0)
+		return rc ? -1 : 0;
+
+	rrc = pread(fd, &hdr, sizeof(hdr), loc.ofs);
+	close(fd);
+	if (rrc != sizeof(hdr)) {
+		applog(LOG_ERR, "read hdr obj(%s @ 0x%llx) failed: %s", fn,
+		       (unsigned long long) loc.ofs,
+		       (rrc < 0) ? strerror(errno) : "<short read>");
+		goto err_out;
+	}
+
+	if (G_UNLIKELY(!fs_hdr_version(&hdr)))
+		goto err_out;
+
+	if (strcmp(user, hdr.owner)) {
+		*err_code = che_AccessDenied;
+		goto err_out;
+	}
+
+	/* unlisted first, as for object files */
+	if (!fs_index_del(table_id, key, key_len))
+		goto err_out;
+
+	rc = fs_pack_remove(table_id, key, key_len);
+	fs_obj_uncache(table_id, key, key_len);
+	if (rc <= 0) {
+		if (rc == 0)
+			*err_code = che_NoSuchKey;
+		goto err_out;
+	}
+
+	free(fn);
+	return 1;
+
+err_out:
+	free(fn);
+	return -1;
+}
+
 bool fs_obj_delete(uint32_t table_id, const char *user,
 		   const void *key, size_t key_len,
 		   enum chunk_errcode *err_code)
 {
 	char *fn = NULL;
-	int fd;
+	const char *rel;
+	int fd, dir_fd, rc;
 	ssize_t rrc;
 	struct be_fs_obj_hdr hdr;
 
@@ -917,13 +1978,21 @@ bool fs_obj_delete(uint32_t table_id, const char *user,
 		return false;
 	}
 
+	rc = fs_obj_delete_packed(table_id, user, key, key_len, err_code);
+	if (rc)
+		return rc > 0;
+
 	/* build local fs pathname */
 	fn = fs_obj_pathname(table_id, key, key_len);
 	if (!fn)
 		goto err_out;
 
+	dir_fd = fs_obj_dirfd(table_id, fn, false, &rel);
+	if (dir_fd < 0)
+		goto err_out;
+
 	/* attempt to open object */
-	fd = open(fn, O_RDONLY);
+	fd = openat(dir_fd, rel, O_RDONLY);
 	if (fd < 0) {
 		if (errno == ENOENT)
 			*err_code = che_NoSuchKey;
@@ -952,8 +2021,7 @@ bool fs_obj_delete(uint32_t table_id, const char *user,
 	}
 
 	/* basic sanity check: verify magic number in header */
-	if (G_UNLIKELY(memcmp(hdr.magic, BE_FS_OBJ_MAGIC,
-			      strlen(BE_FS_OBJ_MAGIC)))) {
+	if (G_UNLIKELY(!fs_hdr_version(&hdr))) {
 		*err_code = che_InternalError;
 		goto err_out;
 	}
@@ -964,8 +2032,18 @@ bool fs_obj_delete(uint32_t table_id, const char *user,
 		goto err_out;
 	}
 
-	/* finally, unlink object */
-	if (unlink(fn) < 0) {
+	/* unlisted first, so a crash cannot leave an entry for a
+	 * missing object
+	 */
+	if (!fs_index_del(table_id, key, key_len))
+		goto err_out;
+
+	/* finally, unlink object; forget it only once it is gone, so a
+	 * racing open cannot cache it again
+	 */
+	rrc = unlinkat(dir_fd, rel, 0);
+	fs_obj_uncache(table_id, key, key_len);
+	if (rrc < 0) {
 		if (errno == ENOENT)
 			*err_code = che_NoSuchKey;
 		else
@@ -1021,6 +2099,23 @@ int fs_list_objs_open(struct fs_obj_lister *t,
 	return 0;
 }
 
+/*
+ * A conversion interrupted by a crash leaves its copy behind.  Only the
+ * selfcheck thread converts, and it renames or removes each copy before
+ * going on with its walk, so any such file it comes across is stale.
+ */
+static void fs_list_objs_reap(struct fs_obj_lister *t, const char *name)
+{
+	if (unlinkat(dirfd(t->d), name, 0) < 0) {
+		if (errno == ENOENT)
+			return;
+		applog(LOG_WARNING, "cannot remove %s/%s: %s",
+		       t->sub, name, strerror(errno));
+		return;
+	}
+	applog(LOG_INFO, "removed stale %s/%s", t->sub, name);
+}
+
 /*
  * Get next filename.
  * Return:
@@ -1064,8 +2159,12 @@ again:
 		goto again;
 	}
 
-	if (de->d_name[0] == '.')
+	if (de->d_name[0] == '.') {
+		if (t->reap_tmp && !strncmp(de->d_name, FS_CVT_PFX,
+					    strlen(FS_CVT_PFX)))
+			fs_list_objs_reap(t, de->d_name);
 		goto again;
+	}
 
 	if (asprintf(fnp, "%s/%s", t->sub, de->d_name) < 0)
 		return -1;
@@ -1084,16 +2183,19 @@ void fs_list_objs_close(struct fs_obj_lister *t)
 }
 
 /*
- * Read an object by filename.
+ * Read an object by filename.  value_ofsp and old_fmtp, where the value
+ * starts and whether the file is still CHU1, may be NULL.
  * TODO - possibly factor out some code from fs_obj_open and fs_obj_delete.
  */
 int fs_obj_hdr_read(const char *fn, char **owner, unsigned char *hash,
+		    enum chd_obj_digest *digest,
 		    void **keyp, size_t *klenp, size_t *csumlenp,
+		    off_t *value_ofsp, bool *old_fmtp,
 		    unsigned long long *size, time_t *mtime)
 {
 	struct be_fs_obj_hdr hdr;
 	struct stat st;
-	int fd;
+	int fd, version;
 	ssize_t rrc;
 	void *key_in;
 	size_t klen_in;
@@ -1119,7 +2221,8 @@ int fs_obj_hdr_read(const char *fn, char **owner, unsigned char *hash,
 		goto err_fix;
 	}
 
-	if (memcmp(hdr.magic, BE_FS_OBJ_MAGIC, strlen(BE_FS_OBJ_MAGIC))) {
+	version = fs_hdr_version(&hdr);
+	if (!version) {
 		applog(LOG_WARNING, "%s hdr magic invalid", fn);
 		goto err_fix;
 	}
@@ -1155,6 +2258,10 @@ int fs_obj_hdr_read(const char *fn, char **owner, unsigned char *hash,
 	}
 
 	*csumlenp = GUINT32_FROM_LE(hdr.n_blk) * CHD_CSUM_SZ;
+	if (value_ofsp)
+		*value_ofsp = fs_value_ofs(version, klen_in, *csumlenp);
+	if (old_fmtp)
+		*old_fmtp = (version < 2);
 
 	*owner = strndup(hdr.owner, sizeof(hdr.owner));
 	if (!*owner) {
@@ -1163,6 +2270,7 @@ int fs_obj_hdr_read(const char *fn, char **owner, unsigned char *hash,
 	}
 
 	memcpy(hash, hdr.hash, sizeof(hdr.hash));
+	*digest = hdr.digest;
 
 	*keyp = key_in;
 	*klenp = klen_in;
@@ -1182,97 +2290,20 @@ int fs_obj_hdr_read(const char *fn, char **owner, unsigned char *hash,
 	return -1;
 }
 
-GList *fs_list_objs(uint32_t table_id, const char *user)
-{
-	struct fs_obj_lister lister;
-	GList *res = NULL;
-	char *fn;
-	int rc;
-
-	memset(&lister, 0, sizeof(struct fs_obj_lister));
-	rc = fs_list_objs_open(&lister, chunkd_srv.vol_path, table_id);
-	if (rc) {
-		applog(LOG_WARNING, "Cannot open table %u: %s", table_id,
-		       strerror(-rc));
-		return NULL;
-	}
-
-	while (fs_list_objs_next(&lister, &fn) > 0) {
-		char *owner;
-		unsigned long long size;
-		time_t mtime;
-		struct volume_entry *ve;
-		void *p;
-		unsigned char md[CHD_CSUM_SZ];
-		size_t alloc_len;
-		void *key_in;
-		size_t klen_in, csumlen_in;
-		char hashstr[(CHD_CSUM_SZ * 2) + 1];
-
-		rc = fs_obj_hdr_read(fn, &owner, md, &key_in, &klen_in,
-				     &csumlen_in, &size, &mtime);
-		if (rc < 0) {
-			free(fn);
-			break;
-		}
-		free(fn);
-
-		hexstr(md, CHD_CSUM_SZ, hashstr);
-
-		/* filter out results that do not match
-		 * the authenticated user
-		 */
-		if (strcmp(user, owner)) {
-			free(owner);
-			free(key_in);
-			continue;
-		}
-
-		/* one alloc, for fixed + var length struct */
-		alloc_len = sizeof(*ve) + strlen(hashstr)+1 + strlen(owner) + 1;
-
-		ve = malloc(alloc_len);
-		if (!ve) {
-			free(owner);
-			free(key_in);
-			applog(LOG_ERR, "OOM");
-			break;
-		}
-
-		/* store fixed-length portion of struct */
-		ve->size = size;
-		ve->mtime = mtime;
-		ve->key = key_in;
-		ve->key_len = klen_in;
-
-		/*
-		 * store variable-length portion of struct:
-		 * checksum, owner strings
-		 */
-
-		p = (ve + 1);
-		ve->hash = p;
-		strcpy(ve->hash, hashstr);
-
-		p += strlen(ve->hash) + 1;
-		ve->owner = p;
-		strcpy(ve->owner, owner);
-
-		/* add entry to result list */
-		res = g_list_append(res, ve);
-
-		free(owner);
-	}
-
-	fs_list_objs_close(&lister);
-	return res;
-}
-
-int fs_obj_do_sum(const char *fn, unsigned int klen, unsigned int csumlen,
-		  unsigned char *md)
+/*
+ * Recompute the object digest from the data on disk.  For tree digests
+ * the block checksums are rebuilt from the data, several blocks at a
+ * time, and the root taken over them; a damaged block or a damaged
+ * stored table both show up as a root mismatch.
+ */
+int fs_obj_do_sum(const char *fn, off_t value_ofs, unsigned int csumlen,
+		  enum chd_obj_digest digest, unsigned char *md)
 {
-	enum { BUFLEN = 128 * 1024 };
+	enum { BUFLEN = CSUM_MAX_LANES * CHUNK_BLK_SZ };
 	void *buf;
+	unsigned char *tbl = NULL;
+	size_t tbl_ofs = 0, tbl_need;
+	bool overflow = false;
 	int fd;
 	ssize_t rrc;
 	int rc;
@@ -1282,14 +2313,18 @@ int fs_obj_do_sum(const char *fn, unsigned int klen, unsigned int csumlen,
 	buf = malloc(BUFLEN);
 	if (!buf)
 		goto err_alloc;
+	if (digest == CHD_DIGEST_TREE) {
+		tbl = malloc(csumlen ? csumlen : 1);
+		if (!tbl)
+			goto err_tbl;
+	}
 
 	fd = open(fn, O_RDONLY);
 	if (fd == -1) {
 		rc = errno;
 		goto err_open;
 	}
-	if (lseek(fd, sizeof(struct be_fs_obj_hdr) + klen + csumlen,
-		  SEEK_SET) == (off_t)-1) {
+	if (lseek(fd, value_ofs, SEEK_SET) == (off_t)-1) {
 		rc = errno;
 		goto err_seek;
 	}
@@ -1301,14 +2336,31 @@ int fs_obj_do_sum(const char *fn, unsigned int klen, unsigned int csumlen,
 			rc = errno;
 			goto err_read;
 		}
-		if (rrc != 0)
+		if (rrc != 0 && digest != CHD_DIGEST_TREE)
 			SHA1_Update(&hash, buf, rrc);
+		else if (rrc != 0) {
+			tbl_need = ((rrc + CHUNK_BLK_MASK) >> CHUNK_BLK_ORDER) *
+				   CHD_CSUM_SZ;
+			if (tbl_ofs + tbl_need > csumlen) {
+				overflow = true;
+				break;
+			}
+			csum_blocks(buf, rrc, CHUNK_BLK_SZ, tbl + tbl_ofs);
+			tbl_ofs += tbl_need;
+		}
 		if (rrc < BUFLEN)
 			break;
 	}
-	SHA1_Final(md, &hash);
+
+	if (digest != CHD_DIGEST_TREE)
+		SHA1_Final(md, &hash);
+	else if (overflow || tbl_ofs != csumlen)
+		memset(md, 0, CHD_CSUM_SZ);	/* length mismatch; never valid */
+	else
+		SHA1(tbl, csumlen, md);
 
 	close(fd);
+	free(tbl);
 	free(buf);
 	return 0;
 
@@ -1316,8 +2368,275 @@ int fs_obj_do_sum(const char *fn, unsigned int klen, unsigned int csumlen,
 	close(fd);
  err_seek:
  err_open:
+	free(tbl);
+ err_tbl:
 	free(buf);
  err_alloc:
 	return -rc;
 }
 
+/*
+ * Verify a packed object for selfcheck: every block of the value
+ * against the csum table, and the digest in the header.  Returns 1 with
+ * its listing attributes if it checks out, 0 if it is damaged, -ENOENT
+ * if the key is not packed (any more), or another negative error.
+ */
+int fs_obj_pack_verify(uint32_t table_id, const void *key, size_t key_len,
+		       char **owner, unsigned char *md,
+		       unsigned long long *size, time_t *mtime)
+{
+	enum { BUFLEN = CSUM_MAX_LANES * CHUNK_BLK_SZ };
+	struct be_fs_obj_hdr hdr;
+	struct fs_pack_loc loc;
+	unsigned char md_act[CHD_CSUM_SZ];
+	unsigned char *tbl = NULL;
+	void *buf = NULL;
+	uint64_t value_len, pos;
+	size_t csum_len, n;
+	off_t value_ofs;
+	char *fn;
+	SHA_CTX hash;
+	int fd, rc;
+
+	rc = fs_pack_lookup(table_id, key, key_len, &loc, &fd, &fn);
+	if (rc <= 0)
+		return rc ? rc : -ENOENT;
+
+	/* damaged, unless it reads back whole */
+	rc = 0;
+	if (pread(fd, &hdr, sizeof(hdr), loc.ofs) != sizeof(hdr) ||
+	    fs_hdr_version(&hdr) != 1 ||
+	    GUINT32_FROM_LE(hdr.key_len) != key_len)
+		goto out;
+
+	value_len = GUINT64_FROM_LE(hdr.value_len);
+	if (fs_blk_count(value_len) != GUINT32_FROM_LE(hdr.n_blk))
+		goto out;
+	csum_len = GUINT32_FROM_LE(hdr.n_blk) * CHD_CSUM_SZ;
+	value_ofs = fs_value_ofs(1, key_len, csum_len);
+	if (value_ofs + value_len > loc.len)
+		goto out;
+
+	rc = -ENOMEM;
+	tbl = malloc(csum_len ? csum_len : 1);
+	buf = malloc(BUFLEN);
+	if (!tbl || !buf)
+		goto out;
+
+	rc = 0;
+	if (pread(fd, tbl, csum_len, loc.ofs + sizeof(hdr) + key_len) !=
+	    csum_len)
+		goto out;
+
+	SHA1_Init(&hash);
+	for (pos = 0; pos < value_len; pos += n) {
+		n = MIN(BUFLEN, value_len - pos);
+		if (pread(fd, buf, n, loc.ofs + value_ofs + pos) != n)
+			goto out;
+		if (csum_verify_blocks(buf, n, CHUNK_BLK_SZ,
+			tbl + (pos >> CHUNK_BLK_ORDER) * CHD_CSUM_SZ) >= 0)
+			goto out;
+		if (hdr.digest != CHD_DIGEST_TREE)
+			SHA1_Update(&hash, buf, n);
+	}
+
+	/* the table matches the data, so the tree root is taken over it */
+	if (hdr.digest == CHD_DIGEST_TREE)
+		SHA1(tbl, csum_len, md_act);
+	else
+		SHA1_Final(md_act, &hash);
+	if (memcmp(md_act, hdr.hash, sizeof(md_act)))
+		goto out;
+
+	rc = -ENOMEM;
+	*owner = strndup(hdr.owner, sizeof(hdr.owner));
+	if (!*owner)
+		goto out;
+
+	memcpy(md, hdr.hash, sizeof(hdr.hash));
+	*size = value_len;
+	*mtime = loc.mtime;
+	rc = 1;
+
+out:
+	if (!rc)
+		applog(LOG_INFO, "chk: packed object in %s damaged", fn);
+	close(fd);
+	free(fn);
+	free(tbl);
+	free(buf);
+	return rc;
+}
+
+struct fs_convert_swap {
+	const char		*tmp_fn;
+	const char		*fn;
+	const struct stat	*st;
+	int			rc;		/* 1: dropped */
+};
+
+/* put the copy in place, if the file is still the one copied */
+static void fs_obj_convert_swap(void *arg)
+{
+	struct fs_convert_swap *sw = arg;
+	struct stat st_now;
+
+	if (stat(sw->fn, &st_now) < 0 || st_now.st_ino != sw->st->st_ino ||
+	    st_now.st_mtime != sw->st->st_mtime) {
+		sw->rc = 1;
+		return;
+	}
+
+	sw->rc = 0;
+	if (rename(sw->tmp_fn, sw->fn) < 0)
+		sw->rc = -errno;
+}
+
+/*
+ * Rewrite a CHU1 object file in the current format, under the same
+ * name.  The caller holds cep for the key: if a PUT or DEL of the key
+ * starts meanwhile, or the file is replaced or removed, the copy is
+ * dropped instead.  The final check and the rename are one step under
+ * the objcache lock, and both PUT and DEL mark cep dirty first, so
+ * neither can slip in between.  The mtime is kept, so the index entry
+ * stays valid.  Returns 0 if converted or dropped, else -errno.
+ */
+int fs_obj_convert(uint32_t table_id, const char *fn,
+		   const void *key, size_t key_len,
+		   struct objcache_entry *cep)
+{
+	enum { BUFLEN = 16 * CHUNK_BLK_SZ };
+	struct be_fs_obj_hdr *hdr;
+	struct fs_convert_swap sw;
+	struct timespec times[2];
+	struct stat st;
+	off_t in_ofs, out_ofs, pos;
+	uint64_t value_len;
+	size_t csum_len, n;
+	char *tmp_fn = NULL, *dir_fn;
+	const char *base;
+	void *meta = NULL, *buf = NULL;
+	ssize_t rrc;
+	int in_fd, out_fd = -1, dir_fd;
+	int rc = -ENOMEM;
+
+	in_fd = open(fn, O_RDONLY);
+	if (in_fd < 0)
+		return -errno;
+
+	meta = malloc(sizeof(*hdr) + key_len);
+	buf = malloc(BUFLEN);
+	if (!meta || !buf)
+		goto out;
+	hdr = meta;
+
+	rc = -EIO;
+	if (fstat(in_fd, &st) < 0 ||
+	    pread(in_fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr))
+		goto out;
+	if (fs_hdr_version(hdr) != 1) {
+		rc = 0;			/* already done */
+		goto out;
+	}
+
+	value_len = GUINT64_FROM_LE(hdr->value_len);
+	csum_len = GUINT32_FROM_LE(hdr->n_blk) * CHD_CSUM_SZ;
+	in_ofs = fs_value_ofs(1, key_len, csum_len);
+	out_ofs = fs_value_ofs(2, key_len, csum_len);
+
+	/* the metadata area is copied as is, but for the magic */
+	rc = -ENOMEM;
+	free(meta);
+	meta = calloc(1, out_ofs);
+	if (!meta)
+		goto out;
+	hdr = meta;
+
+	rc = -EIO;
+	if (pread(in_fd, meta, in_ofs, 0) != in_ofs)
+		goto out;
+	memcpy(hdr->magic, BE_FS_OBJ_MAGIC, strlen(BE_FS_OBJ_MAGIC));
+
+	/* a dot name: listings skip it, selfcheck reaps it after a crash */
+	rc = -ENOMEM;
+	base = strrchr(fn, '/');
+	base = base ? base + 1 : fn;
+	if (asprintf(&tmp_fn, "%.*s" FS_CVT_PFX "%s", (int) (base - fn), fn,
+		     base) < 0) {
+		tmp_fn = NULL;
+		goto out;
+	}
+
+	out_fd = open(tmp_fn, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (out_fd < 0) {
+		rc = -errno;
+		syslogerr(tmp_fn);
+		goto out;
+	}
+
+	rc = -EIO;
+	if (fs_obj_prealloc(out_fd, tmp_fn, out_ofs + value_len) < 0)
+		goto out_unlink;
+	if (pwrite(out_fd, meta, out_ofs, 0) != out_ofs)
+		goto out_unlink;
+
+	for (pos = 0; pos < value_len; pos += n) {
+		n = MIN(BUFLEN, value_len - pos);
+		rrc = pread(in_fd, buf, n, in_ofs + pos);
+		if (rrc != n)
+			goto out_unlink;
+		if (pwrite(out_fd, buf, n, out_ofs + pos) != n)
+			goto out_unlink;
+	}
+
+	times[0] = st.st_atim;
+	times[1] = st.st_mtim;
+	if (futimens(out_fd, times) < 0 || fsync(out_fd) < 0)
+		goto out_unlink;
+
+	/* give up on anything that touched the object meanwhile */
+	sw.tmp_fn = tmp_fn;
+	sw.fn = fn;
+	sw.st = &st;
+	if (!objcache_run_clean(&chunkd_srv.actives, cep,
+				fs_obj_convert_swap, &sw) || sw.rc > 0) {
+		rc = 0;
+		goto out_unlink;
+	}
+	if (sw.rc < 0) {
+		rc = sw.rc;
+		applog(LOG_ERR, "rename(%s, %s) failed: %s",
+		       tmp_fn, fn, strerror(-rc));
+		goto out_unlink;
+	}
+
+	fs_obj_uncache(table_id, key, key_len);
+
+	/* the new name must reach the disk, as the copy did */
+	dir_fn = strndup(fn, base - fn);
+	dir_fd = dir_fn ? open(dir_fn, O_RDONLY | O_DIRECTORY) : -1;
+	if (dir_fd < 0 || fsync(dir_fd) < 0)
+		applog(LOG_WARNING, "cannot sync directory of %s: %s",
+		       fn, strerror(errno));
+	if (dir_fd >= 0)
+		close(dir_fd);
+	free(dir_fn);
+
+	if (debugging)
+		applog(LOG_DEBUG, "converted %s to %s", fn, BE_FS_OBJ_MAGIC);
+	rc = 0;
+	goto out;
+
+out_unlink:
+	if (rc == -EIO)
+		applog(LOG_WARNING, "cannot convert %s, left as is", fn);
+	unlink(tmp_fn);
+out:
+	if (out_fd >= 0)
+		close(out_fd);
+	close(in_fd);
+	free(tmp_fn);
+	free(buf);
+	free(meta);
+	return rc;
+}
@@ -0,0 +1,507 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * Per-table key index.
+ *
+ * Each table directory holds index.tcb, a B+tree mapping object key to
+ * the listing attributes of that object (size, mtime, hash, owner), so
+ * that LIST is a range scan of one file instead of a walk over every
+ * object header in the table.
+ *
+ * The object files remain authoritative.  A commit writes the object
+ * first and then the index entry; a delete removes the index entry
+ * first and then the object.  A crash between the two steps can thus
+ * only leave an object that is missing from the index, never an entry
+ * for an object that is gone, and selfcheck puts missing entries back,
+ * walking pack.tch for the packed objects.
+ * A table without an index file (older volumes) is indexed from its
+ * object files when first opened.
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <tcutil.h>
+#include <tcbdb.h>
+#include <chunk-private.h>
+#include "chunkd.h"
+
+#define FS_INDEX_FN	"index.tcb"
+
+/* on-disk index value; the key is the object key */
+struct fs_index_ent {
+	uint64_t		size;
+	uint64_t		mtime;
+	unsigned char		hash[CHD_CSUM_SZ];
+	char			owner[0];	/* nul-terminated */
+} __attribute__ ((packed));
+
+static char *fs_index_pathname(uint32_t table_id, const char *suffix)
+{
+	char *s;
+
+	if (asprintf(&s, MDB_TPATH_FMT "/" FS_INDEX_FN "%s",
+		     chunkd_srv.vol_path, table_id, suffix) < 0)
+		return NULL;
+	return s;
+}
+
+static bool fs_index_store(TCBDB *bdb, const void *key, size_t key_len,
+			   const char *owner, const unsigned char *hash,
+			   uint64_t size, time_t mtime)
+{
+	struct fs_index_ent *ent;
+	size_t ent_len;
+	bool rcb;
+
+	ent_len = sizeof(*ent) + strlen(owner) + 1;
+	ent = malloc(ent_len);
+	if (!ent)
+		return false;
+
+	ent->size = GUINT64_TO_LE(size);
+	ent->mtime = GUINT64_TO_LE(mtime);
+	memcpy(ent->hash, hash, CHD_CSUM_SZ);
+	strcpy(ent->owner, owner);
+
+	rcb = tcbdbput(bdb, key, key_len, ent, ent_len);
+
+	free(ent);
+	return rcb;
+}
+
+/*
+ * Build the index of a table from its object files, into a scratch file
+ * that is renamed into place only once complete.
+ */
+static int fs_index_rebuild(uint32_t table_id, const char *fn)
+{
+	struct fs_obj_lister lister;
+	TCBDB *bdb;
+	char *tmp_fn, *obj_fn;
+	unsigned long count = 0;
+	int rc;
+
+	tmp_fn = fs_index_pathname(table_id, ".tmp");
+	if (!tmp_fn)
+		return -ENOMEM;
+
+	applog(LOG_INFO, "Building key index for table %u", table_id);
+
+	rc = -ENOMEM;
+	bdb = tcbdbnew();
+	if (!bdb)
+		goto out_fn;
+
+	rc = -EIO;
+	if (!tcbdbopen(bdb, tmp_fn, BDBOWRITER | BDBOCREAT | BDBOTRUNC)) {
+		applog(LOG_ERR, "failed to create index %s: %s", tmp_fn,
+		       tcbdberrmsg(tcbdbecode(bdb)));
+		goto out_bdb;
+	}
+
+	memset(&lister, 0, sizeof(struct fs_obj_lister));
+	rc = fs_list_objs_open(&lister, chunkd_srv.vol_path, table_id);
+	if (rc) {
+		applog(LOG_WARNING, "Cannot open table %u: %s", table_id,
+		       strerror(-rc));
+		goto out_close;
+	}
+
+	while (fs_list_objs_next(&lister, &obj_fn) > 0) {
+		char *owner;
+		unsigned long long size;
+		time_t mtime;
+		unsigned char md[CHD_CSUM_SZ];
+		enum chd_obj_digest digest;
+		void *key_in;
+		size_t klen_in, csumlen_in;
+
+		/* unreadable objects are left for selfcheck to judge */
+		if (fs_obj_hdr_read(obj_fn, &owner, md, &digest, &key_in,
+				    &klen_in, &csumlen_in, NULL, NULL,
+				    &size, &mtime) == 0) {
+			if (fs_index_store(bdb, key_in, klen_in, owner, md,
+					   size, mtime))
+				count++;
+			free(owner);
+			free(key_in);
+		}
+		free(obj_fn);
+	}
+
+	fs_list_objs_close(&lister);
+
+	if (!tcbdbclose(bdb)) {
+		rc = -EIO;
+		goto out_bdb;
+	}
+
+	if (rename(tmp_fn, fn) < 0) {
+		rc = -errno;
+		applog(LOG_ERR, "rename(%s, %s) failed: %s",
+		       tmp_fn, fn, strerror(errno));
+		goto out_bdb;
+	}
+
+	applog(LOG_INFO, "Key index for table %u: %lu objects",
+	       table_id, count);
+	rc = 0;
+	goto out_bdb;
+
+out_close:
+	tcbdbclose(bdb);
+	unlink(tmp_fn);
+out_bdb:
+	tcbdbdel(bdb);
+out_fn:
+	free(tmp_fn);
+	return rc;
+}
+
+/*
+ * Open the index of a table, building it first if the table has none.
+ * Called with tbl_index_lock held.
+ */
+static TCBDB *__fs_index_open(uint32_t table_id, bool creat)
+{
+	TCBDB *bdb;
+	char *fn;
+
+	fn = fs_index_pathname(table_id, "");
+	if (!fn)
+		return NULL;
+
+	if (!creat && access(fn, F_OK) < 0 && errno == ENOENT &&
+	    fs_index_rebuild(table_id, fn) < 0)
+		goto err_out;
+
+	bdb = tcbdbnew();
+	if (!bdb)
+		goto err_out;
+
+	if (!tcbdbsetmutex(bdb))
+		goto err_out_bdb;
+
+	if (!tcbdbopen(bdb, fn, BDBOREADER | BDBOWRITER | BDBOCREAT)) {
+		applog(LOG_ERR, "failed to open index %s: %s", fn,
+		       tcbdberrmsg(tcbdbecode(bdb)));
+		goto err_out_bdb;
+	}
+
+	g_hash_table_insert(chunkd_srv.tbl_index, GUINT_TO_POINTER(table_id),
+			    bdb);
+
+	free(fn);
+	return bdb;
+
+err_out_bdb:
+	tcbdbdel(bdb);
+err_out:
+	free(fn);
+	return NULL;
+}
+
+static TCBDB *fs_index_get(uint32_t table_id)
+{
+	TCBDB *bdb;
+
+	g_mutex_lock(chunkd_srv.tbl_index_lock);
+	bdb = g_hash_table_lookup(chunkd_srv.tbl_index,
+				  GUINT_TO_POINTER(table_id));
+	if (!bdb)
+		bdb = __fs_index_open(table_id, false);
+	g_mutex_unlock(chunkd_srv.tbl_index_lock);
+
+	if (!bdb)
+		applog(LOG_ERR, "no key index for table %u", table_id);
+	return bdb;
+}
+
+/*
+ * Open or create the index of a table.  A newly created table is empty,
+ * so its index is created empty instead of being built.
+ */
+int fs_index_open(uint32_t table_id, bool new_table)
+{
+	TCBDB *bdb;
+
+	g_mutex_lock(chunkd_srv.tbl_index_lock);
+	bdb = g_hash_table_lookup(chunkd_srv.tbl_index,
+				  GUINT_TO_POINTER(table_id));
+	if (!bdb)
+		bdb = __fs_index_open(table_id, new_table);
+	g_mutex_unlock(chunkd_srv.tbl_index_lock);
+
+	return bdb ? 0 : -EIO;
+}
+
+bool fs_index_put(uint32_t table_id, const void *key, size_t key_len,
+		  const char *owner, const unsigned char *hash,
+		  uint64_t size, time_t mtime)
+{
+	TCBDB *bdb;
+
+	bdb = fs_index_get(table_id);
+	if (!bdb)
+		return false;
+
+	if (!tcbdbtranbegin(bdb))
+		goto err_out;
+	if (!fs_index_store(bdb, key, key_len, owner, hash, size, mtime)) {
+		tcbdbtranabort(bdb);
+		goto err_out;
+	}
+	if (!tcbdbtrancommit(bdb))
+		goto err_out;
+
+	return true;
+
+err_out:
+	applog(LOG_ERR, "index put, table %u: %s", table_id,
+	       tcbdberrmsg(tcbdbecode(bdb)));
+	return false;
+}
+
+bool fs_index_del(uint32_t table_id, const void *key, size_t key_len)
+{
+	TCBDB *bdb;
+
+	bdb = fs_index_get(table_id);
+	if (!bdb)
+		return false;
+
+	if (!tcbdbtranbegin(bdb))
+		goto err_out;
+	if (!tcbdbout(bdb, key, key_len) && tcbdbecode(bdb) != TCENOREC) {
+		tcbdbtranabort(bdb);
+		goto err_out;
+	}
+	if (!tcbdbtrancommit(bdb))
+		goto err_out;
+
+	return true;
+
+err_out:
+	applog(LOG_ERR, "index del, table %u: %s", table_id,
+	       tcbdberrmsg(tcbdbecode(bdb)));
+	return false;
+}
+
+/* for durable commits, once their entries are in */
+int fs_index_sync(uint32_t table_id)
+{
+	TCBDB *bdb;
+
+	bdb = fs_index_get(table_id);
+	if (!bdb)
+		return -EIO;
+
+	if (!tcbdbsync(bdb)) {
+		applog(LOG_ERR, "index sync, table %u: %s", table_id,
+		       tcbdberrmsg(tcbdbecode(bdb)));
+		return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * Make sure the index agrees with the header of object file fn.  Used by
+ * selfcheck to repair entries lost to a crash between object commit and
+ * index put.
+ */
+void fs_index_check(uint32_t table_id, const char *fn,
+		    const void *key, size_t key_len,
+		    const char *owner, const unsigned char *hash,
+		    uint64_t size, time_t mtime)
+{
+	struct fs_index_ent *ent;
+	TCBDB *bdb;
+	int vlen;
+	bool ok;
+
+	bdb = fs_index_get(table_id);
+	if (!bdb)
+		return;
+
+	ent = tcbdbget(bdb, key, key_len, &vlen);
+	ok = ent && vlen > sizeof(*ent) &&
+	     GUINT64_FROM_LE(ent->size) == size &&
+	     !memcmp(ent->hash, hash, CHD_CSUM_SZ) &&
+	     !strncmp(ent->owner, owner, vlen - sizeof(*ent));
+	free(ent);
+
+	/*
+	 * the object may have been deleted since its header was read;
+	 * without fn, the caller keeps that from happening
+	 */
+	if (!ok && (!fn || access(fn, F_OK) == 0)) {
+		applog(LOG_INFO, "chk: re-indexing %s",
+		       fn ? fn : "packed object");
+		fs_index_put(table_id, key, key_len, owner, hash, size, mtime);
+	}
+}
+
+static void fs_index_close_one(gpointer key, gpointer val, gpointer user_data)
+{
+	TCBDB *bdb = val;
+
+	tcbdbclose(bdb);
+	tcbdbdel(bdb);
+}
+
+void fs_index_close_all(void)
+{
+	if (!chunkd_srv.tbl_index)
+		return;
+
+	g_mutex_lock(chunkd_srv.tbl_index_lock);
+	g_hash_table_foreach(chunkd_srv.tbl_index, fs_index_close_one, NULL);
+	g_hash_table_destroy(chunkd_srv.tbl_index);
+	chunkd_srv.tbl_index = NULL;
+	g_mutex_unlock(chunkd_srv.tbl_index_lock);
+}
+
+/* the index orders keys like memcmp, shorter keys first on a tie */
+static int fs_index_keycmp(const void *a, size_t a_len,
+			   const void *b, size_t b_len)
+{
+	int rc = memcmp(a, b, MIN(a_len, b_len));
+
+	if (rc)
+		return rc;
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+/*
+ * List the objects of a table owned by user, in key order: those whose
+ * keys begin with prefix and sort after marker (either may be empty),
+ * at most max_keys of them (0: no limit).  *truncated tells whether
+ * more such keys remain.
+ */
+GList *fs_list_objs(uint32_t table_id, const char *user,
+		    const void *prefix, size_t prefix_len,
+		    const void *marker, size_t marker_len,
+		    unsigned int max_keys, bool *truncated)
+{
+	GList *res = NULL;
+	unsigned int n_keys = 0;
+	TCBDB *bdb;
+	BDBCUR *cur;
+	bool found;
+
+	*truncated = false;
+
+	bdb = fs_index_get(table_id);
+	if (!bdb)
+		return NULL;
+
+	cur = tcbdbcurnew(bdb);
+	if (!cur)
+		return NULL;
+
+	/* keys with a common prefix are adjacent, starting at the prefix */
+	if (marker_len &&
+	    fs_index_keycmp(marker, marker_len, prefix, prefix_len) > 0)
+		found = tcbdbcurjump(cur, marker, marker_len);
+	else if (prefix_len)
+		found = tcbdbcurjump(cur, prefix, prefix_len);
+	else
+		found = tcbdbcurfirst(cur);
+	if (!found)
+		goto out;
+
+	do {
+		const struct fs_index_ent *ent;
+		struct volume_entry *ve;
+		const void *key;
+		int klen, vlen;
+		size_t owner_len, alloc_len;
+		void *p;
+
+		key = tcbdbcurkey3(cur, &klen);
+		ent = tcbdbcurval3(cur, &vlen);
+		if (!key || !ent || vlen <= sizeof(*ent))
+			continue;
+		owner_len = vlen - sizeof(*ent);
+
+		if (klen < prefix_len || memcmp(key, prefix, prefix_len))
+			break;		/* past the prefix range */
+		if (marker_len &&
+		    fs_index_keycmp(key, klen, marker, marker_len) <= 0)
+			continue;	/* the marker itself */
+
+		/* filter out results that do not match
+		 * the authenticated user
+		 */
+		if (strncmp(user, ent->owner, owner_len))
+			continue;
+
+		if (max_keys && n_keys == max_keys) {
+			*truncated = true;
+			break;
+		}
+
+		/* one alloc, for fixed + var length struct */
+		alloc_len = sizeof(*ve) + owner_len;
+
+		ve = malloc(alloc_len);
+		if (!ve) {
+			applog(LOG_ERR, "OOM");
+			break;
+		}
+
+		ve->key = g_memdup(key, klen);
+		if (!ve->key) {
+			free(ve);
+			applog(LOG_ERR, "OOM");
+			break;
+		}
+
+		/* store fixed-length portion of struct */
+		ve->size = GUINT64_FROM_LE(ent->size);
+		ve->mtime = GUINT64_FROM_LE(ent->mtime);
+		ve->key_len = klen;
+
+		memcpy(ve->hash, ent->hash, CHD_CSUM_SZ);
+
+		/* store variable-length portion of struct: owner string */
+		p = (ve + 1);
+		ve->owner = p;
+		memcpy(ve->owner, ent->owner, owner_len);
+		ve->owner[owner_len - 1] = 0;
+
+		/* add entry to result list; reversed below */
+		res = g_list_prepend(res, ve);
+		n_keys++;
+	} while (tcbdbcurnext(cur));
+
+out:
+	tcbdbcurdel(cur);
+	return g_list_reverse(res);
+}
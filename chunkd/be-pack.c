@@ -0,0 +1,905 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * Pack segments, for small objects.
+ *
+ * An object smaller than PackThreshold does not get a file of its own.
+ * Its record -- the same header, key, checksum table and value that
+ * make up an object file -- is appended to the current segment of its
+ * table, pack.NNNNNNNN in the table directory, and pack.tch maps the
+ * key to the segment, offset and length of the record.  pack.tch is
+ * authoritative for packed objects, as object files are for the rest.
+ *
+ * Deleting a packed object only drops its pack.tch entry, leaving the
+ * record as dead space.  Selfcheck compacts every segment but the
+ * current one once at least half of it is dead: the live records are
+ * appended to the current segment, and the old segment is unlinked.
+ * Readers use their own descriptor of a segment, so it may go away
+ * under them.
+ *
+ * Before that, selfcheck verifies every live record through
+ * fs_pack_foreach(), and puts its key back into index.tcb if a crash
+ * between append and indexing left it out.
+ *
+ * A key is either packed or has a file of its own.  A small PUT claims
+ * its key in the table's claims set when it starts, and drops the claim
+ * once the key is in pack.tch; a large PUT creates its file under the
+ * same lock, after checking both.
+ *
+ * All state of a table is under the lock of its struct fs_pack.
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <tcutil.h>
+#include <tchdb.h>
+#include <chunk-private.h>
+#include "chunkd.h"
+
+#define FS_PACK_IDX_FN		"pack.tch"
+#define FS_PACK_SEG_PFX		"pack."
+
+enum {
+	FS_PACK_SEG_MAX		= 64 * 1024 * 1024,	/* segment size */
+	FS_PACK_SCAN_BATCH	= 1024,		/* keys per lock hold */
+};
+
+/* on-disk pack.tch value; the key is the object key */
+struct fs_pack_ent {
+	uint32_t		seg;
+	uint32_t		len;
+	uint64_t		ofs;
+	uint64_t		mtime;
+} __attribute__ ((packed));
+
+struct fs_pack_seg {
+	uint32_t		id;
+	int			fd;
+	uint64_t		size;		/* bytes appended */
+	uint64_t		live;		/* bytes of indexed records */
+};
+
+struct fs_pack {
+	GMutex			*lock;
+	bool			probed;		/* looked for pack.tch */
+	TCHDB			*hdb;		/* NULL: no packs (yet) */
+	GHashTable		*segs;		/* segment id -> fs_pack_seg */
+	struct fs_pack_seg	*cur;		/* appended to */
+	GHashTable		*claims;	/* keys of small PUTs, GString */
+};
+
+static char *fs_pack_seg_pathname(uint32_t table_id, uint32_t id)
+{
+	char *s;
+
+	if (asprintf(&s, MDB_TPATH_FMT "/" FS_PACK_SEG_PFX "%08x",
+		     chunkd_srv.vol_path, table_id, id) < 0)
+		return NULL;
+	return s;
+}
+
+static void fs_pack_seg_free(gpointer data)
+{
+	struct fs_pack_seg *seg = data;
+
+	close(seg->fd);
+	free(seg);
+}
+
+static struct fs_pack_seg *fs_pack_seg_open(struct fs_pack *pk,
+					    uint32_t table_id, uint32_t id,
+					    bool creat)
+{
+	struct fs_pack_seg *seg;
+	struct stat st;
+	char *fn;
+
+	fn = fs_pack_seg_pathname(table_id, id);
+	if (!fn)
+		return NULL;
+
+	seg = calloc(1, sizeof(*seg));
+	if (!seg)
+		goto err_out;
+	seg->id = id;
+
+	seg->fd = open(fn, creat ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+	if (seg->fd < 0) {
+		syslogerr(fn);
+		goto err_out_seg;
+	}
+
+	if (fstat(seg->fd, &st) < 0) {
+		syslogerr(fn);
+		goto err_out_fd;
+	}
+	seg->size = st.st_size;
+
+	g_hash_table_insert(pk->segs, GUINT_TO_POINTER(id), seg);
+
+	free(fn);
+	return seg;
+
+err_out_fd:
+	close(seg->fd);
+err_out_seg:
+	free(seg);
+err_out:
+	free(fn);
+	return NULL;
+}
+
+/* open every segment file of the table; the newest is appended to */
+static bool __fs_pack_load_segs(struct fs_pack *pk, uint32_t table_id)
+{
+	struct fs_pack_seg *seg;
+	struct dirent *de;
+	unsigned long id;
+	char *path, *end;
+	DIR *d;
+	bool ok = true;
+
+	if (asprintf(&path, MDB_TPATH_FMT, chunkd_srv.vol_path, table_id) < 0)
+		return false;
+
+	d = opendir(path);
+	if (!d) {
+		syslogerr(path);
+		free(path);
+		return false;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (strlen(de->d_name) != strlen(FS_PACK_SEG_PFX) + 8 ||
+		    strncmp(de->d_name, FS_PACK_SEG_PFX,
+			    strlen(FS_PACK_SEG_PFX)))
+			continue;
+		id = strtoul(de->d_name + strlen(FS_PACK_SEG_PFX), &end, 16);
+		if (*end || !id)
+			continue;
+
+		seg = fs_pack_seg_open(pk, table_id, id, false);
+		if (!seg) {
+			ok = false;
+			break;
+		}
+		if (!pk->cur || seg->id > pk->cur->id)
+			pk->cur = seg;
+	}
+
+	closedir(d);
+	free(path);
+	return ok;
+}
+
+/* count the live bytes of each segment */
+static void __fs_pack_load_live(struct fs_pack *pk, uint32_t table_id)
+{
+	struct fs_pack_ent ent;
+	struct fs_pack_seg *seg;
+	void *kbuf;
+	int klen;
+
+	tchdbiterinit(pk->hdb);
+	while ((kbuf = tchdbiternext(pk->hdb, &klen)) != NULL) {
+		if (tchdbget3(pk->hdb, kbuf, klen, &ent,
+			      sizeof(ent)) == sizeof(ent)) {
+			seg = g_hash_table_lookup(pk->segs,
+				GUINT_TO_POINTER(GUINT32_FROM_LE(ent.seg)));
+			if (seg)
+				seg->live += GUINT32_FROM_LE(ent.len);
+			else
+				applog(LOG_ERR, "table %u: packed object in "
+				       "missing segment %x", table_id,
+				       GUINT32_FROM_LE(ent.seg));
+		}
+		free(kbuf);
+	}
+}
+
+/*
+ * Open pack.tch and the segments of a table, once.  Without creat, a
+ * table that never had packed objects is only looked at the first
+ * time.  Called with pk->lock held.
+ */
+static bool __fs_pack_load(struct fs_pack *pk, uint32_t table_id,
+			   bool creat)
+{
+	char *fn;
+
+	if (pk->hdb)
+		return true;
+	if (pk->probed && !creat)
+		return false;
+	pk->probed = true;
+
+	if (asprintf(&fn, MDB_TPATH_FMT "/" FS_PACK_IDX_FN,
+		     chunkd_srv.vol_path, table_id) < 0)
+		return false;
+
+	if (!creat && access(fn, F_OK) < 0) {
+		if (errno != ENOENT)
+			syslogerr(fn);
+		goto err_out;
+	}
+
+	pk->hdb = tchdbnew();
+	if (!pk->hdb)
+		goto err_out;
+
+	if (!tchdbopen(pk->hdb, fn, HDBOREADER | HDBOWRITER | HDBOCREAT)) {
+		applog(LOG_ERR, "failed to open pack index %s: %s", fn,
+		       tchdberrmsg(tchdbecode(pk->hdb)));
+		goto err_out_hdb;
+	}
+
+	if (!__fs_pack_load_segs(pk, table_id))
+		goto err_out_close;
+
+	__fs_pack_load_live(pk, table_id);
+
+	free(fn);
+	return true;
+
+err_out_close:
+	g_hash_table_remove_all(pk->segs);
+	pk->cur = NULL;
+	tchdbclose(pk->hdb);
+err_out_hdb:
+	tchdbdel(pk->hdb);
+	pk->hdb = NULL;
+err_out:
+	free(fn);
+	return false;
+}
+
+static void fs_pack_claim_free(gpointer data)
+{
+	g_string_free(data, TRUE);
+}
+
+static struct fs_pack *fs_pack_get(uint32_t table_id)
+{
+	struct fs_pack *pk;
+
+	g_mutex_lock(chunkd_srv.tbl_packs_lock);
+
+	pk = g_hash_table_lookup(chunkd_srv.tbl_packs,
+				 GUINT_TO_POINTER(table_id));
+	if (!pk) {
+		pk = calloc(1, sizeof(*pk));
+		if (!pk)
+			goto out;
+
+		pk->lock = g_mutex_new();
+		pk->segs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+						 NULL, fs_pack_seg_free);
+		pk->claims = g_hash_table_new_full((GHashFunc) g_string_hash,
+					(GEqualFunc) g_string_equal,
+					fs_pack_claim_free, NULL);
+
+		g_hash_table_insert(chunkd_srv.tbl_packs,
+				    GUINT_TO_POINTER(table_id), pk);
+	}
+
+out:
+	g_mutex_unlock(chunkd_srv.tbl_packs_lock);
+	return pk;
+}
+
+static bool __fs_pack_find(struct fs_pack *pk, const void *key,
+			   size_t key_len, struct fs_pack_loc *loc)
+{
+	struct fs_pack_ent ent;
+
+	if (tchdbget3(pk->hdb, key, key_len, &ent, sizeof(ent)) !=
+	    sizeof(ent))
+		return false;
+
+	loc->seg = GUINT32_FROM_LE(ent.seg);
+	loc->len = GUINT32_FROM_LE(ent.len);
+	loc->ofs = GUINT64_FROM_LE(ent.ofs);
+	loc->mtime = GUINT64_FROM_LE(ent.mtime);
+	return true;
+}
+
+static bool __fs_pack_store(struct fs_pack *pk, const void *key,
+			    size_t key_len, const struct fs_pack_loc *loc,
+			    bool keep)
+{
+	struct fs_pack_ent ent;
+
+	ent.seg = GUINT32_TO_LE(loc->seg);
+	ent.len = GUINT32_TO_LE(loc->len);
+	ent.ofs = GUINT64_TO_LE(loc->ofs);
+	ent.mtime = GUINT64_TO_LE(loc->mtime);
+
+	if (keep)
+		return tchdbputkeep(pk->hdb, key, key_len, &ent, sizeof(ent));
+	return tchdbput(pk->hdb, key, key_len, &ent, sizeof(ent));
+}
+
+static bool __fs_pack_claimed(struct fs_pack *pk, const void *key,
+			      size_t key_len)
+{
+	GString tmp = { (gchar *) key, key_len, 0 };
+
+	return g_hash_table_lookup(pk->claims, &tmp) != NULL;
+}
+
+static void __fs_pack_unclaim(struct fs_pack *pk, const void *key,
+			      size_t key_len)
+{
+	GString tmp = { (gchar *) key, key_len, 0 };
+
+	g_hash_table_remove(pk->claims, &tmp);
+}
+
+/* the segment to append len bytes to, starting a new one when full */
+static struct fs_pack_seg *__fs_pack_cur(struct fs_pack *pk,
+					 uint32_t table_id, size_t len)
+{
+	struct fs_pack_seg *seg;
+
+	if (pk->cur &&
+	    (!pk->cur->size || pk->cur->size + len <= FS_PACK_SEG_MAX))
+		return pk->cur;
+
+	seg = fs_pack_seg_open(pk, table_id, pk->cur ? pk->cur->id + 1 : 1,
+			       true);
+	if (seg)
+		pk->cur = seg;
+	return seg;
+}
+
+/*
+ * Look up a packed object.  Returns 1 and its location if the key is
+ * packed, 0 if not, or a negative error.  With fdp, a descriptor of the
+ * segment holding it is returned too, which the caller closes, and with
+ * fnp the segment's pathname, for messages.
+ */
+int fs_pack_lookup(uint32_t table_id, const void *key, size_t key_len,
+		   struct fs_pack_loc *loc, int *fdp, char **fnp)
+{
+	struct fs_pack_loc tmp_loc;
+	struct fs_pack_seg *seg;
+	struct fs_pack *pk;
+	int rc = 0;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return -ENOMEM;
+
+	if (!loc)
+		loc = &tmp_loc;
+
+	g_mutex_lock(pk->lock);
+
+	if (!__fs_pack_load(pk, table_id, false) ||
+	    !__fs_pack_find(pk, key, key_len, loc))
+		goto out;
+
+	if (fdp) {
+		seg = g_hash_table_lookup(pk->segs,
+					  GUINT_TO_POINTER(loc->seg));
+		if (!seg) {
+			applog(LOG_ERR, "table %u: packed object in "
+			       "missing segment %x", table_id, loc->seg);
+			rc = -EIO;
+			goto out;
+		}
+
+		*fdp = dup(seg->fd);
+		if (*fdp < 0) {
+			rc = -errno;
+			applog(LOG_ERR, "table %u: dup segment %x: %s",
+			       table_id, loc->seg, strerror(errno));
+			goto out;
+		}
+	}
+
+	if (fnp) {
+		*fnp = fs_pack_seg_pathname(table_id, loc->seg);
+		if (!*fnp) {
+			if (fdp)
+				close(*fdp);
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	rc = 1;
+
+out:
+	g_mutex_unlock(pk->lock);
+	return rc;
+}
+
+/*
+ * Claim a key for a new object, unless it is packed, claimed, or has
+ * a file (rel, under dir_fd).  A small object (pack) holds the claim
+ * until fs_pack_append() or fs_pack_unclaim(); for a large one, the
+ * file is created here and its descriptor returned in *fdp.  Returns
+ * 0, -EEXIST, or another negative error.
+ */
+int fs_pack_claim(uint32_t table_id, const void *key, size_t key_len,
+		  int dir_fd, const char *rel, bool pack, int *fdp)
+{
+	struct fs_pack *pk;
+	GString *s;
+	int rc;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return -ENOMEM;
+
+	g_mutex_lock(pk->lock);
+
+	rc = -EEXIST;
+	if (__fs_pack_load(pk, table_id, false) &&
+	    tchdbvsiz(pk->hdb, key, key_len) >= 0)
+		goto out;
+	if (__fs_pack_claimed(pk, key, key_len))
+		goto out;
+
+	if (!pack) {
+		*fdp = openat(dir_fd, rel, O_WRONLY | O_CREAT | O_EXCL, 0600);
+		rc = (*fdp < 0) ? -errno : 0;
+		goto out;
+	}
+
+	if (faccessat(dir_fd, rel, F_OK, 0) == 0)
+		goto out;
+	if (errno != ENOENT) {
+		rc = -errno;
+		goto out;
+	}
+
+	s = g_string_new_len(key, key_len);
+	g_hash_table_insert(pk->claims, s, s);
+	rc = 0;
+
+out:
+	g_mutex_unlock(pk->lock);
+	return rc;
+}
+
+/* drop the claim of a small object that is not going to be packed */
+void fs_pack_unclaim(uint32_t table_id, const void *key, size_t key_len)
+{
+	struct fs_pack *pk;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return;
+
+	g_mutex_lock(pk->lock);
+	__fs_pack_unclaim(pk, key, key_len);
+	g_mutex_unlock(pk->lock);
+}
+
+/*
+ * Append the record of a new object, given as iov, to the current
+ * segment of the table and index it, which replaces the claim on its
+ * key.  Returns -EEXIST if the key is already packed.  For a durable
+ * write, *sync_fd receives a descriptor of the segment, for the
+ * flusher to sync along with fs_pack_sync().
+ */
+int fs_pack_append(uint32_t table_id, const void *key, size_t key_len,
+		   const struct iovec *iov, int iovcnt, time_t mtime,
+		   int *sync_fd)
+{
+	struct fs_pack_loc loc;
+	struct fs_pack_seg *seg;
+	struct fs_pack *pk;
+	size_t len = 0;
+	ssize_t wrc;
+	int i, rc;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return -ENOMEM;
+
+	g_mutex_lock(pk->lock);
+
+	rc = -EIO;
+	if (!__fs_pack_load(pk, table_id, true))
+		goto out;
+
+	rc = -EEXIST;
+	if (tchdbvsiz(pk->hdb, key, key_len) >= 0)
+		goto out;
+
+	rc = -EIO;
+	seg = __fs_pack_cur(pk, table_id, len);
+	if (!seg)
+		goto out;
+
+	wrc = pwritev(seg->fd, iov, iovcnt, seg->size);
+	if (wrc != len) {
+		applog(LOG_ERR, "table %u: segment %x append failed: %s",
+		       table_id, seg->id,
+		       (wrc < 0) ? strerror(errno) : "<short write>");
+		goto out;
+	}
+
+	loc.seg = seg->id;
+	loc.len = len;
+	loc.ofs = seg->size;
+	loc.mtime = mtime;
+
+	/* from here on, the bytes are used; live once indexed */
+	seg->size += len;
+
+	if (sync_fd) {
+		*sync_fd = dup(seg->fd);
+		if (*sync_fd < 0) {
+			applog(LOG_ERR, "table %u: dup segment %x: %s",
+			       table_id, seg->id, strerror(errno));
+			goto out;
+		}
+	}
+
+	if (!__fs_pack_store(pk, key, key_len, &loc, true)) {
+		applog(LOG_ERR, "table %u: pack index put failed: %s",
+		       table_id, tchdberrmsg(tchdbecode(pk->hdb)));
+		if (sync_fd) {
+			close(*sync_fd);
+			*sync_fd = -1;
+		}
+		goto out;
+	}
+
+	seg->live += len;
+	__fs_pack_unclaim(pk, key, key_len);
+	rc = 0;
+
+out:
+	g_mutex_unlock(pk->lock);
+	return rc;
+}
+
+/*
+ * Drop a packed object.  Returns 1 if it was packed, 0 if not, or a
+ * negative error.
+ */
+int fs_pack_remove(uint32_t table_id, const void *key, size_t key_len)
+{
+	struct fs_pack_loc loc;
+	struct fs_pack_seg *seg;
+	struct fs_pack *pk;
+	int rc = 0;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return -ENOMEM;
+
+	g_mutex_lock(pk->lock);
+
+	/* compaction may have moved it; that changes nothing here */
+	if (!__fs_pack_load(pk, table_id, false) ||
+	    !__fs_pack_find(pk, key, key_len, &loc))
+		goto out;
+
+	if (!tchdbout(pk->hdb, key, key_len)) {
+		applog(LOG_ERR, "table %u: pack index del failed: %s",
+		       table_id, tchdberrmsg(tchdbecode(pk->hdb)));
+		rc = -EIO;
+		goto out;
+	}
+
+	seg = g_hash_table_lookup(pk->segs, GUINT_TO_POINTER(loc.seg));
+	if (seg)
+		seg->live -= loc.len;
+
+	rc = 1;
+
+out:
+	g_mutex_unlock(pk->lock);
+	return rc;
+}
+
+/*
+ * Make the pack index of a table durable, for the flusher; the segments
+ * are flushed with the object data.
+ */
+int fs_pack_sync(uint32_t table_id)
+{
+	struct fs_pack *pk;
+	int rc = 0;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return -ENOMEM;
+
+	g_mutex_lock(pk->lock);
+	if (pk->hdb && !tchdbsync(pk->hdb)) {
+		applog(LOG_ERR, "table %u: pack index sync failed: %s",
+		       table_id, tchdberrmsg(tchdbecode(pk->hdb)));
+		rc = -EIO;
+	}
+	g_mutex_unlock(pk->lock);
+
+	return rc;
+}
+
+/* copy one record out of segment id, if it is still there */
+static void fs_pack_move(struct fs_pack *pk, uint32_t table_id, uint32_t id,
+			 const void *key, size_t key_len)
+{
+	struct fs_pack_loc loc;
+	struct fs_pack_seg *old, *seg;
+	void *buf = NULL;
+	ssize_t rc;
+
+	g_mutex_lock(pk->lock);
+
+	if (!__fs_pack_find(pk, key, key_len, &loc) || loc.seg != id)
+		goto out;		/* deleted meanwhile */
+
+	old = g_hash_table_lookup(pk->segs, GUINT_TO_POINTER(id));
+	if (!old)
+		goto out;
+
+	buf = malloc(loc.len);
+	if (!buf)
+		goto out;
+
+	rc = pread(old->fd, buf, loc.len, loc.ofs);
+	if (rc != loc.len) {
+		applog(LOG_ERR, "table %u: segment %x read failed: %s",
+		       table_id, id,
+		       (rc < 0) ? strerror(errno) : "<short read>");
+		goto out;
+	}
+
+	seg = __fs_pack_cur(pk, table_id, loc.len);
+	if (!seg || seg == old)
+		goto out;
+
+	rc = pwrite(seg->fd, buf, loc.len, seg->size);
+	if (rc != loc.len) {
+		applog(LOG_ERR, "table %u: segment %x append failed: %s",
+		       table_id, seg->id,
+		       (rc < 0) ? strerror(errno) : "<short write>");
+		goto out;
+	}
+
+	loc.seg = seg->id;
+	loc.ofs = seg->size;
+	seg->size += loc.len;
+
+	if (!__fs_pack_store(pk, key, key_len, &loc, false)) {
+		applog(LOG_ERR, "table %u: pack index put failed: %s",
+		       table_id, tchdberrmsg(tchdbecode(pk->hdb)));
+		goto out;
+	}
+
+	old->live -= loc.len;
+	seg->live += loc.len;
+
+out:
+	g_mutex_unlock(pk->lock);
+	free(buf);
+}
+
+/*
+ * Collect the keys packed in segment id, or in any segment for id 0.
+ * The index is walked in batches, letting other users of the table in
+ * between, so keys added or moved meanwhile may be missed.
+ */
+static TCLIST *fs_pack_collect(struct fs_pack *pk, uint32_t id)
+{
+	struct fs_pack_loc loc;
+	TCLIST *keys;
+	void *kbuf;
+	int klen, n;
+	bool done = false;
+
+	keys = tclistnew();
+
+	g_mutex_lock(pk->lock);
+	tchdbiterinit(pk->hdb);
+	while (!done) {
+		for (n = 0; n < FS_PACK_SCAN_BATCH; n++) {
+			kbuf = tchdbiternext(pk->hdb, &klen);
+			if (!kbuf) {
+				done = true;
+				break;
+			}
+			if (__fs_pack_find(pk, kbuf, klen, &loc) &&
+			    (!id || loc.seg == id))
+				tclistpush(keys, kbuf, klen);
+			free(kbuf);
+		}
+
+		g_mutex_unlock(pk->lock);
+		g_mutex_lock(pk->lock);
+	}
+	g_mutex_unlock(pk->lock);
+
+	return keys;
+}
+
+/*
+ * Move the live records out of segment id, and remove it once none are
+ * left.  Anything that slips past the walk of the index keeps the
+ * segment for the next round.
+ */
+static void fs_pack_compact_seg(struct fs_pack *pk, uint32_t table_id,
+				uint32_t id)
+{
+	struct fs_pack_seg *seg;
+	TCLIST *keys;
+	const void *key;
+	int klen, i;
+	char *fn;
+
+	keys = fs_pack_collect(pk, id);
+
+	for (i = 0; i < tclistnum(keys); i++) {
+		key = tclistval(keys, i, &klen);
+		fs_pack_move(pk, table_id, id, key, klen);
+	}
+	tclistdel(keys);
+
+	g_mutex_lock(pk->lock);
+
+	seg = g_hash_table_lookup(pk->segs, GUINT_TO_POINTER(id));
+	if (!seg || seg->live || seg == pk->cur)
+		goto out;
+
+	/* the moved records must be safe before their old copies go */
+	if (pk->cur && fdatasync(pk->cur->fd) < 0) {
+		applog(LOG_ERR, "table %u: segment %x fdatasync failed: %s",
+		       table_id, pk->cur->id, strerror(errno));
+		goto out;
+	}
+	if (!tchdbsync(pk->hdb))
+		goto out;
+
+	fn = fs_pack_seg_pathname(table_id, id);
+	if (!fn)
+		goto out;
+
+	if (unlink(fn) < 0)
+		syslogerr(fn);
+	else {
+		applog(LOG_INFO, "table %u: pack segment %x compacted, "
+		       "%llu bytes freed", table_id, id,
+		       (unsigned long long) seg->size);
+		g_hash_table_remove(pk->segs, GUINT_TO_POINTER(id));
+	}
+	free(fn);
+
+out:
+	g_mutex_unlock(pk->lock);
+}
+
+static void fs_pack_pick(gpointer key, gpointer val, gpointer user_data)
+{
+	struct fs_pack_seg *seg = val;
+	GList **victims = user_data;
+
+	if (seg->live * 2 <= seg->size)
+		*victims = g_list_prepend(*victims, GUINT_TO_POINTER(seg->id));
+}
+
+/*
+ * Call fn on each key packed in the table, without any lock held, so
+ * that fn may use the other fs_pack_* calls.  Keys packed meanwhile may
+ * be missed, and keys deleted meanwhile may still be passed.  Called by
+ * selfcheck.
+ */
+void fs_pack_foreach(uint32_t table_id,
+		     void (*fn)(uint32_t table_id, const void *key,
+				size_t key_len, void *arg),
+		     void *arg)
+{
+	struct fs_pack *pk;
+	TCLIST *keys;
+	const void *key;
+	int klen, i;
+	bool loaded;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return;
+
+	g_mutex_lock(pk->lock);
+	loaded = __fs_pack_load(pk, table_id, false);
+	g_mutex_unlock(pk->lock);
+	if (!loaded)
+		return;
+
+	keys = fs_pack_collect(pk, 0);
+	for (i = 0; i < tclistnum(keys); i++) {
+		key = tclistval(keys, i, &klen);
+		fn(table_id, key, klen, arg);
+	}
+	tclistdel(keys);
+}
+
+/*
+ * Compact the segments of a table that are at least half dead space.
+ * Called by selfcheck, once per table and pass.
+ */
+void fs_pack_compact(uint32_t table_id)
+{
+	struct fs_pack *pk;
+	GList *victims = NULL, *tmpl;
+
+	pk = fs_pack_get(table_id);
+	if (!pk)
+		return;
+
+	g_mutex_lock(pk->lock);
+	if (__fs_pack_load(pk, table_id, false))
+		g_hash_table_foreach(pk->segs, fs_pack_pick, &victims);
+	if (pk->cur)
+		victims = g_list_remove(victims, GUINT_TO_POINTER(pk->cur->id));
+	g_mutex_unlock(pk->lock);
+
+	for (tmpl = victims; tmpl; tmpl = tmpl->next)
+		fs_pack_compact_seg(pk, table_id,
+				    GPOINTER_TO_UINT(tmpl->data));
+	g_list_free(victims);
+}
+
+static void fs_pack_close_one(gpointer key, gpointer val, gpointer user_data)
+{
+	struct fs_pack *pk = val;
+
+	g_hash_table_destroy(pk->segs);
+	g_hash_table_destroy(pk->claims);
+	if (pk->hdb) {
+		tchdbclose(pk->hdb);
+		tchdbdel(pk->hdb);
+	}
+	g_mutex_free(pk->lock);
+	free(pk);
+}
+
+void fs_pack_close_all(void)
+{
+	if (!chunkd_srv.tbl_packs)
+		return;
+
+	g_mutex_lock(chunkd_srv.tbl_packs_lock);
+	g_hash_table_foreach(chunkd_srv.tbl_packs, fs_pack_close_one, NULL);
+	g_hash_table_destroy(chunkd_srv.tbl_packs);
+	chunkd_srv.tbl_packs = NULL;
+	g_mutex_unlock(chunkd_srv.tbl_packs_lock);
+}
@@ -30,6 +30,9 @@
 #include <tchdb.h>
 #include <event.h>
 #include <objcache.h>
+#include <metacache.h>
+#include <fdcache.h>
+#include <csum.h>
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
@@ -39,12 +42,34 @@ enum {
 	CLI_DATA_BUF_SZ		= CHUNK_BLK_SZ,
 
 	CHD_TRASH_MAX		= 1000,
+	CHD_BUF_TRASH_MAX	= 64,		/* idle data bufs per thread */
+
+	CLI_RESP_SLOTS		= 2,		/* resp hdrs in flight */
 
 	CLI_MAX_SENDFILE_SZ	= 512 * 1024,
+
+	CHD_MAX_NET_THREADS	= 256,
+
+	CHD_META_CACHE_ENTS	= 64 * 1024,	/* default, objects */
+	CHD_META_CACHE_CSUM_MB	= 64,		/* default, csum tables */
+	CHD_FD_CACHE_FDS	= 512,		/* default, idle open objs */
+	CHD_PACK_THRESHOLD_MAX	= 1024 * 1024,	/* packed objs are buffered */
+
+	CHD_SYNC_WINDOW_US	= 200,		/* default, group commit */
+	CHD_SYNC_BATCH		= 64,
+
+	CHD_WRITE_BEHIND_MB	= 8,		/* default, writeback step */
+};
+
+/* how the object ETag is derived; stored in the object header */
+enum chd_obj_digest {
+	CHD_DIGEST_SHA1		= 0,		/* SHA1 of the whole value */
+	CHD_DIGEST_TREE		= 1,		/* SHA1 of the csum table */
 };
 
 struct client;
 struct client_write;
+struct net_thread;
 
 typedef bool (*cli_evt_func)(struct client *, unsigned int);
 typedef bool (*cli_write_func)(struct client *, struct client_write *, bool);
@@ -59,12 +84,39 @@ struct client_write {
 	struct list_head	node;
 };
 
+/* a durable commit waiting for the flusher; see flusher.c */
+struct flush_req {
+	struct list_head	node;
+	int			fd;		/* flushed, then closed; or -1 */
+	int			dir_fd;		/* holds fd's new name; or -1 */
+	uint32_t		pack_table;	/* pack index to sync, or 0 */
+	uint32_t		index_table;	/* key index to sync, or 0 */
+	bool			ok;
+	void			(*done)(struct flush_req *);
+};
+
+struct worker_info {
+	enum chunk_errcode	err;		/* error returned to pipe */
+	struct client		*cli;		/* associated client conn */
+
+	void			(*thr_ev)(struct worker_info *);
+	void			(*pipe_ev)(struct worker_info *);
+};
+
+/* preallocated per-client response header storage */
+union cli_resp_slot {
+	struct chunksrv_resp		resp;
+	struct chunksrv_resp_get	get;
+	struct chunksrv_resp_chkstat	chkstat;
+};
+
 /* internal client socket state */
 enum client_state {
 	evt_read_fixed,				/* read fixed-len rec */
 	evt_read_var,				/* read variable-len rec */
 	evt_exec_req,				/* execute request */
 	evt_data_in,				/* request's content */
+	evt_batch_in,				/* PUT_BATCH content */
 	evt_dispose,				/* dispose of client */
 	evt_recycle,				/* restart HTTP request parse */
 	evt_ssl_accept,				/* SSL cxn negotiation */
@@ -73,6 +125,8 @@ enum client_state {
 struct client {
 	enum client_state	state;		/* socket state */
 
+	struct net_thread	*thr;		/* owning event loop thread */
+
 	struct sockaddr_in6	addr;		/* inet address */
 	char			addr_host[64];	/* ASCII version of inet addr */
 	char			addr_port[16];	/* ASCII version of port */
@@ -95,18 +149,46 @@ struct client {
 
 	struct chunksrv_req	creq;
 	struct chunksrv_req_getpart creq_getpart;
+	struct chunksrv_req_getmulti creq_getmulti;
+	struct chunksrv_req_list creq_list;
 	unsigned int		req_used;	/* amount of req_buf in use */
 	void			*req_ptr;	/* start of unexamined data */
 	uint16_t		key_len;
 	unsigned int		var_len;	/* len of vari len record */
-	bool			second_var;	/* inside 2nd vari len rec? */
+	unsigned int		var_idx;	/* next vari len rec to read */
 
 	char			*hdr_start;	/* current hdr start */
 	char			*hdr_end;	/* current hdr end (so far) */
 
 	char			*out_user;
 	SHA_CTX			out_hash;
-	uint64_t		out_len;
+	uint64_t		out_len;	/* content not yet received */
+
+	/*
+	 * PUT ingest is double-buffered: the socket fills out_fill while
+	 * an I/O worker writes out_wbuf to disk.  At most one write is
+	 * in flight per client (out_busy).
+	 */
+	char			*out_fill;
+	size_t			out_fill_len;
+	char			*out_wbuf;
+	size_t			out_wlen;
+	bool			out_busy;
+	bool			out_commit;	/* last write; commit obj */
+	unsigned char		out_md[SHA_DIGEST_LENGTH];
+
+	struct worker_info	wi;		/* worker op in flight */
+	struct flush_req	out_flush;	/* CHF_SYNC PUT, in commit */
+
+	union cli_resp_slot	resp_slot[CLI_RESP_SLOTS];
+	unsigned int		resp_slot_used;	/* bitmask */
+
+	/* data buffers, CLI_DATA_BUF_SZ each; only held while a
+	 * request body is moving, see cli_buf_get()
+	 */
+	char			*netbuf;
+	char			*netbuf_out;
+	void			*batch_buf;	/* PUT_BATCH body */
 
 	struct backend_obj	*out_bo;
 	struct objcache_entry	*out_ce;
@@ -114,13 +196,16 @@ struct client {
 	uint64_t		in_len;
 	struct backend_obj	*in_obj;
 
+	/* GET_MULTI: ranges of in_obj still to send, after this one */
+	unsigned int		range_idx;
+	unsigned int		n_ranges;
+
 	/* we put the big arrays and objects at the end... */
 
 	char			key[CHD_KEY_SZ];
 	char			table[CHD_KEY_SZ];
 	char			key2[CHD_KEY_SZ];
-	char			netbuf[CLI_DATA_BUF_SZ];
-	char			netbuf_out[CLI_DATA_BUF_SZ];
+	struct chunksrv_range	ranges[CHD_MAX_RANGES];
 };
 
 struct backend_obj {
@@ -155,18 +240,10 @@ struct volume_entry {
 	time_t			mtime;		/* obj last-mod time */
 	void			*key;		/* obj id */
 	int			key_len;
-	char			*hash;		/* obj SHA1 checksum */
+	unsigned char		hash[CHD_CSUM_SZ]; /* obj digest */
 	char			*owner;		/* obj owner username */
 };
 
-struct worker_info {
-	enum chunk_errcode	err;		/* error returned to pipe */
-	struct client		*cli;		/* associated client conn */
-
-	void			(*thr_ev)(struct worker_info *);
-	void			(*pipe_ev)(struct worker_info *);
-};
-
 struct server_stats {
 	unsigned long		poll;		/* number polls */
 	unsigned long		event;		/* events dispatched */
@@ -174,6 +251,32 @@ struct server_stats {
 	unsigned long		opt_write;	/* optimistic writes */
 };
 
+/*
+ * One event loop per network thread.  A client is bound to a single
+ * thread for its whole lifetime, so client state, its write queue, the
+ * write-struct freelist and the statistics below are only ever touched
+ * from that thread.
+ */
+struct net_thread {
+	unsigned int		id;
+	GThread			*thread;	/* NULL for main thread */
+	struct event_base	*evbase;
+
+	int			cli_pipe[2];	/* new cxns from acceptor */
+	struct event		cli_ev;
+
+	int			worker_pipe[2];	/* worker completions */
+	struct event		worker_ev;
+
+	struct list_head	wr_trash;
+	unsigned int		trash_sz;
+
+	struct list_head	buf_trash;	/* idle client data bufs */
+	unsigned int		buf_trash_sz;
+
+	struct server_stats	stats;
+};
+
 struct server_socket {
 	int			fd;
 	const struct listen_cfg	*cfg;
@@ -208,11 +311,13 @@ struct server {
 
 	GThreadPool		*workers;	/* global thread worker pool */
 	int			max_workers;
-	int			worker_pipe[2];
-	struct event		worker_ev;
 
-	struct list_head	wr_trash;
-	unsigned int		trash_sz;
+	bool			sendfile_verify; /* csum data before send */
+	enum chd_obj_digest	obj_digest;	/* for newly stored objs */
+
+	struct net_thread	*threads;	/* [0] is the main thread */
+	int			n_threads;
+	unsigned int		next_thread;	/* round-robin accept */
 
 	char			*ourhost;
 	char			*vol_path;
@@ -224,9 +329,30 @@ struct server {
 	GList			*chk_users;
 
 	TCHDB			*tbl_master;
+	GHashTable		*tbl_index;	/* table id -> key index */
+	GMutex			*tbl_index_lock;
+	GHashTable		*tbl_dirs;	/* table id -> open dir */
+	GMutex			*tbl_dirs_lock;
+	GHashTable		*tbl_packs;	/* table id -> pack segments */
+	GMutex			*tbl_packs_lock;
 	struct objcache		actives;
 
-	struct server_stats	stats;		/* global statistics */
+	struct metacache	metas;		/* obj hdrs, by table+key */
+	unsigned int		meta_cache_ents;
+	size_t			meta_cache_csum; /* bytes */
+
+	struct fdcache		fds;		/* open obj files */
+	unsigned int		fd_cache_fds;
+
+	size_t			pack_threshold;	/* smaller objs are packed */
+
+	unsigned int		sync_window;	/* usec, group commit wait */
+	unsigned int		sync_batch;	/* ... or until this many */
+	bool			sync_fs;	/* syncfs(2) the volume instead */
+
+	size_t			write_behind;	/* bytes, 0 = off */
+	uint64_t		nocache_size;	/* bulk objs, 0 = off */
+
 	enum chk_state		chk_state;
 	time_t			chk_done;
 };
@@ -243,6 +369,8 @@ struct fs_obj_lister {
 
 	DIR *d;
 	char *sub;
+
+	bool reap_tmp;		/* unlink leftover conversion files */
 };
 
 extern int fs_open(void);
@@ -256,11 +384,22 @@ extern struct backend_obj *fs_obj_open(uint32_t table_id, const char *user,
 				       const void *kbuf, size_t klen,
 				       enum chunk_errcode *err_code);
 extern ssize_t fs_obj_write(struct backend_obj *bo, const void *ptr, size_t len);
+extern int fs_obj_copy(struct backend_obj *out_bo, struct backend_obj *in_bo,
+		       enum chd_obj_digest *digest);
 extern ssize_t fs_obj_read(struct backend_obj *bo, void *ptr, size_t len);
 extern int fs_obj_seek(struct backend_obj *bo, uint64_t ofs);
+extern int fs_obj_csum_copy(struct backend_obj *bo, unsigned long blk,
+			    unsigned long n, void *out);
 extern void fs_obj_free(struct backend_obj *bo);
+extern void fs_obj_nocache(struct backend_obj *bo);
 extern bool fs_obj_write_commit(struct backend_obj *bo, const char *user,
-				unsigned char *md, bool sync_data);
+				enum chd_obj_digest digest, unsigned char *md,
+				struct flush_req *sync);
+extern bool fs_obj_meta_cached(uint32_t table_id, const char *user,
+			       const void *key, size_t key_len,
+			       struct backend_obj *bo);
+extern void fs_obj_uncache(uint32_t table_id, const void *key,
+			   size_t key_len);
 extern bool fs_obj_delete(uint32_t table_id, const char *user,
 		          const void *kbuf, size_t klen,
 			  enum chunk_errcode *err_code);
@@ -271,21 +410,81 @@ extern int fs_list_objs_open(struct fs_obj_lister *t,
 extern int fs_list_objs_next(struct fs_obj_lister *t, char **fnp);
 extern void fs_list_objs_close(struct fs_obj_lister *t);
 extern int fs_obj_hdr_read(const char *fn, char **owner,
-			   unsigned char *hash,
+			   unsigned char *hash, enum chd_obj_digest *digest,
 			   void **keyp, size_t *klenp, size_t *csumlenp,
+			   off_t *value_ofsp, bool *old_fmtp,
 			   unsigned long long *size, time_t *mtime);
-extern GList *fs_list_objs(uint32_t table_id, const char *user);
 extern bool fs_table_open(const char *user, const void *kbuf, size_t klen,
 		   bool tbl_creat, bool excl_creat, uint32_t *table_id,
 		   enum chunk_errcode *err_code);
-extern int fs_obj_do_sum(const char *fn, unsigned int klen,
-			 unsigned int csumlen, unsigned char *md);
+extern int fs_obj_do_sum(const char *fn, off_t value_ofs,
+			 unsigned int csumlen, enum chd_obj_digest digest,
+			 unsigned char *md);
+extern int fs_obj_pack_verify(uint32_t table_id, const void *key,
+			      size_t key_len, char **owner, unsigned char *md,
+			      unsigned long long *size, time_t *mtime);
+extern int fs_obj_convert(uint32_t table_id, const char *fn,
+			  const void *key, size_t key_len,
+			  struct objcache_entry *cep);
+
+/* be-pack.c */
+struct fs_pack_loc {
+	uint32_t		seg;		/* segment id */
+	uint32_t		len;		/* record length */
+	uint64_t		ofs;		/* record offset in segment */
+	time_t			mtime;
+};
+
+struct iovec;
+extern int fs_pack_lookup(uint32_t table_id, const void *key, size_t key_len,
+			  struct fs_pack_loc *loc, int *fdp, char **fnp);
+extern int fs_pack_claim(uint32_t table_id, const void *key, size_t key_len,
+			 int dir_fd, const char *rel, bool pack, int *fdp);
+extern void fs_pack_unclaim(uint32_t table_id, const void *key,
+			    size_t key_len);
+extern int fs_pack_append(uint32_t table_id, const void *key, size_t key_len,
+			  const struct iovec *iov, int iovcnt, time_t mtime,
+			  int *sync_fd);
+extern int fs_pack_sync(uint32_t table_id);
+extern int fs_pack_remove(uint32_t table_id, const void *key, size_t key_len);
+extern void fs_pack_foreach(uint32_t table_id,
+			    void (*fn)(uint32_t table_id, const void *key,
+				       size_t key_len, void *arg),
+			    void *arg);
+extern void fs_pack_compact(uint32_t table_id);
+extern void fs_pack_close_all(void);
+
+/* be-index.c */
+extern int fs_index_open(uint32_t table_id, bool new_table);
+extern void fs_index_close_all(void);
+extern bool fs_index_put(uint32_t table_id, const void *key, size_t key_len,
+			 const char *owner, const unsigned char *hash,
+			 uint64_t size, time_t mtime);
+extern bool fs_index_del(uint32_t table_id, const void *key, size_t key_len);
+extern int fs_index_sync(uint32_t table_id);
+extern void fs_index_check(uint32_t table_id, const char *fn,
+			   const void *key, size_t key_len,
+			   const char *owner, const unsigned char *hash,
+			   uint64_t size, time_t mtime);
+extern GList *fs_list_objs(uint32_t table_id, const char *user,
+			    const void *prefix, size_t prefix_len,
+			    const void *marker, size_t marker_len,
+			    unsigned int max_keys, bool *truncated);
+
+/* flusher.c */
+extern int flusher_start(void);
+extern void flusher_stop(void);
+extern void flusher_submit(struct flush_req *req);
+extern void flusher_stats(unsigned long *batches, unsigned long *reqs);
 
 /* object.c */
 extern bool object_del(struct client *cli);
 extern bool object_put(struct client *cli);
 extern bool object_get(struct client *cli, bool want_body);
 extern bool object_get_part(struct client *cli);
+extern bool object_get_multi(struct client *cli);
+extern bool object_put_batch(struct client *cli);
+extern bool object_put_batch_run(struct client *cli);
 extern bool object_cp(struct client *cli);
 extern bool cli_evt_data_in(struct client *cli, unsigned int events);
 extern void cli_out_end(struct client *cli);
@@ -322,11 +521,16 @@ extern void cli_rd_set_poll(struct client *cli, bool readable);
 extern void cli_wr_set_poll(struct client *cli, bool writable);
 extern bool cli_cb_free(struct client *cli, struct client_write *wr,
 			bool done);
+extern void *cli_resp_alloc(struct client *cli);
+extern void cli_resp_free(struct client *cli, void *resp);
+extern int cli_writeq_resp(struct client *cli, void *resp, unsigned int len);
 extern bool cli_write_start(struct client *cli);
+extern char *cli_buf_get(struct client *cli);
 extern int cli_req_avail(struct client *cli);
 extern int cli_poll_mod(struct client *cli);
 extern bool worker_pipe_signal(struct worker_info *wi);
 extern void tcp_cli_event(int fd, short events, void *userdata);
+extern void cli_resume(struct client *cli);
 extern void resp_init_req(struct chunksrv_resp *resp,
 		   const struct chunksrv_req *req);
 
@@ -335,6 +539,7 @@ extern void read_config(void);
 
 /* selfcheck.c */
 extern int chk_spawn(TCHDB *hdb);
+extern void chk_stop(void);
 
 static inline bool use_sendfile(struct client *cli)
 {
@@ -141,6 +141,19 @@ static void cfg_elm_start (GMarkupParseContext *context,
 	}
 }
 
+static bool cfg_bool(const char *name, const char *text, bool *val)
+{
+	if (!strcasecmp(text, "true") || !strcmp(text, "1"))
+		*val = true;
+	else if (!strcasecmp(text, "false") || !strcmp(text, "0"))
+		*val = false;
+	else {
+		applog(LOG_ERR, "%s '%s' is not true or false", name, text);
+		return false;
+	}
+	return true;
+}
+
 static void cfg_elm_end_listen(struct config_context *cc)
 {
 	struct listen_cfg *cfg;
@@ -430,6 +443,130 @@ static void cfg_elm_end (GMarkupParseContext *context,
 		cc->text = NULL;
 	}
 
+	else if (!strcmp(element_name, "NetThreads") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 1 || n > CHD_MAX_NET_THREADS)
+			applog(LOG_ERR, "NetThreads '%s' is invalid", cc->text);
+		else
+			chunkd_srv.n_threads = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "SendfileVerify") && cc->text) {
+		cfg_bool(element_name, cc->text, &chunkd_srv.sendfile_verify);
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "ObjectDigest") && cc->text) {
+		if (!strcasecmp(cc->text, "sha1"))
+			chunkd_srv.obj_digest = CHD_DIGEST_SHA1;
+		else if (!strcasecmp(cc->text, "tree"))
+			chunkd_srv.obj_digest = CHD_DIGEST_TREE;
+		else
+			applog(LOG_ERR, "ObjectDigest '%s' is not sha1 or tree",
+			       cc->text);
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "MetaCache") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "MetaCache '%s' is invalid", cc->text);
+		else
+			chunkd_srv.meta_cache_ents = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "MetaCacheCsumMB") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "MetaCacheCsumMB '%s' is invalid",
+			       cc->text);
+		else
+			chunkd_srv.meta_cache_csum = (size_t) n * 1024 * 1024;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "FdCache") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "FdCache '%s' is invalid", cc->text);
+		else
+			chunkd_srv.fd_cache_fds = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "PackThreshold") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0 || n > CHD_PACK_THRESHOLD_MAX)
+			applog(LOG_ERR, "PackThreshold '%s' is invalid",
+			       cc->text);
+		else
+			chunkd_srv.pack_threshold = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "WriteBehindMB") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "WriteBehindMB '%s' is invalid",
+			       cc->text);
+		else
+			chunkd_srv.write_behind = (size_t) n * 1024 * 1024;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "NoCacheMB") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "NoCacheMB '%s' is invalid", cc->text);
+		else
+			chunkd_srv.nocache_size = (uint64_t) n * 1024 * 1024;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "SyncWindow") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 0)
+			applog(LOG_ERR, "SyncWindow '%s' is invalid", cc->text);
+		else
+			chunkd_srv.sync_window = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "SyncBatch") && cc->text) {
+		n = strtol(cc->text, NULL, 10);
+		if (n < 1)
+			applog(LOG_ERR, "SyncBatch '%s' is invalid", cc->text);
+		else
+			chunkd_srv.sync_batch = n;
+		free(cc->text);
+		cc->text = NULL;
+	}
+
+	else if (!strcmp(element_name, "SyncFS") && cc->text) {
+		cfg_bool(element_name, cc->text, &chunkd_srv.sync_fs);
+#ifndef HAVE_SYNCFS
+		if (chunkd_srv.sync_fs) {
+			applog(LOG_WARNING, "SyncFS: no syncfs(2) here, "
+			       "syncing each file instead");
+			chunkd_srv.sync_fs = false;
+		}
+#endif
+		free(cc->text);
+		cc->text = NULL;
+	}
+
 	else if (!strcmp(element_name, "Geo") && cc->text) {
 		cfg_elm_end_geo(cc);
 		cc->in_geo = false;
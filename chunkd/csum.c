@@ -0,0 +1,414 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * SHA1 for the block checksum tables.
+ *
+ * Single buffers always go to OpenSSL, which already picks SHA-NI or
+ * its best SIMD code for the CPU at runtime.  What OpenSSL cannot do
+ * is hash several independent buffers at once, and that is exactly what
+ * verifying a run of 64k blocks needs.  On x86-64 with AVX2 we hash up
+ * to eight blocks side by side, one per 32-bit vector lane, then hand
+ * each lane's intermediate state back to OpenSSL for the tail and
+ * padding.
+ */
+
+#include <csum.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/sha.h>
+
+#if defined(__x86_64__) && defined(__GNUC__) && (__GNUC__ >= 5)
+#define CSUM_X86_MB 1
+#include <immintrin.h>
+#endif
+
+enum {
+	SHA1_BLK		= 64,
+	CSUM_MB_MIN_LANES	= 4,	/* fewer: OpenSSL is faster */
+};
+
+static bool csum_use_mb;
+
+/*
+ * Finish a digest whose first 'done' bytes (a multiple of SHA1_BLK)
+ * were compressed elsewhere into state 'st'.
+ */
+static void csum_finish(const uint32_t *st, uint64_t done,
+			const unsigned char *p, size_t rest, unsigned char *md)
+{
+	SHA_CTX ctx;
+
+	SHA1_Init(&ctx);
+	ctx.h0 = st[0];
+	ctx.h1 = st[1];
+	ctx.h2 = st[2];
+	ctx.h3 = st[3];
+	ctx.h4 = st[4];
+	ctx.Nl = (SHA_LONG) (done << 3);
+	ctx.Nh = (SHA_LONG) (done >> 29);
+
+	SHA1_Update(&ctx, p, rest);
+	SHA1_Final(md, &ctx);
+}
+
+#ifdef CSUM_X86_MB
+
+#define V_ROL(x, n)	_mm256_or_si256(_mm256_slli_epi32(x, n), \
+					_mm256_srli_epi32(x, 32 - (n)))
+#define V_ADD(x, y)	_mm256_add_epi32(x, y)
+#define V_XOR(x, y)	_mm256_xor_si256(x, y)
+#define V_AND(x, y)	_mm256_and_si256(x, y)
+#define V_OR(x, y)	_mm256_or_si256(x, y)
+
+#define F_CH		V_XOR(d, V_AND(b, V_XOR(c, d)))
+#define F_PARITY	V_XOR(V_XOR(b, c), d)
+#define F_MAJ		V_OR(V_AND(b, c), V_AND(d, V_OR(b, c)))
+
+#define SCHED(t)							\
+	(w[(t) & 15] = V_ROL(V_XOR(V_XOR(w[((t) - 3) & 15],		\
+					 w[((t) - 8) & 15]),		\
+				   V_XOR(w[((t) - 14) & 15],		\
+					 w[(t) & 15])), 1))
+
+#define ROUND(f, k, wt)							\
+	do {								\
+		__m256i tmp = V_ADD(V_ADD(V_ROL(a, 5), f),		\
+				    V_ADD(V_ADD(e, k), wt));		\
+		e = d;							\
+		d = c;							\
+		c = V_ROL(b, 30);					\
+		b = a;							\
+		a = tmp;						\
+	} while (0)
+
+/*
+ * Load 32 bytes from each of eight lanes, and transpose so that w[j]
+ * holds big-endian word j of every lane.
+ */
+__attribute__((target("avx2")))
+static inline void sha1_x8_load(__m256i *w, const unsigned char * const *p,
+				size_t ofs, __m256i bswap)
+{
+	__m256i r[8], t[8], u[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		r[i] = _mm256_loadu_si256((const __m256i *) (p[i] + ofs));
+
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+	}
+	for (i = 0; i < 4; i++) {
+		w[i] = _mm256_shuffle_epi8(
+			_mm256_permute2x128_si256(u[i], u[i + 4], 0x20), bswap);
+		w[i + 4] = _mm256_shuffle_epi8(
+			_mm256_permute2x128_si256(u[i], u[i + 4], 0x31), bswap);
+	}
+}
+
+/*
+ * Compress nblk 64-byte blocks from each of eight lanes.  st[j][i] is
+ * state word j of lane i.
+ */
+__attribute__((target("avx2")))
+static void sha1_x8_avx2(uint32_t st[5][8], const unsigned char * const *p,
+			 size_t nblk)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const __m256i k1 = _mm256_set1_epi32(0x5a827999);
+	const __m256i k2 = _mm256_set1_epi32(0x6ed9eba1);
+	const __m256i k3 = _mm256_set1_epi32(0x8f1bbcdc);
+	const __m256i k4 = _mm256_set1_epi32(0xca62c1d6);
+	__m256i a, b, c, d, e, w[16];
+	size_t blk;
+	int t;
+
+	a = _mm256_loadu_si256((const __m256i *) st[0]);
+	b = _mm256_loadu_si256((const __m256i *) st[1]);
+	c = _mm256_loadu_si256((const __m256i *) st[2]);
+	d = _mm256_loadu_si256((const __m256i *) st[3]);
+	e = _mm256_loadu_si256((const __m256i *) st[4]);
+
+	for (blk = 0; blk < nblk; blk++) {
+		__m256i aa = a, bb = b, cc = c, dd = d, ee = e;
+		size_t ofs = blk * SHA1_BLK;
+
+		sha1_x8_load(&w[0], p, ofs, bswap);
+		sha1_x8_load(&w[8], p, ofs + 32, bswap);
+
+		for (t = 0; t < 16; t++)
+			ROUND(F_CH, k1, w[t]);
+		for (; t < 20; t++)
+			ROUND(F_CH, k1, SCHED(t));
+		for (; t < 40; t++)
+			ROUND(F_PARITY, k2, SCHED(t));
+		for (; t < 60; t++)
+			ROUND(F_MAJ, k3, SCHED(t));
+		for (; t < 80; t++)
+			ROUND(F_PARITY, k4, SCHED(t));
+
+		a = V_ADD(a, aa);
+		b = V_ADD(b, bb);
+		c = V_ADD(c, cc);
+		d = V_ADD(d, dd);
+		e = V_ADD(e, ee);
+	}
+
+	_mm256_storeu_si256((__m256i *) st[0], a);
+	_mm256_storeu_si256((__m256i *) st[1], b);
+	_mm256_storeu_si256((__m256i *) st[2], c);
+	_mm256_storeu_si256((__m256i *) st[3], d);
+	_mm256_storeu_si256((__m256i *) st[4], e);
+}
+
+static void csum_mb_group(const void * const *bufs, const size_t *lens,
+			  unsigned int n, unsigned char *md)
+{
+	static const uint32_t iv[5] = {
+		0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+	};
+	uint32_t st[5][8];
+	const unsigned char *p[8];
+	size_t nblk = lens[0] / SHA1_BLK;
+	unsigned int i, j;
+
+	/* unused lanes shadow lane 0; their results are ignored */
+	for (i = 0; i < 8; i++) {
+		p[i] = bufs[i < n ? i : 0];
+		for (j = 0; j < 5; j++)
+			st[j][i] = iv[j];
+	}
+	for (i = 1; i < n; i++)
+		if (lens[i] / SHA1_BLK < nblk)
+			nblk = lens[i] / SHA1_BLK;
+
+	sha1_x8_avx2(st, p, nblk);
+
+	for (i = 0; i < n; i++) {
+		uint32_t lane[5];
+		size_t done = nblk * SHA1_BLK;
+
+		for (j = 0; j < 5; j++)
+			lane[j] = st[j][i];
+
+		csum_finish(lane, done, p[i] + done, lens[i] - done,
+			    md + (i * CSUM_DIGEST_SZ));
+	}
+}
+
+#endif /* CSUM_X86_MB */
+
+#ifdef CSUM_X86_MB
+
+static double csum_time_one(const unsigned char *buf, size_t blk, bool mb)
+{
+	const void *bufs[CSUM_MAX_LANES];
+	size_t lens[CSUM_MAX_LANES];
+	unsigned char md[CSUM_MAX_LANES * CSUM_DIGEST_SZ];
+	struct timespec ta, tb;
+	int i;
+
+	for (i = 0; i < CSUM_MAX_LANES; i++) {
+		bufs[i] = buf + (i * blk);
+		lens[i] = blk;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &ta);
+	if (mb)
+		csum_mb_group(bufs, lens, CSUM_MAX_LANES, md);
+	else
+		for (i = 0; i < CSUM_MAX_LANES; i++)
+			SHA1(bufs[i], lens[i], md + (i * CSUM_DIGEST_SZ));
+	clock_gettime(CLOCK_MONOTONIC, &tb);
+
+	return (tb.tv_sec - ta.tv_sec) * 1e9 + (tb.tv_nsec - ta.tv_nsec);
+}
+
+/*
+ * OpenSSL may already be using SHA-NI, which can beat eight AVX2 lanes.
+ * Rather than guess from CPU flags, time both, best of a few runs.
+ */
+static bool csum_mb_is_faster(void)
+{
+	enum { BLK = 64 * 1024, RUNS = 3 };
+	unsigned char *buf;
+	double t_one = 0, t_mb = 0, t;
+	int i;
+
+	buf = malloc(CSUM_MAX_LANES * BLK);
+	if (!buf)
+		return false;
+	memset(buf, 0x5a, CSUM_MAX_LANES * BLK);
+
+	for (i = 0; i < RUNS; i++) {
+		t = csum_time_one(buf, BLK, false);
+		if (i == 0 || t < t_one)
+			t_one = t;
+		t = csum_time_one(buf, BLK, true);
+		if (i == 0 || t < t_mb)
+			t_mb = t;
+	}
+
+	free(buf);
+	return t_mb < t_one;
+}
+
+#endif /* CSUM_X86_MB */
+
+bool csum_init(enum csum_impl impl)
+{
+	bool have_mb = false;
+
+	csum_use_mb = false;
+
+#ifdef CSUM_X86_MB
+	__builtin_cpu_init();
+	have_mb = __builtin_cpu_supports("avx2");
+#endif
+
+	switch (impl) {
+	case CSUM_IMPL_OPENSSL:
+		break;
+	case CSUM_IMPL_MB:
+		if (!have_mb)
+			return false;
+		csum_use_mb = true;
+		break;
+	case CSUM_IMPL_AUTO:
+#ifdef CSUM_X86_MB
+		if (have_mb)
+			csum_use_mb = csum_mb_is_faster();
+#endif
+		break;
+	}
+
+	return true;
+}
+
+const char *csum_impl_name(void)
+{
+	return csum_use_mb ? "openssl+avx2x8" : "openssl";
+}
+
+void csum_one(const void *buf, size_t len, unsigned char *md)
+{
+	SHA1(buf, len, md);
+}
+
+void csum_many(const void * const *bufs, const size_t *lens,
+	       unsigned int n, unsigned char *md)
+{
+	while (n > 0) {
+		unsigned int i, cnt = n;
+
+		if (cnt > CSUM_MAX_LANES)
+			cnt = CSUM_MAX_LANES;
+
+#ifdef CSUM_X86_MB
+		if (csum_use_mb && cnt >= CSUM_MB_MIN_LANES)
+			csum_mb_group(bufs, lens, cnt, md);
+		else
+#endif
+		for (i = 0; i < cnt; i++)
+			SHA1(bufs[i], lens[i], md + (i * CSUM_DIGEST_SZ));
+
+		bufs += cnt;
+		lens += cnt;
+		md += cnt * CSUM_DIGEST_SZ;
+		n -= cnt;
+	}
+}
+
+/*
+ * Set up one group of at most CSUM_MAX_LANES blocks starting at 'ofs'.
+ * Returns the number of blocks in the group.
+ */
+static unsigned int csum_blk_group(const void *buf, size_t len, size_t ofs,
+				   size_t blk_sz, const void **bufs,
+				   size_t *lens)
+{
+	unsigned int n = 0;
+
+	while (n < CSUM_MAX_LANES && ofs < len) {
+		/* a short tail block would hold the other lanes back */
+		if (n > 0 && (len - ofs) < blk_sz)
+			break;
+
+		bufs[n] = (const unsigned char *) buf + ofs;
+		lens[n] = (len - ofs < blk_sz) ? (len - ofs) : blk_sz;
+		ofs += lens[n];
+		n++;
+	}
+
+	return n;
+}
+
+void csum_blocks(const void *buf, size_t len, size_t blk_sz,
+		 unsigned char *md_tbl)
+{
+	const void *bufs[CSUM_MAX_LANES];
+	size_t lens[CSUM_MAX_LANES];
+	size_t ofs = 0;
+	unsigned int n;
+
+	while ((n = csum_blk_group(buf, len, ofs, blk_sz, bufs, lens)) > 0) {
+		csum_many(bufs, lens, n, md_tbl);
+
+		ofs += (n - 1) * blk_sz + lens[n - 1];
+		md_tbl += n * CSUM_DIGEST_SZ;
+	}
+}
+
+long csum_verify_blocks(const void *buf, size_t len, size_t blk_sz,
+			const unsigned char *md_tbl)
+{
+	const void *bufs[CSUM_MAX_LANES];
+	size_t lens[CSUM_MAX_LANES];
+	unsigned char md[CSUM_MAX_LANES * CSUM_DIGEST_SZ];
+	size_t ofs = 0;
+	long idx = 0;
+	unsigned int i, n;
+
+	while ((n = csum_blk_group(buf, len, ofs, blk_sz, bufs, lens)) > 0) {
+		csum_many(bufs, lens, n, md);
+
+		for (i = 0; i < n; i++)
+			if (memcmp(md + (i * CSUM_DIGEST_SZ),
+				   md_tbl + ((idx + i) * CSUM_DIGEST_SZ),
+				   CSUM_DIGEST_SZ))
+				return idx + i;
+
+		ofs += (n - 1) * blk_sz + lens[n - 1];
+		idx += n;
+	}
+
+	return -1;
+}
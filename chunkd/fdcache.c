@@ -0,0 +1,252 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <fdcache.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct fdcache_shard *fdcache_shard(struct fdcache *fc,
+					   unsigned int hash)
+{
+	return &fc->shard[tblkey_shard(hash, FDCACHE_SHARDS)];
+}
+
+static void fdcache_ent_free(struct fdcache_ent *ent)
+{
+	close(ent->fd);
+	free(ent->name);
+	free(ent);
+}
+
+/*
+ * Take an entry out of the cache, dropping the cache's reference.
+ * Shard lock held.  Returns true if the caller must free the entry.
+ */
+static bool fdcache_remove(struct fdcache_shard *sh, struct fdcache_ent *ent)
+{
+	g_hash_table_remove(sh->table, &ent->tk);
+	list_del(&ent->lru);
+	sh->n_ents--;
+	ent->cached = false;
+
+	return (--ent->ref == 0);
+}
+
+struct fdcache_ent *fdcache_get(struct fdcache *fc, uint32_t table_id,
+				const void *key, size_t key_len,
+				unsigned long *gen)
+{
+	struct fdcache_ent *ent;
+	struct tblkey probe;
+	struct fdcache_shard *sh;
+
+	*gen = 0;
+	if (!fc->max_ents)
+		return NULL;
+
+	tblkey_init(&probe, table_id, key, key_len);
+	sh = fdcache_shard(fc, probe.hash);
+
+	g_mutex_lock(sh->lock);
+
+	*gen = sh->gen;
+
+	ent = g_hash_table_lookup(sh->table, &probe);
+	if (ent) {
+		sh->hits++;
+		ent->ref++;
+		list_move(&ent->lru, &sh->lru);
+	} else
+		sh->misses++;
+
+	g_mutex_unlock(sh->lock);
+
+	return ent;
+}
+
+struct fdcache_ent *fdcache_add(struct fdcache *fc, uint32_t table_id,
+				const void *key, size_t key_len,
+				int fd, uint64_t ino, char *name,
+				unsigned long gen)
+{
+	struct fdcache_ent *ent, *old;
+	struct fdcache_shard *sh;
+	GList *victims = NULL, *tmpl;
+
+	ent = malloc(sizeof(*ent) + key_len);
+	if (!ent)
+		return NULL;
+
+	memcpy(ent->key_buf, key, key_len);
+	tblkey_init(&ent->tk, table_id, ent->key_buf, key_len);
+	ent->fd = fd;
+	ent->ino = ino;
+	ent->name = name;
+	ent->ref = 1;
+	ent->cached = false;
+	INIT_LIST_HEAD(&ent->lru);
+
+	if (!fc->max_ents)
+		return ent;
+
+	sh = fdcache_shard(fc, ent->tk.hash);
+
+	g_mutex_lock(sh->lock);
+
+	/* invalidated while the caller was opening: use, but do not keep */
+	if (sh->gen != gen)
+		goto out;
+
+	old = g_hash_table_lookup(sh->table, &ent->tk);
+	if (old && fdcache_remove(sh, old))
+		victims = g_list_prepend(victims, old);
+
+	g_hash_table_insert(sh->table, &ent->tk, ent);
+	list_add(&ent->lru, &sh->lru);
+	sh->n_ents++;
+	ent->cached = true;
+	ent->ref++;
+
+	while (sh->n_ents > fc->max_ents) {
+		old = list_entry(sh->lru.prev, struct fdcache_ent, lru);
+		if (fdcache_remove(sh, old))
+			victims = g_list_prepend(victims, old);
+		sh->evictions++;
+	}
+
+out:
+	g_mutex_unlock(sh->lock);
+
+	/* close outside the lock */
+	for (tmpl = victims; tmpl; tmpl = tmpl->next)
+		fdcache_ent_free(tmpl->data);
+	g_list_free(victims);
+
+	return ent;
+}
+
+void fdcache_put(struct fdcache *fc, struct fdcache_ent *ent)
+{
+	struct fdcache_shard *sh = fdcache_shard(fc, ent->tk.hash);
+	bool last;
+
+	if (!fc->max_ents) {
+		fdcache_ent_free(ent);
+		return;
+	}
+
+	g_mutex_lock(sh->lock);
+	last = (--ent->ref == 0);
+	g_mutex_unlock(sh->lock);
+
+	if (last)
+		fdcache_ent_free(ent);
+}
+
+void fdcache_invalidate(struct fdcache *fc, uint32_t table_id,
+			const void *key, size_t key_len)
+{
+	struct fdcache_ent *ent;
+	struct tblkey probe;
+	struct fdcache_shard *sh;
+	bool last = false;
+
+	if (!fc->max_ents)
+		return;
+
+	tblkey_init(&probe, table_id, key, key_len);
+	sh = fdcache_shard(fc, probe.hash);
+
+	g_mutex_lock(sh->lock);
+
+	sh->gen++;
+
+	ent = g_hash_table_lookup(sh->table, &probe);
+	if (ent)
+		last = fdcache_remove(sh, ent);
+
+	g_mutex_unlock(sh->lock);
+
+	if (last)
+		fdcache_ent_free(ent);
+}
+
+void fdcache_stats(struct fdcache *fc, struct fdcache_stats *st)
+{
+	struct fdcache_shard *sh;
+	int i;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < FDCACHE_SHARDS; i++) {
+		sh = &fc->shard[i];
+
+		g_mutex_lock(sh->lock);
+		st->hits += sh->hits;
+		st->misses += sh->misses;
+		st->evictions += sh->evictions;
+		st->entries += sh->n_ents;
+		g_mutex_unlock(sh->lock);
+	}
+}
+
+int fdcache_init(struct fdcache *fc, unsigned int max_fds)
+{
+	struct fdcache_shard *sh;
+	int i;
+
+	memset(fc, 0, sizeof(*fc));
+
+	/* the limit is enforced per shard */
+	fc->max_ents = (max_fds + FDCACHE_SHARDS - 1) / FDCACHE_SHARDS;
+
+	for (i = 0; i < FDCACHE_SHARDS; i++) {
+		sh = &fc->shard[i];
+
+		sh->lock = g_mutex_new();
+		if (!sh->lock) {
+			fdcache_fini(fc);
+			return -1;
+		}
+		sh->table = g_hash_table_new(tblkey_ghash, tblkey_gequal);
+		INIT_LIST_HEAD(&sh->lru);
+	}
+
+	return 0;
+}
+
+void fdcache_fini(struct fdcache *fc)
+{
+	struct fdcache_shard *sh;
+	struct fdcache_ent *ent, *tmp;
+	int i;
+
+	for (i = 0; i < FDCACHE_SHARDS; i++) {
+		sh = &fc->shard[i];
+		if (!sh->lock)
+			continue;
+
+		list_for_each_entry_safe(ent, tmp, &sh->lru, lru) {
+			if (fdcache_remove(sh, ent))
+				fdcache_ent_free(ent);
+		}
+		g_hash_table_destroy(sh->table);
+		g_mutex_free(sh->lock);
+	}
+}
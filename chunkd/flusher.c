@@ -0,0 +1,282 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+/*
+ * Group commit of durable (CHF_SYNC) writes.
+ *
+ * Rather than flush its own object before replying, a durable commit
+ * hands the flusher thread a flush_req and lets its reply wait.  The
+ * flusher collects requests for up to SyncWindow microseconds, or until
+ * SyncBatch of them are waiting, then flushes the whole batch at once:
+ * an fdatasync of each file and of the directory of each new one, or
+ * with SyncFS one syncfs(2) of the volume instead, plus one sync of the
+ * key index and the pack index of each table involved.  Only then are
+ * the requests completed.  Requests arriving during a flush make up
+ * the next batch.
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <glib.h>
+#include "chunkd.h"
+
+static struct {
+	GMutex			*lock;
+	GCond			*cond;
+	GThread			*thread;
+
+	struct list_head	queue;
+	unsigned int		n_queued;
+	bool			exiting;
+
+	int			vol_fd;
+
+	unsigned long		batches;
+	unsigned long		reqs;
+} flusher;
+
+static GList *flusher_add_table(GList *tables, uint32_t table_id)
+{
+	if (!table_id || g_list_find(tables, GUINT_TO_POINTER(table_id)))
+		return tables;
+	return g_list_prepend(tables, GUINT_TO_POINTER(table_id));
+}
+
+static void flusher_flush(struct list_head *batch)
+{
+	struct flush_req *req;
+	GList *packs = NULL, *indexes = NULL, *tmpl;
+	bool vol_ok = true;
+	uint32_t table_id;
+
+#ifdef HAVE_SYNCFS
+	if (chunkd_srv.sync_fs && syncfs(flusher.vol_fd) < 0) {
+		applog(LOG_ERR, "syncfs(%s) failed: %s",
+		       chunkd_srv.vol_path, strerror(errno));
+		vol_ok = false;
+	}
+#endif
+
+	list_for_each_entry(req, batch, node) {
+		req->ok = vol_ok;
+
+		if (!chunkd_srv.sync_fs) {
+			if (req->fd >= 0 && fdatasync(req->fd) < 0) {
+				applog(LOG_ERR, "fdatasync failed: %s",
+				       strerror(errno));
+				req->ok = false;
+			}
+			if (req->dir_fd >= 0 && fsync(req->dir_fd) < 0) {
+				applog(LOG_ERR, "directory fsync failed: %s",
+				       strerror(errno));
+				req->ok = false;
+			}
+		}
+
+		packs = flusher_add_table(packs, req->pack_table);
+		indexes = flusher_add_table(indexes, req->index_table);
+	}
+
+	for (tmpl = packs; tmpl; tmpl = tmpl->next) {
+		table_id = GPOINTER_TO_UINT(tmpl->data);
+		if (fs_pack_sync(table_id) == 0)
+			continue;
+
+		list_for_each_entry(req, batch, node)
+			if (req->pack_table == table_id)
+				req->ok = false;
+	}
+	g_list_free(packs);
+
+	for (tmpl = indexes; tmpl; tmpl = tmpl->next) {
+		table_id = GPOINTER_TO_UINT(tmpl->data);
+		if (fs_index_sync(table_id) == 0)
+			continue;
+
+		list_for_each_entry(req, batch, node)
+			if (req->index_table == table_id)
+				req->ok = false;
+	}
+	g_list_free(indexes);
+}
+
+/* close what the request handed us, and complete it */
+static void flusher_req_done(struct flush_req *req)
+{
+	if (req->fd >= 0)
+		close(req->fd);
+	req->fd = -1;
+	if (req->dir_fd >= 0)
+		close(req->dir_fd);
+	req->dir_fd = -1;
+
+	req->done(req);
+}
+
+static gpointer flusher_thread(gpointer data)
+{
+	struct flush_req *req, *tmp;
+	struct list_head batch;
+	GTimeVal deadline;
+	unsigned int n;
+
+	INIT_LIST_HEAD(&batch);
+
+	g_mutex_lock(flusher.lock);
+
+	for (;;) {
+		while (list_empty(&flusher.queue) && !flusher.exiting)
+			g_cond_wait(flusher.cond, flusher.lock);
+		if (list_empty(&flusher.queue))
+			break;		/* exiting, and nothing left */
+
+		/* let concurrent commits join the batch */
+		if (chunkd_srv.sync_window) {
+			g_get_current_time(&deadline);
+			g_time_val_add(&deadline, chunkd_srv.sync_window);
+
+			while (flusher.n_queued < chunkd_srv.sync_batch &&
+			       !flusher.exiting &&
+			       g_cond_timed_wait(flusher.cond, flusher.lock,
+						 &deadline))
+				;
+		}
+
+		list_splice_init(&flusher.queue, &batch);
+		n = flusher.n_queued;
+		flusher.n_queued = 0;
+
+		g_mutex_unlock(flusher.lock);
+
+		flusher_flush(&batch);
+
+		list_for_each_entry_safe(req, tmp, &batch, node) {
+			list_del_init(&req->node);
+			flusher_req_done(req);
+		}
+
+		g_mutex_lock(flusher.lock);
+
+		flusher.batches++;
+		flusher.reqs += n;
+	}
+
+	g_mutex_unlock(flusher.lock);
+	return NULL;
+}
+
+/*
+ * Queue a durable commit.  req->done is called from the flusher thread
+ * once req->fd and req->dir_fd (closed then) and the rest of the batch
+ * are on disk, or with req->ok false if they could not be flushed.
+ */
+void flusher_submit(struct flush_req *req)
+{
+	struct list_head batch;
+
+	g_mutex_lock(flusher.lock);
+
+	/*
+	 * The thread may be past its last look at the queue; flush a
+	 * request arriving while it stops right here instead.
+	 */
+	if (flusher.exiting) {
+		g_mutex_unlock(flusher.lock);
+
+		INIT_LIST_HEAD(&batch);
+		list_add_tail(&req->node, &batch);
+		flusher_flush(&batch);
+		list_del_init(&req->node);
+
+		flusher_req_done(req);
+		return;
+	}
+
+	list_add_tail(&req->node, &flusher.queue);
+	flusher.n_queued++;
+
+	/* wake the flusher when idle, or when the batch is full */
+	if (flusher.n_queued == 1 ||
+	    flusher.n_queued == chunkd_srv.sync_batch)
+		g_cond_signal(flusher.cond);
+
+	g_mutex_unlock(flusher.lock);
+}
+
+void flusher_stats(unsigned long *batches, unsigned long *reqs)
+{
+	g_mutex_lock(flusher.lock);
+	*batches = flusher.batches;
+	*reqs = flusher.reqs;
+	g_mutex_unlock(flusher.lock);
+}
+
+int flusher_start(void)
+{
+	GError *error = NULL;
+
+	INIT_LIST_HEAD(&flusher.queue);
+
+	flusher.vol_fd = open(chunkd_srv.vol_path, O_RDONLY | O_DIRECTORY);
+	if (flusher.vol_fd < 0) {
+		syslogerr(chunkd_srv.vol_path);
+		return -1;
+	}
+
+	flusher.lock = g_mutex_new();
+	flusher.cond = g_cond_new();
+
+	flusher.thread = g_thread_create(flusher_thread, NULL, TRUE, &error);
+	if (!flusher.thread) {
+		applog(LOG_ERR, "Failed to start flusher thread: %s",
+		       error->message);
+		g_cond_free(flusher.cond);
+		g_mutex_free(flusher.lock);
+		close(flusher.vol_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Flush whatever is still queued, and stop the thread.  The net threads
+ * and workers, which submit requests, must be stopped already.
+ */
+void flusher_stop(void)
+{
+	g_mutex_lock(flusher.lock);
+	flusher.exiting = true;
+	g_cond_signal(flusher.cond);
+	g_mutex_unlock(flusher.lock);
+
+	g_thread_join(flusher.thread);
+
+	g_cond_free(flusher.cond);
+	g_mutex_free(flusher.lock);
+	close(flusher.vol_fd);
+}
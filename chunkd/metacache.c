@@ -0,0 +1,258 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include <metacache.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct metacache_ent {
+	struct list_head	lru;
+	struct tblkey		tk;		/* tk.key is key_buf */
+
+	struct metacache_meta	meta;
+	void			*csum_tbl;
+	size_t			csum_len;
+
+	unsigned char		key_buf[0];
+};
+
+static struct metacache_shard *metacache_shard(struct metacache *mc,
+					       unsigned int hash)
+{
+	return &mc->shard[tblkey_shard(hash, METACACHE_SHARDS)];
+}
+
+/* shard lock held */
+static void metacache_remove(struct metacache_shard *sh,
+			     struct metacache_ent *ent)
+{
+	g_hash_table_remove(sh->table, &ent->tk);
+	list_del(&ent->lru);
+	sh->n_ents--;
+	sh->csum_bytes -= ent->csum_len;
+	free(ent->csum_tbl);
+	free(ent);
+}
+
+bool metacache_get(struct metacache *mc, uint32_t table_id,
+		   const void *key, size_t key_len,
+		   struct metacache_meta *meta,
+		   void **csum_tbl, size_t *csum_len,
+		   unsigned long *gen)
+{
+	struct metacache_ent *ent;
+	struct tblkey probe;
+	struct metacache_shard *sh;
+	bool hit = false;
+
+	if (csum_tbl) {
+		*csum_tbl = NULL;
+		*csum_len = 0;
+	}
+
+	*gen = 0;
+	if (!mc->max_ents)
+		return false;
+
+	tblkey_init(&probe, table_id, key, key_len);
+	sh = metacache_shard(mc, probe.hash);
+
+	g_mutex_lock(sh->lock);
+
+	*gen = sh->gen;
+
+	ent = g_hash_table_lookup(sh->table, &probe);
+	if (!ent) {
+		sh->misses++;
+		goto out;
+	}
+
+	sh->hits++;
+	list_move(&ent->lru, &sh->lru);
+
+	memcpy(meta, &ent->meta, sizeof(*meta));
+
+	if (csum_tbl && ent->csum_tbl) {
+		*csum_tbl = malloc(ent->csum_len);
+		if (*csum_tbl) {
+			memcpy(*csum_tbl, ent->csum_tbl, ent->csum_len);
+			*csum_len = ent->csum_len;
+		}
+	}
+
+	hit = true;
+
+out:
+	g_mutex_unlock(sh->lock);
+	return hit;
+}
+
+void metacache_put(struct metacache *mc, uint32_t table_id,
+		   const void *key, size_t key_len,
+		   const struct metacache_meta *meta,
+		   const void *csum_tbl, size_t csum_len,
+		   unsigned long gen)
+{
+	struct metacache_ent *ent, *old;
+	struct metacache_shard *sh;
+
+	if (!mc->max_ents)
+		return;
+
+	/* one big object should not push out the tables of many others */
+	if (!csum_tbl || csum_len > mc->max_csum / 8)
+		csum_len = 0;
+
+	ent = malloc(sizeof(*ent) + key_len);
+	if (!ent)
+		return;
+
+	memcpy(ent->key_buf, key, key_len);
+	tblkey_init(&ent->tk, table_id, ent->key_buf, key_len);
+	memcpy(&ent->meta, meta, sizeof(*meta));
+
+	ent->csum_tbl = NULL;
+	if (csum_len) {
+		ent->csum_tbl = malloc(csum_len);
+		if (ent->csum_tbl)
+			memcpy(ent->csum_tbl, csum_tbl, csum_len);
+		else
+			csum_len = 0;
+	}
+	ent->csum_len = csum_len;
+
+	sh = metacache_shard(mc, ent->tk.hash);
+
+	g_mutex_lock(sh->lock);
+
+	/* invalidated while the caller was reading the disk */
+	if (sh->gen != gen) {
+		g_mutex_unlock(sh->lock);
+		free(ent->csum_tbl);
+		free(ent);
+		return;
+	}
+
+	old = g_hash_table_lookup(sh->table, &ent->tk);
+	if (old)
+		metacache_remove(sh, old);
+
+	g_hash_table_insert(sh->table, &ent->tk, ent);
+	list_add(&ent->lru, &sh->lru);
+	sh->n_ents++;
+	sh->csum_bytes += csum_len;
+
+	while (sh->n_ents > mc->max_ents || sh->csum_bytes > mc->max_csum) {
+		old = list_entry(sh->lru.prev, struct metacache_ent, lru);
+		metacache_remove(sh, old);
+		sh->evictions++;
+	}
+
+	g_mutex_unlock(sh->lock);
+}
+
+void metacache_invalidate(struct metacache *mc, uint32_t table_id,
+			  const void *key, size_t key_len)
+{
+	struct metacache_ent *ent;
+	struct tblkey probe;
+	struct metacache_shard *sh;
+
+	if (!mc->max_ents)
+		return;
+
+	tblkey_init(&probe, table_id, key, key_len);
+	sh = metacache_shard(mc, probe.hash);
+
+	g_mutex_lock(sh->lock);
+
+	sh->gen++;
+
+	ent = g_hash_table_lookup(sh->table, &probe);
+	if (ent)
+		metacache_remove(sh, ent);
+
+	g_mutex_unlock(sh->lock);
+}
+
+void metacache_stats(struct metacache *mc, struct metacache_stats *st)
+{
+	struct metacache_shard *sh;
+	int i;
+
+	memset(st, 0, sizeof(*st));
+	for (i = 0; i < METACACHE_SHARDS; i++) {
+		sh = &mc->shard[i];
+
+		g_mutex_lock(sh->lock);
+		st->hits += sh->hits;
+		st->misses += sh->misses;
+		st->evictions += sh->evictions;
+		st->entries += sh->n_ents;
+		st->csum_bytes += sh->csum_bytes;
+		g_mutex_unlock(sh->lock);
+	}
+}
+
+int metacache_init(struct metacache *mc, unsigned int max_ents,
+		   size_t max_csum_bytes)
+{
+	struct metacache_shard *sh;
+	int i;
+
+	memset(mc, 0, sizeof(*mc));
+
+	/* limits are enforced per shard */
+	mc->max_ents = (max_ents + METACACHE_SHARDS - 1) / METACACHE_SHARDS;
+	mc->max_csum = max_csum_bytes / METACACHE_SHARDS;
+
+	for (i = 0; i < METACACHE_SHARDS; i++) {
+		sh = &mc->shard[i];
+
+		sh->lock = g_mutex_new();
+		if (!sh->lock) {
+			metacache_fini(mc);
+			return -1;
+		}
+		sh->table = g_hash_table_new(tblkey_ghash, tblkey_gequal);
+		INIT_LIST_HEAD(&sh->lru);
+	}
+
+	return 0;
+}
+
+void metacache_fini(struct metacache *mc)
+{
+	struct metacache_shard *sh;
+	struct metacache_ent *ent, *tmp;
+	int i;
+
+	for (i = 0; i < METACACHE_SHARDS; i++) {
+		sh = &mc->shard[i];
+		if (!sh->lock)
+			continue;
+
+		list_for_each_entry_safe(ent, tmp, &sh->lru, lru) {
+			free(ent->csum_tbl);
+			free(ent);
+		}
+		g_hash_table_destroy(sh->table);
+		g_mutex_free(sh->lock);
+	}
+}
@@ -93,6 +93,19 @@ bool objcache_test_dirty(struct objcache *cache, struct objcache_entry *cep)
 	return ret;
 }
 
+bool objcache_run_clean(struct objcache *cache, struct objcache_entry *cep,
+			void (*fn)(void *arg), void *arg)
+{
+	bool clean;
+
+	g_mutex_lock(cache->lock);
+	clean = !(cep->flags & OC_F_DIRTY);
+	if (clean)
+		fn(arg);
+	g_mutex_unlock(cache->lock);
+	return clean;
+}
+
 void objcache_put(struct objcache *cache, struct objcache_entry *cep)
 {
 	g_mutex_lock(cache->lock);
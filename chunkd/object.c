@@ -36,33 +36,60 @@
 static bool object_get_more(struct client *cli, struct client_write *wr,
 			    bool done);
 
-bool object_del(struct client *cli)
+/*
+ * Run an operation's disk work on the worker pool.  The client stops
+ * reading until the completion comes back through the worker pipe, so
+ * nothing else touches its object state in the meantime.
+ */
+static bool object_worker_push(struct client *cli, struct worker_info *wi,
+			       void (*thr_ev)(struct worker_info *),
+			       void (*pipe_ev)(struct worker_info *))
 {
-	int rc;
+	wi->err = che_Success;
+	wi->cli = cli;
+	wi->thr_ev = thr_ev;
+	wi->pipe_ev = pipe_ev;
+
+	cli_rd_set_poll(cli, false);
+
+	g_thread_pool_push(chunkd_srv.workers, wi, NULL);
+
+	return false;
+}
+
+static void worker_del_thr(struct worker_info *wi)
+{
+	struct client *cli = wi->cli;
 	enum chunk_errcode err = che_InternalError;
-	bool rcb;
-	struct chunksrv_resp *resp = NULL;
+	struct objcache_entry *ce;
 
-	resp = malloc(sizeof(*resp));
-	if (!resp) {
-		cli->state = evt_dispose;
-		return true;
-	}
+	/* like a PUT, so that selfcheck keeps off the key meanwhile */
+	ce = objcache_get_dirty(&chunkd_srv.actives, cli->key, cli->key_len);
 
-	resp_init_req(resp, &cli->creq);
+	if (fs_obj_delete(cli->table_id, cli->user,
+			  cli->key, cli->key_len, &err))
+		err = che_Success;
 
-	rcb = fs_obj_delete(cli->table_id, cli->user,
-			    cli->key, cli->key_len, &err);
-	if (!rcb)
-		return cli_err(cli, err, true);
+	objcache_put(&chunkd_srv.actives, ce);
 
-	rc = cli_writeq(cli, resp, sizeof(*resp), cli_cb_free, resp);
-	if (rc) {
-		free(resp);
-		return true;
-	}
+	wi->err = err;
+	worker_pipe_signal(wi);
+}
 
-	return cli_write_start(cli);
+static void worker_del_pipe(struct worker_info *wi)
+{
+	struct client *cli = wi->cli;
+
+	cli_rd_set_poll(cli, true);
+
+	cli_err(cli, wi->err, true);
+	cli_resume(cli);
+}
+
+bool object_del(struct client *cli)
+{
+	return object_worker_push(cli, &cli->wi, worker_del_thr,
+				  worker_del_pipe);
 }
 
 void cli_out_end(struct client *cli)
@@ -85,13 +112,10 @@ void cli_out_end(struct client *cli)
 
 static bool object_put_end(struct client *cli)
 {
-	unsigned char md[SHA_DIGEST_LENGTH];
 	int rc;
-	enum chunk_errcode err = che_InternalError;
-	bool rcb;
 	struct chunksrv_resp *resp = NULL;
 
-	resp = malloc(sizeof(*resp));
+	resp = cli_resp_alloc(cli);
 	if (!resp) {
 		cli->state = evt_dispose;
 		return true;
@@ -101,14 +125,7 @@ static bool object_put_end(struct client *cli)
 
 	cli->state = evt_recycle;
 
-	SHA1_Final(md, &cli->out_hash);
-
-	rcb = fs_obj_write_commit(cli->out_bo, cli->out_user,
-				  md, (cli->creq.flags & CHF_SYNC));
-	if (!rcb)
-		goto err_out;
-
-	memcpy(resp->hash, md, sizeof(resp->hash));
+	memcpy(resp->hash, cli->out_md, sizeof(resp->hash));
 
 	cli_out_end(cli);
 
@@ -116,37 +133,155 @@ static bool object_put_end(struct client *cli)
 		applog(LOG_DEBUG, "REQ(data-in) seq %x done code %d",
 		       resp->nonce, resp->resp_code);
 
-	rc = cli_writeq(cli, resp, sizeof(*resp), cli_cb_free, resp);
-	if (rc) {
-		free(resp);
+	rc = cli_writeq_resp(cli, resp, sizeof(*resp));
+	if (rc)
 		return true;
-	}
 
 	return cli_write_start(cli);
+}
 
-err_out:
-	free(resp);
-	cli_out_end(cli);
-	return cli_err(cli, err, true);
+/* bulk transfers, by request or by size, bypass the page cache */
+static bool object_nocache(struct client *cli, uint64_t size)
+{
+	if (cli->creq.flags & CHF_NOCACHE)
+		return true;
+	return chunkd_srv.nocache_size && size >= chunkd_srv.nocache_size;
+}
+
+/* flusher thread: a CHF_SYNC PUT is on disk, let its reply go out */
+static void worker_put_flushed(struct flush_req *req)
+{
+	struct client *cli = list_entry(req, struct client, out_flush);
+
+	cli->wi.err = req->ok ? che_Success : che_InternalError;
+	worker_pipe_signal(&cli->wi);
+}
+
+static void worker_put_thr(struct worker_info *wi)
+{
+	struct client *cli = wi->cli;
+	enum chunk_errcode err = che_InternalError;
+	char *p = cli->out_wbuf;
+	size_t avail = cli->out_wlen;
+	struct flush_req *sync = NULL;
+	ssize_t bytes;
+
+	while (avail > 0) {
+		bytes = fs_obj_write(cli->out_bo, p, avail);
+		if (bytes < 0)
+			goto out;
+
+		if (chunkd_srv.obj_digest == CHD_DIGEST_SHA1)
+			SHA1_Update(&cli->out_hash, p, bytes);
+
+		p += bytes;
+		avail -= bytes;
+	}
+
+	if (cli->out_commit) {
+		/* tree digests are taken from the block csums instead */
+		if (chunkd_srv.obj_digest == CHD_DIGEST_SHA1)
+			SHA1_Final(cli->out_md, &cli->out_hash);
+
+		if (cli->creq.flags & CHF_SYNC)
+			sync = &cli->out_flush;
+
+		if (!fs_obj_write_commit(cli->out_bo, cli->out_user,
+					 chunkd_srv.obj_digest, cli->out_md,
+					 sync))
+			goto out;
+
+		/* the reply waits for a group flush */
+		if (sync) {
+			sync->done = worker_put_flushed;
+			flusher_submit(sync);
+			return;
+		}
+	}
+
+	err = che_Success;
+
+out:
+	wi->err = err;
+	worker_pipe_signal(wi);
+}
+
+static void object_put_submit(struct client *cli);
+
+static void worker_put_pipe(struct worker_info *wi)
+{
+	struct client *cli = wi->cli;
+
+	cli->out_busy = false;
+	cli_rd_set_poll(cli, true);
+
+	/* connection went away while the worker held our buffers */
+	if (cli->state == evt_dispose)
+		goto out;
+
+	if (wi->err != che_Success)
+		cli_err(cli, wi->err, false);
+	else if (cli->out_commit)
+		object_put_end(cli);
+	else if (cli->out_fill_len)
+		object_put_submit(cli);
+
+out:
+	cli_resume(cli);
+}
+
+/*
+ * Hand the buffer filled so far to an I/O worker, and switch the socket
+ * over to the other buffer.  The write carrying the last byte of content
+ * also commits the object.
+ */
+static void object_put_submit(struct client *cli)
+{
+	struct worker_info *wi = &cli->wi;
+
+	cli->out_wbuf = cli->out_fill;
+	cli->out_wlen = cli->out_fill_len;
+	cli->out_commit = (cli->out_len == 0);
+
+	if (cli->out_fill == cli->netbuf)
+		cli->out_fill = cli->netbuf_out;
+	else
+		cli->out_fill = cli->netbuf;
+	cli->out_fill_len = 0;
+
+	memset(wi, 0, sizeof(*wi));
+	wi->cli = cli;
+	wi->thr_ev = worker_put_thr;
+	wi->pipe_ev = worker_put_pipe;
+
+	cli->out_busy = true;
+
+	g_thread_pool_push(chunkd_srv.workers, wi, NULL);
 }
 
 bool cli_evt_data_in(struct client *cli, unsigned int events)
 {
-	char *p = cli->netbuf;
-	ssize_t avail, bytes;
+	char *p;
+	ssize_t avail;
 	size_t read_sz;
 
-	if (!cli->out_len)
-		return object_put_end(cli);
+	/* stop reading once all content is in, or both buffers are
+	 * busy; the worker completion turns polling back on
+	 */
+	read_sz = MIN(cli->out_len, CLI_DATA_BUF_SZ - cli->out_fill_len);
+	if (!read_sz) {
+		cli_rd_set_poll(cli, false);
+		return false;
+	}
 
-	read_sz = MIN(cli->out_len, CLI_DATA_BUF_SZ);
+	p = cli->out_fill + cli->out_fill_len;
 
 	if (debugging)
 		applog(LOG_DEBUG, "REQ(data-in) seq %x, out_len %llu, read_sz %u",
 		       cli->creq.nonce, cli->out_len, read_sz);
 
 	if (cli->ssl) {
-		int rc = SSL_read(cli->ssl, cli->netbuf, read_sz);
+		int rc = SSL_read(cli->ssl, p, read_sz);
 		if (rc <= 0) {
 			if (rc == 0) {
 				cli->state = evt_dispose;
@@ -165,7 +300,7 @@ bool cli_evt_data_in(struct client *cli, unsigned int events)
 		}
 		avail = rc;
 	} else {
-		avail = read(cli->fd, cli->netbuf, read_sz);
+		avail = read(cli->fd, p, read_sz);
 		if (avail <= 0) {
 			if (avail == 0) {
 				applog(LOG_ERR, "object read(2) unexpected EOF");
@@ -179,7 +314,6 @@ bool cli_evt_data_in(struct client *cli, unsigned int events)
 				return false;
 			}
 
-			cli_out_end(cli);
 			applog(LOG_ERR, "object read(2) error: %s",
 					strerror(errno));
 			return cli_err(cli, che_InternalError, false);
@@ -189,22 +323,11 @@ bool cli_evt_data_in(struct client *cli, unsigned int events)
 	if (debugging && (avail != read_sz))
 		applog(LOG_DEBUG, "REQ(data-in) avail %ld", (long)avail);
 
-	while (avail > 0) {
-		bytes = fs_obj_write(cli->out_bo, p, avail);
-		if (bytes < 0) {
-			cli_out_end(cli);
-			return cli_err(cli, che_InternalError, false);
-		}
-
-		SHA1_Update(&cli->out_hash, p, bytes);
-
-		cli->out_len -= bytes;
-		p += bytes;
-		avail -= bytes;
-	}
+	cli->out_fill_len += avail;
+	cli->out_len -= avail;
 
-	if (!cli->out_len)
-		return object_put_end(cli);
+	if (!cli->out_busy)
+		object_put_submit(cli);
 
 	return true;
 }
@@ -218,6 +341,14 @@ bool object_put(struct client *cli)
 	if (!user)
 		return cli_err(cli, che_AccessDenied, true);
 
+	/* both data buffers, for double-buffered ingest */
+	if (!cli->netbuf)
+		cli->netbuf = cli_buf_get(cli);
+	if (!cli->netbuf_out)
+		cli->netbuf_out = cli_buf_get(cli);
+	if (!cli->netbuf || !cli->netbuf_out)
+		return cli_err(cli, che_InternalError, true);
+
 	cli->out_ce = objcache_get_dirty(&chunkd_srv.actives,
 					 cli->key, cli->key_len);
 	if (!cli->out_ce)
@@ -227,16 +358,277 @@ bool object_put(struct client *cli)
 				 content_len, &err);
 	if (!cli->out_bo)
 		return cli_err(cli, err, true);
+	if (object_nocache(cli, content_len))
+		fs_obj_nocache(cli->out_bo);
 
 	SHA1_Init(&cli->out_hash);
 	cli->out_len = content_len;
 	cli->out_user = strdup(user);
 
-	if (!cli->out_len)
-		return object_put_end(cli);
+	cli->out_fill = cli->netbuf;
+	cli->out_fill_len = 0;
 
 	cli->state = evt_data_in;
 
+	/* empty object: nothing to read, go straight to commit */
+	if (!cli->out_len)
+		object_put_submit(cli);
+
+	return true;
+}
+
+struct batch_info;
+
+struct batch_sync {
+	struct flush_req	req;
+	struct batch_info	*bi;
+	unsigned int		idx;
+};
+
+struct batch_info {
+	struct worker_info	wi;		/* must be first */
+
+	unsigned int		n_items;
+	uint8_t			*status;	/* chunk_errcode per item */
+	struct batch_sync	*syncs;		/* CHF_SYNC batches only */
+	volatile gint		pending;	/* syncs not yet flushed */
+};
+
+/* flusher thread: one more durable item of a batch is on disk */
+static void worker_batch_flushed(struct flush_req *req)
+{
+	struct batch_sync *bs = list_entry(req, struct batch_sync, req);
+	struct batch_info *bi = bs->bi;
+
+	if (!req->ok)
+		bi->status[bs->idx] = che_InternalError;
+
+	if (g_atomic_int_dec_and_test(&bi->pending))
+		worker_pipe_signal(&bi->wi);
+}
+
+/* count the records of a PUT_BATCH body, or -1 if it is malformed */
+static int batch_count(const void *buf, uint64_t len)
+{
+	const struct chunksrv_batch_ent *ent;
+	uint64_t pos = 0, rec_len;
+	int n = 0;
+
+	while (pos < len) {
+		if (len - pos < sizeof(*ent) || n == CHD_BATCH_MAX_ITEMS)
+			return -1;
+		ent = buf + pos;
+
+		rec_len = GUINT16_FROM_LE(ent->key_len);
+		if (le64_to_cpu(ent->len) > len)
+			return -1;
+		rec_len += le64_to_cpu(ent->len);
+		if (len - pos - sizeof(*ent) < rec_len)
+			return -1;
+
+		pos += sizeof(*ent) + rec_len;
+		n++;
+	}
+
+	return n;
+}
+
+/* store one object of a batch, in full, as a PUT would */
+static enum chunk_errcode batch_put_one(struct client *cli,
+					const void *key, size_t key_len,
+					const void *data, uint64_t len,
+					struct flush_req *sync)
+{
+	enum chunk_errcode err = che_InternalError;
+	unsigned char md[SHA_DIGEST_LENGTH];
+	struct objcache_entry *ce;
+	struct backend_obj *bo;
+	ssize_t wrc;
+
+	ce = objcache_get_dirty(&chunkd_srv.actives, key, key_len);
+	if (!ce)
+		return che_InternalError;
+
+	bo = fs_obj_new(cli->table_id, key, key_len, len, &err);
+	if (!bo)
+		goto out;
+	err = che_InternalError;
+
+	/* tree digests are taken from the block csums instead */
+	if (chunkd_srv.obj_digest == CHD_DIGEST_SHA1)
+		SHA1(data, len, md);
+
+	while (len > 0) {
+		wrc = fs_obj_write(bo, data, len);
+		if (wrc < 0)
+			goto out_bo;
+
+		data += wrc;
+		len -= wrc;
+	}
+
+	/* a failed commit hands no descriptors over */
+	if (!fs_obj_write_commit(bo, cli->user, chunkd_srv.obj_digest, md,
+				 sync))
+		goto out_bo;
+
+	err = che_Success;
+
+out_bo:
+	fs_obj_free(bo);
+out:
+	objcache_put(&chunkd_srv.actives, ce);
+	return err;
+}
+
+/*
+ * Store every object of the batch in one go.  A durable batch hands
+ * each commit to the flusher right away, so they all land in the same
+ * group flush, and the reply waits for the last of them.
+ */
+static void worker_put_batch_thr(struct worker_info *wi)
+{
+	struct batch_info *bi = (struct batch_info *) wi;
+	struct client *cli = wi->cli;
+	uint64_t len = le64_to_cpu(cli->creq.data_len);
+	const struct chunksrv_batch_ent *ent;
+	struct flush_req *sync = NULL;
+	const void *p = cli->batch_buf;
+	const void *key;
+	size_t key_len;
+	uint64_t val_len;
+	unsigned int i;
+	int n;
+
+	n = batch_count(cli->batch_buf, len);
+	if (n <= 0) {
+		wi->err = che_InvalidArgument;
+		goto out;
+	}
+	bi->n_items = n;
+
+	bi->status = malloc(n);
+	if (cli->creq.flags & CHF_SYNC)
+		bi->syncs = calloc(n, sizeof(*bi->syncs));
+	if (!bi->status || ((cli->creq.flags & CHF_SYNC) && !bi->syncs)) {
+		wi->err = che_InternalError;
+		goto out;
+	}
+
+	/* one reference for the batch itself, dropped below */
+	bi->pending = 1;
+
+	for (i = 0; i < n; i++) {
+		ent = p;
+		key = p + sizeof(*ent);
+		key_len = GUINT16_FROM_LE(ent->key_len);
+		val_len = le64_to_cpu(ent->len);
+		p += sizeof(*ent) + key_len + val_len;
+
+		if (bi->syncs) {
+			bi->syncs[i].bi = bi;
+			bi->syncs[i].idx = i;
+			sync = &bi->syncs[i].req;
+		}
+
+		bi->status[i] = batch_put_one(cli, key, key_len,
+					      key + key_len, val_len, sync);
+
+		if (sync && bi->status[i] == che_Success) {
+			sync->done = worker_batch_flushed;
+			g_atomic_int_inc(&bi->pending);
+			flusher_submit(sync);
+		}
+	}
+
+	wi->err = che_Success;
+	if (!g_atomic_int_dec_and_test(&bi->pending))
+		return;
+out:
+	worker_pipe_signal(wi);
+}
+
+static void worker_put_batch_pipe(struct worker_info *wi)
+{
+	struct batch_info *bi = (struct batch_info *) wi;
+	struct client *cli = wi->cli;
+	struct chunksrv_resp *resp;
+
+	cli_rd_set_poll(cli, true);
+
+	free(cli->batch_buf);
+	cli->batch_buf = NULL;
+
+	if (wi->err != che_Success) {
+		cli_err(cli, wi->err, true);
+		goto out;
+	}
+
+	resp = cli_resp_alloc(cli);
+	if (!resp) {
+		cli->state = evt_dispose;
+		goto out;
+	}
+
+	resp_init_req(resp, &cli->creq);
+	resp->data_len = cpu_to_le64(bi->n_items);
+
+	if (cli_writeq_resp(cli, resp, sizeof(*resp)) ||
+	    cli_writeq(cli, bi->status, bi->n_items, cli_cb_free, bi->status)) {
+		cli->state = evt_dispose;
+		goto out;
+	}
+	bi->status = NULL;
+
+	cli_write_start(cli);
+
+out:
+	cli_resume(cli);
+	free(bi->status);
+	free(bi->syncs);
+	free(bi);
+}
+
+/* body is in; hand the whole batch to a worker */
+bool object_put_batch_run(struct client *cli)
+{
+	struct batch_info *bi;
+
+	bi = calloc(1, sizeof(*bi));
+	if (!bi) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	return object_worker_push(cli, &bi->wi, worker_put_batch_thr,
+				  worker_put_batch_pipe);
+}
+
+/*
+ * Called once the header is authenticated and a table is open, so
+ * nobody gets us to allocate the body before that.  A batch is small
+ * enough to take in whole.
+ */
+bool object_put_batch(struct client *cli)
+{
+	uint64_t len = le64_to_cpu(cli->creq.data_len);
+
+	if (len > CHD_BATCH_MAX_SZ) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	free(cli->batch_buf);
+	cli->batch_buf = malloc(len ? len : 1);
+	if (!cli->batch_buf) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	cli->req_ptr = cli->batch_buf;
+	cli->var_len = len;
+	cli->req_used = 0;
+	cli->state = evt_batch_in;
 	return true;
 }
 
@@ -249,6 +641,27 @@ void cli_in_end(struct client *cli)
 		fs_obj_free(cli->in_obj);
 		cli->in_obj = NULL;
 	}
+
+	cli->range_idx = cli->n_ranges = 0;
+}
+
+/* GET_MULTI: move in_obj to the next non-empty range, if any is left */
+static bool object_next_range(struct client *cli)
+{
+	const struct chunksrv_range *r;
+
+	while (cli->range_idx < cli->n_ranges) {
+		r = &cli->ranges[cli->range_idx++];
+		if (!r->len)
+			continue;
+
+		if (fs_obj_seek(cli->in_obj, r->offset))
+			return false;
+		cli->in_len = r->len;
+		return true;
+	}
+
+	return false;
 }
 
 static bool object_read_bytes(struct client *cli)
@@ -258,6 +671,13 @@ static bool object_read_bytes(struct client *cli)
 			return false;
 	} else {
 		ssize_t bytes;
+		bool more;
+
+		if (!cli->netbuf_out) {
+			cli->netbuf_out = cli_buf_get(cli);
+			if (!cli->netbuf_out)
+				return false;
+		}
 
 		bytes = fs_obj_read(cli->in_obj, cli->netbuf_out,
 				    MIN(cli->in_len, CLI_DATA_BUF_SZ));
@@ -268,11 +688,12 @@ static bool object_read_bytes(struct client *cli)
 
 		cli->in_len -= bytes;
 
-		if (!cli->in_len)
+		more = cli->in_len || cli->range_idx < cli->n_ranges;
+		if (!more)
 			cli_in_end(cli);
 
 		if (cli_writeq(cli, cli->netbuf_out, bytes,
-			       cli->in_len ? object_get_more : NULL, NULL))
+			       more ? object_get_more : NULL, NULL))
 			return false;
 	}
 
@@ -286,7 +707,7 @@ static bool object_get_more(struct client *cli, struct client_write *wr,
 	if (!done)
 		goto err_out_buf;
 
-	if (!cli->in_len)
+	if (!cli->in_len && !object_next_range(cli))
 		cli_in_end(cli);
 	else if (!object_read_bytes(cli))
 		goto err_out;
@@ -299,14 +720,14 @@ err_out_buf:
 	return false;
 }
 
-bool object_get(struct client *cli, bool want_body)
+static bool object_get_body(struct client *cli, bool want_body)
 {
 	int rc;
 	enum chunk_errcode err = che_InternalError;
-	struct backend_obj *obj;
+	struct backend_obj *obj = cli->in_obj;
 	struct chunksrv_resp_get *get_resp = NULL;
 
-	get_resp = calloc(1, sizeof(*get_resp));
+	get_resp = cli_resp_alloc(cli);
 	if (!get_resp) {
 		cli->state = evt_dispose;
 		return true;
@@ -314,24 +735,15 @@ bool object_get(struct client *cli, bool want_body)
 
 	resp_init_req(&get_resp->resp, &cli->creq);
 
-	cli->in_obj = obj = fs_obj_open(cli->table_id, cli->user, cli->key,
-					cli->key_len, &err);
-	if (!obj) {
-		free(get_resp);
-		return cli_err(cli, err, true);
-	}
-
 	cli->in_len = obj->size;
 
 	get_resp->resp.data_len = cpu_to_le64(obj->size);
 	memcpy(get_resp->resp.hash, obj->hash, sizeof(obj->hash));
 	get_resp->mtime = cpu_to_le64(obj->mtime);
 
-	rc = cli_writeq(cli, get_resp, sizeof(*get_resp), cli_cb_free, get_resp);
-	if (rc) {
-		free(get_resp);
+	rc = cli_writeq_resp(cli, get_resp, sizeof(*get_resp));
+	if (rc)
 		return true;
-	}
 
 	if (!want_body) {
 		cli_in_end(cli);
@@ -354,19 +766,40 @@ start_write:
 	return cli_write_start(cli);
 }
 
-bool object_get_part(struct client *cli)
+static void worker_get_thr(struct worker_info *wi)
 {
-	static const uint64_t max_getpart = CHUNK_MAX_GETPART * CHUNK_BLK_SZ;
-	int rc;
+	struct client *cli = wi->cli;
 	enum chunk_errcode err = che_InternalError;
-	struct backend_obj *obj;
-	struct chunksrv_resp_get *get_resp = NULL;
-	uint64_t offset, length, remain;
-	uint64_t aligned_ofs, aligned_len, aligned_rem;
-	ssize_t rrc;
-	void *mem = NULL;
 
-	get_resp = calloc(1, sizeof(*get_resp));
+	cli->in_obj = fs_obj_open(cli->table_id, cli->user, cli->key,
+				  cli->key_len, &err);
+	if (cli->in_obj && cli->creq.op == CHO_GET &&
+	    object_nocache(cli, cli->in_obj->size))
+		fs_obj_nocache(cli->in_obj);
+
+	wi->err = cli->in_obj ? che_Success : err;
+	worker_pipe_signal(wi);
+}
+
+static void worker_get_pipe(struct worker_info *wi)
+{
+	struct client *cli = wi->cli;
+
+	cli_rd_set_poll(cli, true);
+
+	if (wi->err != che_Success)
+		cli_err(cli, wi->err, true);
+	else
+		object_get_body(cli, (cli->creq.op == CHO_GET));
+	cli_resume(cli);
+}
+
+/* GET_META straight from the metadata cache, without a worker */
+static bool object_get_meta_cached(struct client *cli, struct backend_obj *bo)
+{
+	struct chunksrv_resp_get *get_resp;
+
+	get_resp = cli_resp_alloc(cli);
 	if (!get_resp) {
 		cli->state = evt_dispose;
 		return true;
@@ -374,97 +807,328 @@ bool object_get_part(struct client *cli)
 
 	resp_init_req(&get_resp->resp, &cli->creq);
 
-	cli->in_obj = obj = fs_obj_open(cli->table_id, cli->user, cli->key,
-					cli->key_len, &err);
-	if (!obj) {
-		free(get_resp);
-		return cli_err(cli, err, true);
+	get_resp->resp.data_len = cpu_to_le64(bo->size);
+	memcpy(get_resp->resp.hash, bo->hash, sizeof(bo->hash));
+	get_resp->mtime = cpu_to_le64(bo->mtime);
+
+	cli->state = evt_recycle;
+
+	if (cli_writeq_resp(cli, get_resp, sizeof(*get_resp))) {
+		cli->state = evt_dispose;
+		return true;
 	}
 
-	cli->in_len = obj->size;
+	return cli_write_start(cli);
+}
+
+bool object_get(struct client *cli, bool want_body)
+{
+	struct backend_obj bo;
+
+	if (!want_body &&
+	    fs_obj_meta_cached(cli->table_id, cli->user, cli->key,
+			       cli->key_len, &bo))
+		return object_get_meta_cached(cli, &bo);
+
+	return object_worker_push(cli, &cli->wi, worker_get_thr,
+				  worker_get_pipe);
+}
+
+struct getpart_info {
+	struct worker_info	wi;		/* must be first */
+
+	struct chunksrv_resp_get get_resp;
+	void			*csums;		/* csums of blocks covered */
+	size_t			csum_len;
+};
+
+static void worker_get_part_thr(struct worker_info *wi)
+{
+	struct getpart_info *gpi = (struct getpart_info *) wi;
+	struct client *cli = wi->cli;
+	enum chunk_errcode err = che_InternalError;
+	struct backend_obj *obj;
+	uint64_t offset, length, remain;
+	unsigned long first_blk, n_blk;
+
+	cli->in_obj = obj = fs_obj_open(cli->table_id, cli->user, cli->key,
+					cli->key_len, &err);
+	if (!obj)
+		goto err_out;
 
 	/* obtain requested offset */
 	offset = le64_to_cpu(cli->creq_getpart.offset);
 	if (offset > obj->size) {
 		err = che_InvalidSeek;
-		free(get_resp);
-		return cli_err(cli, err, true);
+		goto err_out;
 	}
-
-	/* align to block boundary */
-	aligned_ofs = offset & ~CHUNK_BLK_MASK;
 	remain = obj->size - offset;
-	aligned_rem = obj->size - aligned_ofs;
 
 	/* obtain requested length; 0 == "until end of object" */
 	length = le64_to_cpu(cli->creq.data_len);
 	if (length == 0 || length > remain)
 		length = remain;
-	if (length > max_getpart)
-		length = max_getpart;
-
-	/* calculate length based on block size */
-	aligned_len = length + (offset - aligned_ofs);
-	if (aligned_len & CHUNK_BLK_MASK)
-		aligned_len += (CHUNK_BLK_SZ - (aligned_len & CHUNK_BLK_MASK));
-	if (aligned_len > aligned_rem)
-		aligned_len = aligned_rem;
 
 	if (length) {
-		/* seek to offset */
-		rc = fs_obj_seek(obj, aligned_ofs);
-		if (rc) {
+		/* the body streams from here, as a GET does */
+		if (fs_obj_seek(obj, offset)) {
 			err = che_InvalidSeek;
-			free(get_resp);
-			return cli_err(cli, err, true);
+			goto err_out;
 		}
 
-		/* allocate buffer to hold all get_part request data */
-		mem = malloc(aligned_len);
-		if (!mem) {
-			free(get_resp);
-			return cli_err(cli, err, true);
-		}
+		/* the csums of every block the range touches */
+		first_blk = offset >> CHUNK_BLK_ORDER;
+		n_blk = ((offset + length - 1) >> CHUNK_BLK_ORDER) -
+			first_blk + 1;
 
-		/* read requested data in its entirety */
-		rrc = fs_obj_read(obj, mem, aligned_len);
-		if (rrc != aligned_len) {
-			free(mem);
-			free(get_resp);
-			return cli_err(cli, err, true);
-		}
+		gpi->csum_len = n_blk * CHD_CSUM_SZ;
+		gpi->csums = malloc(gpi->csum_len);
+		if (!gpi->csums)
+			goto err_out;
+
+		if (fs_obj_csum_copy(obj, first_blk, n_blk, gpi->csums))
+			goto err_out;
 	}
 
 	/* fill in response */
 	if (length == remain)
-		get_resp->resp.flags |= CHF_GET_PART_LAST;
-	get_resp->resp.data_len = cpu_to_le64(length);
-	SHA1(mem, aligned_len, get_resp->resp.hash);
-	get_resp->mtime = cpu_to_le64(obj->mtime);
+		gpi->get_resp.resp.flags |= CHF_GET_PART_LAST;
+	if (cli->creq.flags & CHF_GETPART_CSUM)
+		gpi->get_resp.resp.flags |= CHF_GETPART_CSUM;
+	gpi->get_resp.resp.data_len = cpu_to_le64(length);
+	SHA1(gpi->csums, gpi->csum_len, gpi->get_resp.resp.hash);
+	gpi->get_resp.mtime = cpu_to_le64(obj->mtime);
+
+	cli->in_len = length;
+
+	wi->err = che_Success;
+	worker_pipe_signal(wi);
+	return;
+
+err_out:
+	cli_in_end(cli);
+	wi->err = err;
+	worker_pipe_signal(wi);
+}
+
+static void worker_get_part_pipe(struct worker_info *wi)
+{
+	struct getpart_info *gpi = (struct getpart_info *) wi;
+	struct client *cli = wi->cli;
+	struct chunksrv_resp_get *get_resp;
+
+	cli_rd_set_poll(cli, true);
+
+	if (wi->err != che_Success)
+		goto err_out;
 
 	/* write response header */
-	rc = cli_writeq(cli, get_resp, sizeof(*get_resp), cli_cb_free, get_resp);
-	if (rc) {
-		free(mem);
-		free(get_resp);
+	get_resp = cli_resp_alloc(cli);
+	if (!get_resp) {
+		wi->err = che_InternalError;
+		goto err_out_in;
+	}
+	memcpy(get_resp, &gpi->get_resp, sizeof(*get_resp));
+	if (cli_writeq_resp(cli, get_resp, sizeof(*get_resp))) {
+		wi->err = che_InternalError;
+		goto err_out_in;
+	}
+
+	/* csums, if asked for, precede the data */
+	if (gpi->csums && (gpi->get_resp.resp.flags & CHF_GETPART_CSUM)) {
+		if (cli_writeq(cli, gpi->csums, gpi->csum_len,
+			       cli_cb_free, gpi->csums)) {
+			free(gpi->csums);
+			cli_in_end(cli);
+			cli->state = evt_dispose;
+			goto out;
+		}
+	} else
+		free(gpi->csums);
+	gpi->csums = NULL;
+
+	/* then the range itself, in pieces, as object_get_body does */
+	if (!cli->in_len)
+		cli_in_end(cli);
+	else if (!object_read_bytes(cli)) {
+		cli_in_end(cli);
+		cli->state = evt_dispose;
+		goto out;
+	}
+
+	cli_write_start(cli);
+	goto out;
+
+err_out_in:
+	cli_in_end(cli);
+err_out:
+	free(gpi->csums);
+	cli_err(cli, wi->err, true);
+out:
+	cli_resume(cli);
+	free(gpi);
+}
+
+bool object_get_part(struct client *cli)
+{
+	struct getpart_info *gpi;
+
+	gpi = calloc(1, sizeof(*gpi));
+	if (!gpi) {
+		cli->state = evt_dispose;
 		return true;
 	}
 
-	if (length) {
-		/* write response data */
-		rc = cli_writeq(cli, mem + (offset - aligned_ofs),
-				length, cli_cb_free, mem);
-		if (rc) {
-			free(mem);
-			free(get_resp);	/* FIXME: double-free due to
-					   cli_wq success? */
-			return true;
+	resp_init_req(&gpi->get_resp.resp, &cli->creq);
+
+	return object_worker_push(cli, &gpi->wi, worker_get_part_thr,
+				  worker_get_part_pipe);
+}
+
+struct getmulti_info {
+	struct worker_info	wi;		/* must be first */
+
+	struct chunksrv_resp_get get_resp;
+	struct chunksrv_range	*ranges;	/* as served, wire order */
+	unsigned int		n_ranges;
+};
+
+/*
+ * Open the object once for all ranges, check them and clamp their
+ * lengths.  cli->ranges is rewritten in host order for
+ * object_next_range(), which seeks from one range to the next while
+ * the data streams out, verified block by block as for GET_PART.
+ */
+static void worker_get_multi_thr(struct worker_info *wi)
+{
+	struct getmulti_info *gmi = (struct getmulti_info *) wi;
+	struct client *cli = wi->cli;
+	enum chunk_errcode err = che_InternalError;
+	struct backend_obj *obj;
+	struct chunksrv_range *r;
+	uint64_t total = 0;
+	unsigned int i;
+
+	cli->in_obj = obj = fs_obj_open(cli->table_id, cli->user, cli->key,
+					cli->key_len, &err);
+	if (!obj)
+		goto err_out;
+
+	gmi->ranges = calloc(gmi->n_ranges, sizeof(*gmi->ranges));
+	if (!gmi->ranges) {
+		err = che_InternalError;
+		goto err_out;
+	}
+
+	for (i = 0; i < gmi->n_ranges; i++) {
+		r = &cli->ranges[i];
+		r->offset = le64_to_cpu(r->offset);
+		r->len = le64_to_cpu(r->len);
+
+		if (r->offset > obj->size) {
+			err = che_InvalidSeek;
+			goto err_out;
 		}
+		if (r->len == 0 || r->len > obj->size - r->offset)
+			r->len = obj->size - r->offset;
+
+		gmi->ranges[i].offset = cpu_to_le64(r->offset);
+		gmi->ranges[i].len = cpu_to_le64(r->len);
+		total += r->len;
 	}
 
+	gmi->get_resp.resp.data_len = cpu_to_le64(total);
+	memcpy(gmi->get_resp.resp.hash, obj->hash, sizeof(obj->hash));
+	gmi->get_resp.mtime = cpu_to_le64(obj->mtime);
+
+	cli->range_idx = 0;
+	cli->n_ranges = gmi->n_ranges;
+	cli->in_len = 0;
+
+	wi->err = che_Success;
+	worker_pipe_signal(wi);
+	return;
+
+err_out:
 	cli_in_end(cli);
+	wi->err = err;
+	worker_pipe_signal(wi);
+}
 
-	return cli_write_start(cli);
+static void worker_get_multi_pipe(struct worker_info *wi)
+{
+	struct getmulti_info *gmi = (struct getmulti_info *) wi;
+	struct client *cli = wi->cli;
+	struct chunksrv_resp_get *get_resp;
+
+	cli_rd_set_poll(cli, true);
+
+	if (wi->err != che_Success)
+		goto err_out;
+
+	/* write response header */
+	get_resp = cli_resp_alloc(cli);
+	if (!get_resp) {
+		wi->err = che_InternalError;
+		goto err_out_in;
+	}
+	memcpy(get_resp, &gmi->get_resp, sizeof(*get_resp));
+	if (cli_writeq_resp(cli, get_resp, sizeof(*get_resp))) {
+		wi->err = che_InternalError;
+		goto err_out_in;
+	}
+
+	/* the ranges as served, so the client can split the data */
+	if (cli_writeq(cli, gmi->ranges, gmi->n_ranges * sizeof(*gmi->ranges),
+		       cli_cb_free, gmi->ranges)) {
+		free(gmi->ranges);
+		cli_in_end(cli);
+		cli->state = evt_dispose;
+		goto out;
+	}
+
+	/* then the data of each, back to back */
+	if (!object_next_range(cli))
+		cli_in_end(cli);
+	else if (!object_read_bytes(cli)) {
+		cli_in_end(cli);
+		cli->state = evt_dispose;
+		goto out;
+	}
+
+	cli_write_start(cli);
+	goto out;
+
+err_out_in:
+	cli_in_end(cli);
+err_out:
+	free(gmi->ranges);
+	cli_err(cli, wi->err, true);
+out:
+	cli_resume(cli);
+	free(gmi);
+}
+
+bool object_get_multi(struct client *cli)
+{
+	struct getmulti_info *gmi;
+	unsigned int n_ranges;
+
+	n_ranges = GUINT16_FROM_LE(cli->creq_getmulti.n_ranges);
+	if (n_ranges == 0)
+		return cli_err(cli, che_InvalidArgument, true);
+
+	gmi = calloc(1, sizeof(*gmi));
+	if (!gmi) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	resp_init_req(&gmi->get_resp.resp, &cli->creq);
+	gmi->n_ranges = n_ranges;
+
+	return object_worker_push(cli, &gmi->wi, worker_get_multi_thr,
+				  worker_get_multi_pipe);
 }
 
 static void worker_cp_thr(struct worker_info *wi)
@@ -473,14 +1137,12 @@ static void worker_cp_thr(struct worker_info *wi)
 	struct client *cli = wi->cli;
 	struct backend_obj *obj = NULL, *out_obj = NULL;
 	enum chunk_errcode err = che_InternalError;
+	enum chd_obj_digest digest = chunkd_srv.obj_digest;
 	unsigned char md[SHA_DIGEST_LENGTH];
-
-	buf = malloc(CLI_DATA_BUF_SZ);
-	if (!buf)
-		goto out;
+	int rc;
 
 	cli->in_obj = obj = fs_obj_open(cli->table_id, cli->user, cli->key2,
-					cli->var_len, &err);
+					le64_to_cpu(cli->creq.data_len), &err);
 	if (!obj)
 		goto out;
 
@@ -497,6 +1159,20 @@ static void worker_cp_thr(struct worker_info *wi)
 	if (!cli->out_bo)
 		goto out;
 
+	/* reflink or in-kernel copy, reusing the csums and digest */
+	rc = fs_obj_copy(out_obj, obj, &digest);
+	if (rc == 0) {
+		memcpy(md, obj->hash, sizeof(md));
+		cli->in_len = 0;
+		goto commit;
+	}
+	if (rc != -EOPNOTSUPP)
+		goto err_out;
+
+	buf = malloc(CLI_DATA_BUF_SZ);
+	if (!buf)
+		goto out;
+
 	SHA1_Init(&cli->out_hash);
 
 	while (cli->in_len > 0) {
@@ -508,7 +1184,8 @@ static void worker_cp_thr(struct worker_info *wi)
 		if (rrc == 0)
 			break;
 
-		SHA1_Update(&cli->out_hash, buf, rrc);
+		if (chunkd_srv.obj_digest == CHD_DIGEST_SHA1)
+			SHA1_Update(&cli->out_hash, buf, rrc);
 		cli->in_len -= rrc;
 
 		while (rrc > 0) {
@@ -520,9 +1197,11 @@ static void worker_cp_thr(struct worker_info *wi)
 		}
 	}
 
-	SHA1_Final(md, &cli->out_hash);
+	if (chunkd_srv.obj_digest == CHD_DIGEST_SHA1)
+		SHA1_Final(md, &cli->out_hash);
 
-	if (!fs_obj_write_commit(out_obj, cli->user, md, false))
+commit:
+	if (!fs_obj_write_commit(out_obj, cli->user, digest, md, NULL))
 		goto err_out;
 
 	err = che_Success;
@@ -536,48 +1215,29 @@ out:
 	return;
 
 err_out:
-	/* FIXME: remove half-written destination object */
+	/*
+	 * Abort the destination before the key is released: its file is
+	 * unlinked, or its pack claim dropped, so no partial copy is left
+	 * under the key.
+	 */
+	fs_obj_free(out_obj);
+	cli->out_bo = NULL;
 	goto out;
 }
 
 static void worker_cp_pipe(struct worker_info *wi)
 {
 	struct client *cli = wi->cli;
-	bool rcb;
 
 	cli_rd_set_poll(cli, true);
 
-	rcb = cli_err(cli, wi->err, (wi->err == che_Success) ? true : false);
-	if (rcb) {
-		short events = POLLIN;
-		if (cli->writing)
-			events |= POLLOUT;
-		tcp_cli_event(cli->fd, events, cli);
-	}
-
-	memset(wi, 0xffffffff, sizeof(*wi));	/* poison */
-	free(wi);
+	cli_err(cli, wi->err, (wi->err == che_Success) ? true : false);
+	cli_resume(cli);
 }
 
 bool object_cp(struct client *cli)
 {
-	enum chunk_errcode err = che_InternalError;
-	struct worker_info *wi;
-
-	cli_rd_set_poll(cli, false);
-
-	wi = calloc(1, sizeof(*wi));
-	if (!wi) {
-		cli_rd_set_poll(cli, true);
-		return cli_err(cli, err, false);
-	}
-
-	wi->thr_ev = worker_cp_thr;
-	wi->pipe_ev = worker_cp_pipe;
-	wi->cli = cli;
-
-	g_thread_pool_push(chunkd_srv.workers, wi, NULL);
-
-	return false;
+	return object_worker_push(cli, &cli->wi, worker_cp_thr,
+				  worker_cp_pipe);
 }
 
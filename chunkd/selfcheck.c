@@ -14,7 +14,7 @@
 
 struct chk_arg {
 	TCHDB *hdb;
-	// GThread *gthread;
+	GThread *gthread;
 };
 
 struct chk_tls {
@@ -34,10 +34,14 @@ static void chk_list_objs(struct chk_tls *tls, uint32_t table_id)
 	time_t mtime;
 	void *key_in;
 	size_t klen_in, csumlen_in;
+	off_t value_ofs;
+	bool old_fmt;
+	enum chd_obj_digest digest;
 	struct objcache_entry *cep;
 	int rc;
 
 	memset(&lister, 0, sizeof(struct fs_obj_lister));
+	lister.reap_tmp = true;
 	rc = fs_list_objs_open(&lister, chunkd_srv.vol_path, table_id);
 	if (rc) {
 		applog(LOG_WARNING, "Cannot open table %u: %s", table_id,
@@ -47,8 +51,9 @@ static void chk_list_objs(struct chk_tls *tls, uint32_t table_id)
 
 	while (fs_list_objs_next(&lister, &fn) > 0) {
 
-		rc = fs_obj_hdr_read(fn, &owner, md, &key_in, &klen_in,
-				     &csumlen_in, &size, &mtime);
+		rc = fs_obj_hdr_read(fn, &owner, md, &digest, &key_in, &klen_in,
+				     &csumlen_in, &value_ofs, &old_fmt,
+				     &size, &mtime);
 		if (rc < 0) {
 			free(fn);
 			break;
@@ -64,7 +69,7 @@ static void chk_list_objs(struct chk_tls *tls, uint32_t table_id)
 			break;
 		}
 
-		rc = fs_obj_do_sum(fn, klen_in, csumlen_in, md_act);
+		rc = fs_obj_do_sum(fn, value_ofs, csumlen_in, digest, md_act);
 		if (rc) {
 			applog(LOG_INFO, "Cannot compute checksum for %s", fn);
 		} else {
@@ -80,14 +85,26 @@ static void chk_list_objs(struct chk_tls *tls, uint32_t table_id)
 					       "Checksum mismatch for %s: "
 					       "expected %s actual %s",
 					       fn, hashstr, hashstr_act);
+					fs_index_del(table_id, key_in, klen_in);
 					fs_obj_disable(fn);
+					fs_obj_uncache(table_id, key_in,
+						       klen_in);
 					/*
 					 * FIXME Suicide the whole server if
 					 * fs_obj_disable fails a few times,
 					 * maybe? But what about races?
 					 */
 				} else {
+					fs_index_check(table_id, fn, key_in,
+						       klen_in, owner, md,
+						       size, mtime);
 					tls->stat_ok++;
+
+					/* verified; bring it to CHU2 */
+					if (old_fmt)
+						fs_obj_convert(table_id, fn,
+							       key_in, klen_in,
+							       cep);
 				}
 			} else {
 				tls->stat_conflict++;
@@ -103,6 +120,72 @@ static void chk_list_objs(struct chk_tls *tls, uint32_t table_id)
 	fs_list_objs_close(&lister);
 }
 
+struct chk_packed {
+	uint32_t		table_id;
+	const void		*key;
+	size_t			key_len;
+	bool			damaged;
+	char			*owner;
+	unsigned char		md[CHD_CSUM_SZ];
+	unsigned long long	size;
+	time_t			mtime;
+};
+
+/* under the objcache lock, so that no PUT or DEL of the key interleaves */
+static void chk_packed_fix(void *arg)
+{
+	struct chk_packed *cp = arg;
+
+	if (cp->damaged) {
+		fs_index_del(cp->table_id, cp->key, cp->key_len);
+		fs_pack_remove(cp->table_id, cp->key, cp->key_len);
+		fs_obj_uncache(cp->table_id, cp->key, cp->key_len);
+	} else
+		fs_index_check(cp->table_id, NULL, cp->key, cp->key_len,
+			       cp->owner, cp->md, cp->size, cp->mtime);
+}
+
+/*
+ * Packed objects have no files for chk_list_objs to find: verify each
+ * record in pack.tch, drop the damaged ones, and re-index the others.
+ */
+static void chk_packed_one(uint32_t table_id, const void *key,
+			   size_t key_len, void *arg)
+{
+	struct chk_tls *tls = arg;
+	struct chk_packed cp = {
+		.table_id = table_id, .key = key, .key_len = key_len,
+	};
+	struct objcache_entry *cep;
+	int rc;
+
+	cep = objcache_get(&chunkd_srv.actives, key, key_len);
+	if (!cep) {
+		applog(LOG_ERR, "chk: objcache_get failed");
+		return;
+	}
+
+	rc = fs_obj_pack_verify(table_id, key, key_len, &cp.owner, cp.md,
+				&cp.size, &cp.mtime);
+	if (rc < 0) {
+		if (rc != -ENOENT)
+			applog(LOG_INFO, "chk: cannot verify packed object "
+			       "in table %u: %s", table_id, strerror(-rc));
+		goto out;
+	}
+	cp.damaged = (rc == 0);
+
+	if (!objcache_run_clean(&chunkd_srv.actives, cep,
+				chk_packed_fix, &cp))
+		tls->stat_conflict++;
+	else if (!cp.damaged)
+		tls->stat_ok++;
+
+	free(cp.owner);
+out:
+	objcache_put(&chunkd_srv.actives, cep);
+}
+
 static void chk_dbscan(struct chk_tls *tls)
 {
 	TCHDB *hdb = tls->arg->hdb;
@@ -130,6 +213,8 @@ static void chk_dbscan(struct chk_tls *tls)
 		}
 
 		chk_list_objs(tls, GUINT32_FROM_LE(*val_p));
+		fs_pack_foreach(GUINT32_FROM_LE(*val_p), chk_packed_one, tls);
+		fs_pack_compact(GUINT32_FROM_LE(*val_p));
 
 		free(val_p);
 		free(kbuf);
@@ -249,16 +334,41 @@ int chk_spawn(TCHDB *hdb)
 	}
 	arg->hdb = hdb;
 
-	gthread = g_thread_create(chk_thread_func, arg, FALSE, &error);
+	gthread = g_thread_create(chk_thread_func, arg, TRUE, &error);
 	if (!gthread) {
 		applog(LOG_ERR, "Failed to start replication thread: %s",
 		       error->message);
+		free(arg);
 		return -1;
 	}
 
-	// arg->gthread = gthread;
+	arg->gthread = gthread;
 	thread = arg;
 
 	return 0;
 }
 
+/*
+ * Stop the selfcheck thread, if it was ever started, and wait for it
+ * to finish any scan under way.  It uses the fs layer and the caches,
+ * so this must come before they are closed.  Net threads are stopped
+ * already, so nobody can chk_spawn() meanwhile.
+ */
+void chk_stop(void)
+{
+	unsigned char cmd = CHK_CMD_EXIT;
+
+	if (!thread)
+		return;
+
+	if (write(chunkd_srv.chk_pipe[1], &cmd, 1) != 1) {
+		applog(LOG_ERR, "chk: exit command write failed: %s",
+		       strerror(errno));
+		return;
+	}
+	g_thread_join(thread->gthread);
+
+	free(thread);
+	thread = NULL;
+}
+
@@ -42,6 +42,7 @@
 #include <argp.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include <glib.h>
 #include <openssl/hmac.h>
 #include <openssl/ssl.h>
@@ -260,16 +261,65 @@ static void stats_signal(int signo)
 }
 
 #define X(stat) \
-	applog(LOG_INFO, "STAT %s %lu", #stat, chunkd_srv.stats.stat)
+	applog(LOG_INFO, "STAT %s %lu", #stat, stats.stat)
 
 static void stats_dump(void)
 {
+	struct server_stats stats;
+	int i;
+
+	/* each event loop thread keeps its own counters; sum them here */
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < chunkd_srv.n_threads; i++) {
+		struct server_stats *ts = &chunkd_srv.threads[i].stats;
+
+		stats.poll += ts->poll;
+		stats.event += ts->event;
+		stats.tcp_accept += ts->tcp_accept;
+		stats.opt_write += ts->opt_write;
+	}
+
 	X(poll);
 	X(event);
 	X(tcp_accept);
 	X(opt_write);
 }
 
+static void metacache_stats_dump(void)
+{
+	struct metacache_stats stats;
+
+	metacache_stats(&chunkd_srv.metas, &stats);
+
+	applog(LOG_INFO, "STAT metacache_hits %lu", stats.hits);
+	applog(LOG_INFO, "STAT metacache_misses %lu", stats.misses);
+	applog(LOG_INFO, "STAT metacache_evictions %lu", stats.evictions);
+	applog(LOG_INFO, "STAT metacache_entries %lu", stats.entries);
+	applog(LOG_INFO, "STAT metacache_csum_bytes %lu", stats.csum_bytes);
+}
+
+static void fdcache_stats_dump(void)
+{
+	struct fdcache_stats stats;
+
+	fdcache_stats(&chunkd_srv.fds, &stats);
+
+	applog(LOG_INFO, "STAT fdcache_hits %lu", stats.hits);
+	applog(LOG_INFO, "STAT fdcache_misses %lu", stats.misses);
+	applog(LOG_INFO, "STAT fdcache_evictions %lu", stats.evictions);
+	applog(LOG_INFO, "STAT fdcache_entries %lu", stats.entries);
+}
+
+static void flusher_stats_dump(void)
+{
+	unsigned long batches, reqs;
+
+	flusher_stats(&batches, &reqs);
+
+	applog(LOG_INFO, "STAT sync_batches %lu", batches);
+	applog(LOG_INFO, "STAT sync_reqs %lu", reqs);
+}
+
 #undef X
 
 void resp_init_req(struct chunksrv_resp *resp,
@@ -284,6 +334,7 @@ void resp_init_req(struct chunksrv_resp *resp,
 static bool cli_write_free(struct client *cli, struct client_write *tmp,
 			   bool done)
 {
+	struct net_thread *thr = cli->thr;
 	bool rcb = false;
 
 	/* call callback, clean up struct */
@@ -291,14 +342,14 @@ static bool cli_write_free(struct client *cli, struct client_write *tmp,
 		rcb = tmp->cb(cli, tmp, done);
 	list_del(&tmp->node);
 
-	if (chunkd_srv.trash_sz < CHD_TRASH_MAX) {
+	if (thr->trash_sz < CHD_TRASH_MAX) {
 
 		/* recycle struct for future use */
 		memset(tmp, 0, sizeof(*tmp));
 		INIT_LIST_HEAD(&tmp->node);
 
-		list_add(&tmp->node, &chunkd_srv.wr_trash);
-		chunkd_srv.trash_sz++;
+		list_add(&tmp->node, &thr->wr_trash);
+		thr->trash_sz++;
 	} else
 		free(tmp);
 
@@ -314,6 +365,49 @@ static void cli_write_free_all(struct client *cli)
 	}
 }
 
+/*
+ * Client data buffers come from a small per-thread freelist, so that
+ * idle connections do not pin CLI_DATA_BUF_SZ-sized buffers.  The
+ * freelist link lives inside the idle buffer itself.
+ */
+char *cli_buf_get(struct client *cli)
+{
+	struct net_thread *thr = cli->thr;
+	struct list_head *tmp;
+
+	if (!thr->buf_trash_sz)
+		return malloc(CLI_DATA_BUF_SZ);
+
+	tmp = thr->buf_trash.next;
+	list_del(tmp);
+	thr->buf_trash_sz--;
+
+	return (char *) tmp;
+}
+
+static void cli_buf_put(struct client *cli, char *buf)
+{
+	struct net_thread *thr = cli->thr;
+	struct list_head *tmp = (struct list_head *) buf;
+
+	if (!buf)
+		return;
+
+	if (thr->buf_trash_sz < CHD_BUF_TRASH_MAX) {
+		list_add(tmp, &thr->buf_trash);
+		thr->buf_trash_sz++;
+	} else
+		free(buf);
+}
+
+static void cli_bufs_release(struct client *cli)
+{
+	cli_buf_put(cli, cli->netbuf);
+	cli_buf_put(cli, cli->netbuf_out);
+	cli->netbuf = NULL;
+	cli->netbuf_out = NULL;
+}
+
 static void cli_free(struct client *cli)
 {
 	applog(LOG_INFO, "client host %s port %s disconnected",
@@ -323,6 +417,8 @@ static void cli_free(struct client *cli)
 
 	cli_out_end(cli);
 	cli_in_end(cli);
+	cli_bufs_release(cli);
+	free(cli->batch_buf);
 
 	if (cli->ev_mask && (event_del(&cli->ev) < 0))
 		applog(LOG_ERR, "TCP cli poll del failed");
@@ -363,6 +459,14 @@ static struct client *cli_alloc(void)
 
 static bool cli_evt_dispose(struct client *cli, unsigned int events)
 {
+	/* an I/O worker still owns our buffers and backend object;
+	 * go quiet, and let its completion bring us back here
+	 */
+	if (cli->out_busy) {
+		cli_rd_set_poll(cli, false);
+		return false;
+	}
+
 	/* if write queue is not empty, we should continue to get
 	 * poll callbacks here until it is
 	 */
@@ -381,6 +485,11 @@ static bool cli_evt_recycle(struct client *cli, unsigned int events)
 	if (!list_empty(&cli->write_q))
 		return false;
 
+	cli_bufs_release(cli);
+
+	free(cli->batch_buf);
+	cli->batch_buf = NULL;
+
 	cli->req_ptr = &cli->creq;
 	cli->req_used = 0;
 	cli->state = evt_read_fixed;
@@ -399,6 +508,7 @@ static void cli_ev_update(struct client *cli, short new_mask)
 	if (new_mask) {
 		event_set(&cli->ev, cli->fd, new_mask | EV_PERSIST,
 			  tcp_cli_event, cli);
+		event_base_set(cli->thr->evbase, &cli->ev);
 		if (event_add(&cli->ev, NULL) < 0)
 			applog(LOG_ERR, "unable to ready cli fd");
 	}
@@ -570,7 +680,7 @@ bool cli_write_start(struct client *cli)
 	 */
 	cli_writable(cli);
 	if (list_empty(&cli->write_q)) {
-		chunkd_srv.stats.opt_write++;
+		cli->thr->stats.opt_write++;
 		return true;		/* loop, not poll */
 	}
 
@@ -580,28 +690,40 @@ bool cli_write_start(struct client *cli)
 	return false;			/* poll wait */
 }
 
-int cli_writeq(struct client *cli, const void *buf, unsigned int buflen,
-		     cli_write_func cb, void *cb_data)
+static struct client_write *cli_write_alloc(struct client *cli)
 {
+	struct net_thread *thr = cli->thr;
 	struct client_write *wr;
 
-	if (!buf || !buflen)
-		return -EINVAL;
-
-	if (!chunkd_srv.trash_sz) {
+	if (!thr->trash_sz) {
 		wr = calloc(1, sizeof(struct client_write));
 		if (!wr)
-			return -ENOMEM;
+			return NULL;
 
 		INIT_LIST_HEAD(&wr->node);
 	} else {
-		struct list_head *tmp = chunkd_srv.wr_trash.next;
+		struct list_head *tmp = thr->wr_trash.next;
 		wr = list_entry(tmp, struct client_write, node);
 
 		list_del_init(&wr->node);
-		chunkd_srv.trash_sz--;
+		thr->trash_sz--;
 	}
 
+	return wr;
+}
+
+int cli_writeq(struct client *cli, const void *buf, unsigned int buflen,
+		     cli_write_func cb, void *cb_data)
+{
+	struct client_write *wr;
+
+	if (!buf || !buflen)
+		return -EINVAL;
+
+	wr = cli_write_alloc(cli);
+	if (!wr)
+		return -ENOMEM;
+
 	wr->buf = buf;
 	wr->len = buflen;
 	wr->cb = cb;
@@ -617,14 +739,15 @@ bool cli_wr_sendfile(struct client *cli, cli_write_func cb)
 {
 	struct client_write *wr;
 
-	wr = calloc(1, sizeof(struct client_write));
+	wr = cli_write_alloc(cli);
 	if (!wr)
 		return false;
 
+	wr->buf = NULL;
 	wr->len = cli->in_len;
 	wr->cb = cb;
+	wr->cb_data = NULL;
 	wr->sendfile = true;
-	INIT_LIST_HEAD(&wr->node);
 
 	list_add_tail(&wr->node, &cli->write_q);
 
@@ -679,6 +802,55 @@ bool cli_cb_free(struct client *cli, struct client_write *wr,
 	return false;
 }
 
+/*
+ * Response headers are built in one of the client's preallocated
+ * slots.  More than CLI_RESP_SLOTS headers in flight at once is not
+ * expected, but is handled by falling back to the heap.
+ */
+void *cli_resp_alloc(struct client *cli)
+{
+	int i;
+
+	for (i = 0; i < CLI_RESP_SLOTS; i++) {
+		if (!(cli->resp_slot_used & (1U << i))) {
+			cli->resp_slot_used |= (1U << i);
+			return &cli->resp_slot[i];
+		}
+	}
+
+	return malloc(sizeof(union cli_resp_slot));
+}
+
+void cli_resp_free(struct client *cli, void *resp)
+{
+	union cli_resp_slot *slot = resp;
+
+	if (slot >= &cli->resp_slot[0] &&
+	    slot < &cli->resp_slot[CLI_RESP_SLOTS])
+		cli->resp_slot_used &= ~(1U << (slot - &cli->resp_slot[0]));
+	else
+		free(resp);
+}
+
+static bool cli_cb_resp_free(struct client *cli, struct client_write *wr,
+			     bool done)
+{
+	cli_resp_free(cli, wr->cb_data);
+
+	return false;
+}
+
+int cli_writeq_resp(struct client *cli, void *resp, unsigned int len)
+{
+	int rc;
+
+	rc = cli_writeq(cli, resp, len, cli_cb_resp_free, resp);
+	if (rc)
+		cli_resp_free(cli, resp);
+
+	return rc;
+}
+
 static int cli_write_list(struct client *cli, GList *list)
 {
 	int rc = 0;
@@ -709,7 +881,7 @@ bool cli_err(struct client *cli, enum chunk_errcode code, bool recycle_ok)
 		applog(LOG_INFO, "client %s error %s",
 		       cli->addr_host, err_info[code].code);
 
-	resp = malloc(sizeof(*resp));
+	resp = cli_resp_alloc(cli);
 	if (!resp) {
 		cli->state = evt_dispose;
 		return true;
@@ -724,11 +896,9 @@ bool cli_err(struct client *cli, enum chunk_errcode code, bool recycle_ok)
 	else
 		cli->state = evt_dispose;
 
-	rc = cli_writeq(cli, resp, sizeof(*resp), cli_cb_free, resp);
-	if (rc) {
-		free(resp);
+	rc = cli_writeq_resp(cli, resp, sizeof(*resp));
+	if (rc)
 		return true;
-	}
 
 	return cli_write_start(cli);
 }
@@ -740,7 +910,7 @@ static bool cli_resp_xml(struct client *cli, GList *content)
 	size_t content_len = strlist_len(content);
 	struct chunksrv_resp *resp = NULL;
 
-	resp = malloc(sizeof(*resp));
+	resp = cli_resp_alloc(cli);
 	if (!resp) {
 		cli->state = evt_dispose;
 		return true;
@@ -752,9 +922,8 @@ static bool cli_resp_xml(struct client *cli, GList *content)
 
 	cli->state = evt_recycle;
 
-	rc = cli_writeq(cli, resp, sizeof(*resp), cli_cb_free, resp);
+	rc = cli_writeq_resp(cli, resp, sizeof(*resp));
 	if (rc) {
-		free(resp);
 		cli->state = evt_dispose;
 		return true;
 	}
@@ -773,64 +942,25 @@ static bool cli_resp_xml(struct client *cli, GList *content)
 	return rcb;
 }
 
-static bool cli_resp_bin(struct client *cli, void *data, size_t content_len)
+static void volume_list_free(GList *res)
 {
-	int rc;
-	bool rcb;
-	struct chunksrv_resp *resp = NULL;
-	void *bin;
-
-	resp = malloc(sizeof(*resp));
-	if (!resp) {
-		cli->state = evt_dispose;
-		return true;
-	}
+	GList *tmpl;
 
-	bin = malloc(content_len);
-	if (!bin) {
-		free(resp);
-		cli->state = evt_dispose;
-		return true;
-	}
-	memcpy(bin, data, content_len);
-
-	resp_init_req(resp, &cli->creq);
-
-	resp->data_len = cpu_to_le64(content_len);
-
-	cli->state = evt_recycle;
-
-	rc = cli_writeq(cli, resp, sizeof(*resp), cli_cb_free, resp);
-	if (rc) {
-		free(resp);
-		free(bin);
-		cli->state = evt_dispose;
-		return true;
-	}
+	for (tmpl = res; tmpl; tmpl = tmpl->next) {
+		struct volume_entry *ve = tmpl->data;
 
-	rc = cli_writeq(cli, bin, content_len, cli_cb_free, bin);
-	if (rc) {
-		free(bin);
-		cli->state = evt_dispose;
-		return true;
+		free(ve->key);
+		free(ve);
 	}
-
-	rcb = cli_write_start(cli);
-
-	if (cli->state == evt_recycle)
-		return true;
-
-	return rcb;
+	g_list_free(res);
 }
 
-static bool volume_list(struct client *cli)
+static bool volume_list_xml(struct client *cli, GList *res, bool paged,
+			    unsigned int max_keys, bool truncated)
 {
 	char *s;
 	GList *content, *tmpl;
-	bool rcb;
-	GList *res = NULL;
-
-	res = fs_list_objs(cli->table_id, cli->user);
+	struct volume_entry *ve = NULL;
 
 	s = g_markup_printf_escaped(
 "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
@@ -841,17 +971,28 @@ static bool volume_list(struct client *cli)
 
 	content = g_list_append(NULL, s);
 
-	tmpl = res;
-	while (tmpl) {
-		char timestr[50], *esc_key;
-		struct volume_entry *ve;
+	if (paged) {
+		char *esc_prefix = g_markup_escape_text(cli->key, cli->key_len);
+
+		s = g_strdup_printf(
+			 "  <Prefix>%s</Prefix>\r\n"
+			 "  <MaxKeys>%u</MaxKeys>\r\n"
+			 "  <IsTruncated>%s</IsTruncated>\r\n",
+			 esc_prefix, max_keys, truncated ? "true" : "false");
+		content = g_list_prepend(content, s);
+		free(esc_prefix);
+	}
+
+	for (tmpl = res; tmpl; tmpl = tmpl->next) {
+		char timestr[50], hashstr[(CHD_CSUM_SZ * 2) + 1], *esc_key;
 
 		ve = tmpl->data;
-		tmpl = tmpl->next;
 
 		/* copy-and-escape key into nul-terminated buffer */
 		esc_key = g_markup_escape_text(ve->key, ve->key_len);
 
+		hexstr(ve->hash, CHD_CSUM_SZ, hashstr);
+
 		s = g_strdup_printf(
                          "  <Contents>\r\n"
 			 "    <Name>%s</Name>\r\n"
@@ -863,25 +1004,150 @@ static bool volume_list(struct client *cli)
 
 			 esc_key,
 			 time2str(timestr, ve->mtime),
-			 ve->hash,
+			 hashstr,
 			 ve->size,
 			 ve->owner);
 
-		content = g_list_append(content, s);
+		/* prepend, not append: lists may be millions long */
+		content = g_list_prepend(content, s);
 
 		free(esc_key);
-		free(ve->key);
-		free(ve);
 	}
 
-	g_list_free(res);
+	/* the last key returned, hex-encoded since keys are binary */
+	if (truncated && ve) {
+		char marker[(CHD_KEY_SZ * 2) + 1];
+
+		hexstr(ve->key, ve->key_len, marker);
+		s = g_strdup_printf("  <NextMarker>%s</NextMarker>\r\n",
+				    marker);
+		content = g_list_prepend(content, s);
+	}
 
 	s = strdup("</ListVolumeResult>\r\n");
-	content = g_list_append(content, s);
+	content = g_list_prepend(content, s);
+	content = g_list_reverse(content);
+
+	return cli_resp_xml(cli, content);
+}
+
+/*
+ * Binary list (CHF_LIST_BIN): a chunksrv_list_hdr, then per key a
+ * chunksrv_list_ent and the key.  Owners are left out, since a LIST only
+ * returns the caller's own objects.  The body goes out in
+ * CLI_DATA_BUF_SZ pieces, so that even a whole-table list never needs
+ * one huge allocation.
+ */
+static bool volume_list_bin(struct client *cli, GList *res, bool truncated)
+{
+	struct chunksrv_resp *resp;
+	struct chunksrv_list_hdr *hdr;
+	struct chunksrv_list_ent *ent;
+	uint64_t content_len = sizeof(*hdr);
+	unsigned int n_ents = 0;
+	size_t buf_len = 0, rec_len;
+	char *buf = NULL;
+	GList *tmpl;
+	bool rcb;
 
-	rcb = cli_resp_xml(cli, content);
+	for (tmpl = res; tmpl; tmpl = tmpl->next) {
+		struct volume_entry *ve = tmpl->data;
 
-	g_list_free(content);
+		content_len += sizeof(*ent) + ve->key_len;
+		n_ents++;
+	}
+
+	resp = cli_resp_alloc(cli);
+	if (!resp)
+		goto err_out;
+
+	resp_init_req(resp, &cli->creq);
+	resp->data_len = cpu_to_le64(content_len);
+
+	if (cli_writeq_resp(cli, resp, sizeof(*resp)))
+		goto err_out;
+
+	buf = malloc(CLI_DATA_BUF_SZ);
+	if (!buf)
+		goto err_out;
+
+	hdr = (struct chunksrv_list_hdr *) buf;
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, CHUNKD_LIST_MAGIC, sizeof(hdr->magic));
+	hdr->flags = truncated ? CHLF_TRUNCATED : 0;
+	hdr->n_ents = GUINT32_TO_LE(n_ents);
+	buf_len = sizeof(*hdr);
+
+	for (tmpl = res; tmpl; tmpl = tmpl->next) {
+		struct volume_entry *ve = tmpl->data;
+
+		rec_len = sizeof(*ent) + ve->key_len;
+		if (buf_len + rec_len > CLI_DATA_BUF_SZ) {
+			if (cli_writeq(cli, buf, buf_len, cli_cb_free, buf))
+				goto err_out;
+			buf = malloc(CLI_DATA_BUF_SZ);
+			if (!buf)
+				goto err_out;
+			buf_len = 0;
+		}
+
+		ent = (struct chunksrv_list_ent *) (buf + buf_len);
+		ent->size = GUINT64_TO_LE(ve->size);
+		ent->mtime = GUINT64_TO_LE(ve->mtime);
+		memcpy(ent->hash, ve->hash, CHD_CSUM_SZ);
+		ent->key_len = GUINT16_TO_LE(ve->key_len);
+		memcpy(ent + 1, ve->key, ve->key_len);
+		buf_len += rec_len;
+	}
+
+	if (cli_writeq(cli, buf, buf_len, cli_cb_free, buf))
+		goto err_out;
+
+	cli->state = evt_recycle;
+
+	rcb = cli_write_start(cli);
+	if (cli->state == evt_recycle)
+		return true;
+	return rcb;
+
+err_out:
+	free(buf);
+	cli->state = evt_dispose;
+	return true;
+}
+
+/*
+ * A plain LIST returns the whole table.  A paged LIST (CHF_LIST_PAGED)
+ * returns at most max_keys keys that start with the request key (the
+ * prefix) and sort after the marker, plus whether more remain.  With
+ * CHF_LIST_BIN the result is binary instead of XML.
+ */
+static bool volume_list(struct client *cli)
+{
+	bool rcb;
+	GList *res = NULL;
+	bool paged = (cli->creq.flags & CHF_LIST_PAGED);
+	unsigned int max_keys = 0;
+	size_t marker_len = 0;
+	bool truncated = false;
+
+	if (paged) {
+		max_keys = le32_to_cpu(cli->creq_list.max_keys);
+		if (max_keys == 0 || max_keys > CHD_LIST_MAX_KEYS)
+			max_keys = CHD_LIST_MAX_KEYS;
+		marker_len = GUINT16_FROM_LE(cli->creq_list.marker_len);
+	}
+
+	res = fs_list_objs(cli->table_id, cli->user,
+			   cli->key, paged ? cli->key_len : 0,
+			   cli->key2, marker_len, max_keys, &truncated);
+
+	if (cli->creq.flags & CHF_LIST_BIN)
+		rcb = volume_list_bin(cli, res, truncated);
+	else
+		rcb = volume_list_xml(cli, res, paged, max_keys, truncated);
+
+	volume_list_free(res);
 
 	return rcb;
 }
@@ -904,19 +1170,34 @@ out:
 	return cli_err(cli, err, true);
 }
 
-static bool authcheck(const struct chunksrv_req *req,
-		      const struct chunksrv_req_getpart *gpr,
-		      const void *key, size_t key_len, const char *secret_key)
+static bool authcheck(const struct client *cli, const char *secret_key)
 {
+	const struct chunksrv_req *req = &cli->creq;
 	char req_buf[sizeof(struct chunksrv_req) + CHD_KEY_SZ +
-		     sizeof(struct chunksrv_req_getpart)];
+		     sizeof(struct chunksrv_req_list) + CHD_KEY_SZ +
+		     sizeof(struct chunksrv_req_getmulti) +
+		     sizeof(cli->ranges)];
 	struct chunksrv_req *tmpreq = (struct chunksrv_req *) req_buf;
 	char hmac[64];
 	void *p = (tmpreq + 1);
 
+	/* rebuild the request as sent, for signing */
 	memcpy(tmpreq, req, sizeof(*req));
-	memcpy(p, key, key_len);
-	memcpy(p + key_len, gpr, sizeof(*gpr));
+	memcpy(p, cli->key, cli->key_len);
+	p += cli->key_len;
+	if (req->op == CHO_GET_PART)
+		memcpy(p, &cli->creq_getpart, sizeof(cli->creq_getpart));
+	else if (req->op == CHO_GET_MULTI) {
+		memcpy(p, &cli->creq_getmulti, sizeof(cli->creq_getmulti));
+		p += sizeof(cli->creq_getmulti);
+		memcpy(p, cli->ranges,
+		       GUINT16_FROM_LE(cli->creq_getmulti.n_ranges) *
+		       sizeof(struct chunksrv_range));
+	} else if (req->op == CHO_LIST && (req->flags & CHF_LIST_PAGED)) {
+		memcpy(p, &cli->creq_list, sizeof(cli->creq_list));
+		p += sizeof(cli->creq_list);
+		memcpy(p, cli->key2, GUINT16_FROM_LE(cli->creq_list.marker_len));
+	}
 	memset(tmpreq->sig, 0, sizeof(tmpreq->sig));
 
 	chreq_sign(tmpreq, secret_key, hmac);
@@ -926,7 +1207,6 @@ static bool authcheck(const struct chunksrv_req *req,
 
 static bool login_user(struct client *cli)
 {
-	struct chunksrv_req *req = &cli->creq;
 	enum chunk_errcode err;
 
 	/* validate username length */
@@ -942,8 +1222,7 @@ static bool login_user(struct client *cli)
 	/* for lack of a better authentication scheme, we
 	 * supply the username as the secret key
 	 */
-	if (!authcheck(req, &cli->creq_getpart,
-		       cli->key, cli->key_len, cli->user)) {
+	if (!authcheck(cli, cli->user)) {
 		err = che_SignatureDoesNotMatch;
 		cli->state = evt_dispose;
 		goto err_out;
@@ -1008,29 +1287,54 @@ static bool chk_start(struct client *cli)
 
 static bool chk_status(struct client *cli)
 {
-	struct chunk_check_status outbuf;
+	struct chunksrv_resp_chkstat *resp;
+	struct chunk_check_status *outbuf;
+	bool rcb;
 
-	memset(&outbuf, 0, sizeof(struct chunk_check_status));
+	resp = cli_resp_alloc(cli);
+	if (!resp) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	resp_init_req(&resp->resp, &cli->creq);
+	resp->resp.data_len = cpu_to_le64(sizeof(struct chunk_check_status));
+
+	outbuf = &resp->chkstat;
+	memset(outbuf, 0, sizeof(struct chunk_check_status));
 
 	g_mutex_lock(chunkd_srv.bigmutex);
 
-	outbuf.lastdone = cpu_to_le64(chunkd_srv.chk_done);
+	outbuf->lastdone = cpu_to_le64(chunkd_srv.chk_done);
 
 	switch (chunkd_srv.chk_state) {
 	case CHK_ST_IDLE:
-		outbuf.state = chk_Idle;
+		outbuf->state = chk_Idle;
 		break;
 	case CHK_ST_INIT:
 	case CHK_ST_RUNNING:
-		outbuf.state = chk_Active;
+		outbuf->state = chk_Active;
 		break;
 	default:
-		outbuf.state = chk_Off;
+		outbuf->state = chk_Off;
 	}
 
 	g_mutex_unlock(chunkd_srv.bigmutex);
 
-	return cli_resp_bin(cli, &outbuf, sizeof(struct chunk_check_status));
+	cli->state = evt_recycle;
+
+	/* header and body go out from the same slot */
+	if (cli_writeq_resp(cli, resp, sizeof(*resp))) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	rcb = cli_write_start(cli);
+
+	if (cli->state == evt_recycle)
+		return true;
+
+	return rcb;
 }
 
 static bool valid_req_hdr(const struct chunksrv_req *req)
@@ -1063,6 +1367,8 @@ static const char *op2str(enum chunksrv_ops op)
 	case CHO_START_TLS:	return "CHO_START_TLS";
 	case CHO_CP:		return "CHO_CP";
 	case CHO_GET_PART:	return "CHO_GET_PART";
+	case CHO_GET_MULTI:	return "CHO_GET_MULTI";
+	case CHO_PUT_BATCH:	return "CHO_PUT_BATCH";
 
 	default:
 		return "BUG/UNKNOWN!";
@@ -1100,9 +1406,7 @@ static bool cli_evt_exec_req(struct client *cli, unsigned int events)
 	/* for lack of a better authentication scheme, we
 	 * supply the username as the secret key
 	 */
-	if (logged_in &&
-	    !authcheck(req, &cli->creq_getpart,
-	    	       cli->key, cli->key_len, cli->user)) {
+	if (logged_in && !authcheck(cli, cli->user)) {
 		err = che_SignatureDoesNotMatch;
 		goto err_out;
 	}
@@ -1121,7 +1425,9 @@ static bool cli_evt_exec_req(struct client *cli, unsigned int events)
 	switch (req->op) {
 	case CHO_GET:
 	case CHO_GET_META:
+	case CHO_GET_MULTI:
 	case CHO_PUT:
+	case CHO_PUT_BATCH:
 	case CHO_DEL:
 	case CHO_LIST:
 		if (!have_table) {
@@ -1155,9 +1461,15 @@ static bool cli_evt_exec_req(struct client *cli, unsigned int events)
 	case CHO_GET_PART:
 		rcb = object_get_part(cli);
 		break;
+	case CHO_GET_MULTI:
+		rcb = object_get_multi(cli);
+		break;
 	case CHO_PUT:
 		rcb = object_put(cli);
 		break;
+	case CHO_PUT_BATCH:
+		rcb = object_put_batch(cli);
+		break;
 	case CHO_DEL:
 		rcb = object_del(cli);
 		break;
@@ -1215,6 +1527,69 @@ err_out:
 	goto out;
 }
 
+/*
+ * Variable-length records follow the fixed request header: the key, then
+ * for some ops a second record, and for a paged LIST a third (the marker).
+ * Set up to read the next non-empty one, or go execute the request.
+ */
+static void cli_req_next_var(struct client *cli)
+{
+	const struct chunksrv_req *req = &cli->creq;
+	bool paged_list = (req->op == CHO_LIST) &&
+			  (req->flags & CHF_LIST_PAGED);
+	void *ptr = NULL;
+	uint64_t len = 0;
+
+	while (len == 0) {
+		switch (cli->var_idx++) {
+		case 0:
+			ptr = &cli->key;
+			len = cli->key_len;
+			break;
+		case 1:
+			if (req->op == CHO_CP) {
+				ptr = &cli->key2;
+				len = le64_to_cpu(req->data_len);
+			} else if (req->op == CHO_GET_PART) {
+				ptr = &cli->creq_getpart;
+				len = sizeof(cli->creq_getpart);
+			} else if (req->op == CHO_GET_MULTI) {
+				ptr = &cli->creq_getmulti;
+				len = sizeof(cli->creq_getmulti);
+			} else if (paged_list) {
+				ptr = &cli->creq_list;
+				len = sizeof(cli->creq_list);
+			}
+			break;
+		case 2:
+			if (paged_list) {
+				ptr = &cli->key2;
+				len = GUINT16_FROM_LE(cli->creq_list.marker_len);
+			} else if (req->op == CHO_GET_MULTI) {
+				ptr = cli->ranges;
+				len = GUINT16_FROM_LE(cli->creq_getmulti.n_ranges) *
+				      sizeof(struct chunksrv_range);
+			}
+			break;
+		default:
+			cli->state = evt_exec_req;
+			return;
+		}
+	}
+
+	/* second keys share the key length limit */
+	if ((ptr == &cli->key2 && len > CHD_KEY_SZ) ||
+	    (ptr == cli->ranges && len > sizeof(cli->ranges))) {
+		cli->state = evt_dispose;
+		return;
+	}
+
+	cli->req_ptr = ptr;
+	cli->var_len = len;
+	cli->req_used = 0;
+	cli->state = evt_read_var;
+}
+
 static bool cli_evt_read_fixed(struct client *cli, unsigned int events)
 {
 	int rc = cli_read_data(cli, cli->req_ptr,
@@ -1233,24 +1608,15 @@ static bool cli_evt_read_fixed(struct client *cli, unsigned int events)
 
 	cli->key_len = GUINT16_FROM_LE(cli->creq.key_len);
 
-	/* if no key, skip to execute-request state */
-	if (cli->key_len == 0) {
-		cli->state = evt_exec_req;
-		return true;
-	}
-
 	/* drop cxn if invalid key length */
 	if (cli->key_len > CHD_KEY_SZ) {
 		cli->state = evt_dispose;
 		return true;
 	}
 
-	/* otherwise, go to read-variable-len-record state */
-	cli->req_ptr = &cli->key;
-	cli->var_len = cli->key_len;
-	cli->req_used = 0;
-	cli->state = evt_read_var;
-	cli->second_var = false;
+	/* go read the key and whatever else follows, if anything */
+	cli->var_idx = 0;
+	cli_req_next_var(cli);
 
 	return true;
 }
@@ -1271,24 +1637,30 @@ static bool cli_evt_read_var(struct client *cli, unsigned int events)
 	if (cli->req_used < cli->var_len)
 		return false;
 
-	if (cli->creq.op == CHO_CP && !cli->second_var) {
-		cli->req_ptr = &cli->key2;
-		cli->var_len = le64_to_cpu(cli->creq.data_len);
-		cli->req_used = 0;
-		cli->state = evt_read_var;
-		cli->second_var = true;
-	} else if (cli->creq.op == CHO_GET_PART && !cli->second_var) {
-		cli->req_ptr = &cli->creq_getpart;
-		cli->var_len = sizeof(cli->creq_getpart);
-		cli->req_used = 0;
-		cli->state = evt_read_var;
-		cli->second_var = true;
-	} else
-		cli->state = evt_exec_req;
+	cli_req_next_var(cli);
 
 	return true;
 }
 
+/* PUT_BATCH body, read only once the header passed the auth checks */
+static bool cli_evt_batch_in(struct client *cli, unsigned int events)
+{
+	int rc = cli_read_data(cli, cli->req_ptr,
+			       cli->var_len - cli->req_used);
+	if (rc < 0) {
+		cli->state = evt_dispose;
+		return true;
+	}
+
+	cli->req_ptr += rc;
+	cli->req_used += rc;
+
+	if (cli->req_used < cli->var_len)
+		return false;
+
+	return object_put_batch_run(cli);
+}
+
 static bool cli_evt_ssl_accept(struct client *cli, unsigned int events)
 {
 	int rc;
@@ -1321,6 +1693,7 @@ static cli_evt_func state_funcs[] = {
 	[evt_read_var]		= cli_evt_read_var,
 	[evt_exec_req]		= cli_evt_exec_req,
 	[evt_data_in]		= cli_evt_data_in,
+	[evt_batch_in]		= cli_evt_batch_in,
 	[evt_dispose]		= cli_evt_dispose,
 	[evt_recycle]		= cli_evt_recycle,
 	[evt_ssl_accept]	= cli_evt_ssl_accept,
@@ -1360,10 +1733,39 @@ void tcp_cli_event(int fd, short events, void *userdata)
 	}
 }
 
+/*
+ * Re-enter the client state machine, after a worker thread completion
+ * changed client state behind the back of the event loop.
+ */
+void cli_resume(struct client *cli)
+{
+	short events = EV_READ;
+
+	if (cli->writing)
+		events |= EV_WRITE;
+
+	tcp_cli_event(cli->fd, events, cli);
+}
+
+static void cli_attach(struct client *cli)
+{
+	event_set(&cli->ev, cli->fd, EV_READ | EV_PERSIST,
+		  tcp_cli_event, cli);
+	event_base_set(cli->thr->evbase, &cli->ev);
+
+	if (event_add(&cli->ev, NULL) < 0) {
+		applog(LOG_ERR, "unable to ready srv fd for polling");
+		cli_free(cli);
+		return;
+	}
+	cli->ev_mask = EV_READ;
+}
+
 static void tcp_srv_event(int fd, short events, void *userdata)
 {
 	struct server_socket *sock = userdata;
 	socklen_t addrlen = sizeof(struct sockaddr_in6);
+	struct net_thread *thr;
 	struct client *cli;
 	char host[64];
 	char port[16];
@@ -1384,7 +1786,7 @@ static void tcp_srv_event(int fd, short events, void *userdata)
 		goto err_out;
 	}
 
-	chunkd_srv.stats.tcp_accept++;
+	chunkd_srv.threads[0].stats.tcp_accept++;
 
 	/* mark non-blocking, for upcoming poll use */
 	if (fsetflags("tcp client", cli->fd, O_NONBLOCK) < 0)
@@ -1395,9 +1797,6 @@ static void tcp_srv_event(int fd, short events, void *userdata)
 		applog(LOG_WARNING, "TCP_NODELAY failed: %s",
 		       strerror(errno));
 
-	event_set(&cli->ev, cli->fd, EV_READ | EV_PERSIST,
-		  tcp_cli_event, cli);
-
 	/* pretty-print incoming cxn info */
 	getnameinfo((struct sockaddr *) &cli->addr, addrlen,
 		    host, sizeof(host), port, sizeof(port),
@@ -1410,11 +1809,21 @@ static void tcp_srv_event(int fd, short events, void *userdata)
 	strcpy(cli->addr_host, host);
 	strcpy(cli->addr_port, port);
 
-	if (event_add(&cli->ev, NULL) < 0) {
-		applog(LOG_ERR, "unable to ready srv fd for polling");
+	/* pick an event loop thread; the client stays there until freed */
+	thr = &chunkd_srv.threads[chunkd_srv.next_thread++ %
+				  chunkd_srv.n_threads];
+	cli->thr = thr;
+
+	if (thr->id == 0) {
+		cli_attach(cli);
+		return;
+	}
+
+	if (write(thr->cli_pipe[1], &cli, sizeof(cli)) != sizeof(cli)) {
+		applog(LOG_ERR, "thread %u cxn hand-off failed: %s",
+		       thr->id, strerror(errno));
 		goto err_out_fd;
 	}
-	cli->ev_mask = EV_READ;
 
 	return;
 
@@ -1661,7 +2070,7 @@ bool worker_pipe_signal(struct worker_info *wi)
 {
 	ssize_t wrc;
 
-	wrc = write(chunkd_srv.worker_pipe[1], &wi, sizeof(wi));
+	wrc = write(wi->cli->thr->worker_pipe[1], &wi, sizeof(wi));
 	if (wrc != sizeof(wi)) {
 		applog(LOG_ERR, "worker pipe output failed: %s",
 		       strerror(errno));
@@ -1684,6 +2093,223 @@ static void worker_pipe_evt(int fd, short events, void *userdata)
 	wi->pipe_ev(wi);
 }
 
+static void net_thread_cli_evt(int fd, short events, void *userdata)
+{
+	struct net_thread *thr = userdata;
+	struct client *cli = NULL;
+
+	if (read(fd, &cli, sizeof(cli)) != sizeof(cli)) {
+		applog(LOG_ERR, "thread %u cxn pipe input failed: %s",
+		       thr->id, strerror(errno));
+		return;
+	}
+
+	/* a NULL client is the main thread asking us to exit */
+	if (!cli) {
+		event_base_loopbreak(thr->evbase);
+		return;
+	}
+
+	cli_attach(cli);
+}
+
+static int net_thread_init(struct net_thread *thr, unsigned int id,
+			   struct event_base *evbase)
+{
+	thr->id = id;
+	INIT_LIST_HEAD(&thr->wr_trash);
+	thr->trash_sz = 0;
+	INIT_LIST_HEAD(&thr->buf_trash);
+	thr->buf_trash_sz = 0;
+
+	if (pipe(thr->cli_pipe) < 0)
+		goto err_out;
+	if (pipe(thr->worker_pipe) < 0)
+		goto err_out_cli_pipe;
+
+	event_set(&thr->cli_ev, thr->cli_pipe[0], EV_READ | EV_PERSIST,
+		  net_thread_cli_evt, thr);
+	event_base_set(evbase, &thr->cli_ev);
+	if (event_add(&thr->cli_ev, NULL) < 0)
+		goto err_out_worker_pipe;
+
+	event_set(&thr->worker_ev, thr->worker_pipe[0], EV_READ | EV_PERSIST,
+		  worker_pipe_evt, NULL);
+	event_base_set(evbase, &thr->worker_ev);
+	if (event_add(&thr->worker_ev, NULL) < 0)
+		goto err_out_cli_ev;
+
+	/* set once all is in place, for net_threads_free() */
+	thr->evbase = evbase;
+	return 0;
+
+err_out_cli_ev:
+	event_del(&thr->cli_ev);
+err_out_worker_pipe:
+	close(thr->worker_pipe[0]);
+	close(thr->worker_pipe[1]);
+err_out_cli_pipe:
+	close(thr->cli_pipe[0]);
+	close(thr->cli_pipe[1]);
+err_out:
+	applog(LOG_ERR, "thread %u init failed: %s", id, strerror(errno));
+	return -1;
+}
+
+static gpointer net_thread_func(gpointer data)
+{
+	struct net_thread *thr = data;
+	sigset_t set;
+
+	/* leave signal delivery to the main thread, which owns shutdown */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	event_base_dispatch(thr->evbase);
+
+	return NULL;
+}
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static GMutex **ssl_locks;
+
+static void ssl_locking_cb(int mode, int n, const char *file, int line)
+{
+	if (mode & CRYPTO_LOCK)
+		g_mutex_lock(ssl_locks[n]);
+	else
+		g_mutex_unlock(ssl_locks[n]);
+}
+
+static unsigned long ssl_id_cb(void)
+{
+	return (unsigned long) pthread_self();
+}
+
+static void ssl_thread_setup(void)
+{
+	int i;
+
+	ssl_locks = calloc(CRYPTO_num_locks(), sizeof(GMutex *));
+	if (!ssl_locks) {
+		applog(LOG_ERR, "OOM in SSL lock setup");
+		exit(1);
+	}
+	for (i = 0; i < CRYPTO_num_locks(); i++)
+		ssl_locks[i] = g_mutex_new();
+
+	CRYPTO_set_id_callback(ssl_id_cb);
+	CRYPTO_set_locking_callback(ssl_locking_cb);
+}
+#else
+static void ssl_thread_setup(void)
+{
+	/* OpenSSL 1.1 and later lock internally */
+}
+#endif
+
+static int net_threads_start(void)
+{
+	GError *error = NULL;
+	int i;
+
+	chunkd_srv.threads = calloc(chunkd_srv.n_threads,
+				    sizeof(struct net_thread));
+	if (!chunkd_srv.threads)
+		return -ENOMEM;
+
+	/* thread 0 is us, running main_loop() on the main event base */
+	if (net_thread_init(&chunkd_srv.threads[0], 0, chunkd_srv.evbase_main))
+		return -EIO;
+
+	for (i = 1; i < chunkd_srv.n_threads; i++) {
+		struct net_thread *thr = &chunkd_srv.threads[i];
+		struct event_base *evbase;
+
+		evbase = event_base_new();
+		if (!evbase) {
+			applog(LOG_ERR, "thread %d event_base_new failed", i);
+			return -ENOMEM;
+		}
+
+		if (net_thread_init(thr, i, evbase)) {
+			event_base_free(evbase);
+			return -EIO;
+		}
+
+		thr->thread = g_thread_create(net_thread_func, thr, TRUE,
+					      &error);
+		if (!thr->thread) {
+			applog(LOG_ERR, "Failed to start net thread %d: %s",
+			       i, error->message);
+			return -EIO;
+		}
+	}
+
+	if (chunkd_srv.n_threads > 1)
+		applog(LOG_INFO, "%d network threads", chunkd_srv.n_threads);
+
+	return 0;
+}
+
+static void net_threads_stop(void)
+{
+	struct client *cli = NULL;
+	int i;
+
+	if (!chunkd_srv.threads)
+		return;
+
+	for (i = 1; i < chunkd_srv.n_threads; i++) {
+		struct net_thread *thr = &chunkd_srv.threads[i];
+
+		if (!thr->thread)
+			continue;
+
+		/* without the exit request, joining would hang */
+		if (write(thr->cli_pipe[1], &cli, sizeof(cli)) != sizeof(cli)) {
+			applog(LOG_ERR, "thread %u exit request failed: %s",
+			       thr->id, strerror(errno));
+			continue;
+		}
+		g_thread_join(thr->thread);
+		thr->thread = NULL;
+	}
+}
+
+/*
+ * Release what net_threads_start() set up.  Workers signal completions
+ * through the worker pipes, so the pool must be drained first.  The
+ * main event base is not ours to free.
+ */
+static void net_threads_free(void)
+{
+	int i;
+
+	if (!chunkd_srv.threads)
+		return;
+
+	for (i = 0; i < chunkd_srv.n_threads; i++) {
+		struct net_thread *thr = &chunkd_srv.threads[i];
+
+		if (!thr->evbase || thr->thread)
+			continue;
+
+		event_del(&thr->cli_ev);
+		event_del(&thr->worker_ev);
+		close(thr->cli_pipe[0]);
+		close(thr->cli_pipe[1]);
+		close(thr->worker_pipe[0]);
+		close(thr->worker_pipe[1]);
+		if (i)
+			event_base_free(thr->evbase);
+		thr->evbase = NULL;
+	}
+
+	free(chunkd_srv.threads);
+	chunkd_srv.threads = NULL;
+}
+
 static int main_loop(void)
 {
 	int rc = 0;
@@ -1694,6 +2320,9 @@ static int main_loop(void)
 		if (dump_stats) {
 			dump_stats = false;
 			stats_dump();
+			metacache_stats_dump();
+			fdcache_stats_dump();
+			flusher_stats_dump();
 		}
 	}
 	
@@ -1705,11 +2334,18 @@ int main (int argc, char *argv[])
 	error_t aprc;
 	int rc = 1;
 	struct list_head *tmpl;
-	unsigned char cmd;
 
 	INIT_LIST_HEAD(&chunkd_srv.listeners);
 	INIT_LIST_HEAD(&chunkd_srv.sockets);
-	INIT_LIST_HEAD(&chunkd_srv.wr_trash);
+	chunkd_srv.n_threads = 1;
+	chunkd_srv.sendfile_verify = true;
+	chunkd_srv.obj_digest = CHD_DIGEST_SHA1;
+	chunkd_srv.meta_cache_ents = CHD_META_CACHE_ENTS;
+	chunkd_srv.meta_cache_csum = CHD_META_CACHE_CSUM_MB * 1024 * 1024;
+	chunkd_srv.fd_cache_fds = CHD_FD_CACHE_FDS;
+	chunkd_srv.sync_window = CHD_SYNC_WINDOW_US;
+	chunkd_srv.sync_batch = CHD_SYNC_BATCH;
+	chunkd_srv.write_behind = CHD_WRITE_BEHIND_MB * 1024 * 1024;
 
 	/* isspace() and strcasecmp() consistency requires this */
 	setlocale(LC_ALL, "C");
@@ -1739,6 +2375,7 @@ int main (int argc, char *argv[])
 	g_thread_init(NULL);
 	chunkd_srv.bigmutex = g_mutex_new();
 	SSL_library_init();
+	ssl_thread_setup();
 	chunkd_srv.evbase_main = event_init();
 
 	/* init SSL */
@@ -1790,6 +2427,9 @@ int main (int argc, char *argv[])
 	signal(SIGTERM, term_signal);
 	signal(SIGUSR1, stats_signal);
 
+	csum_init(CSUM_IMPL_AUTO);
+	applog(LOG_INFO, "block checksums: %s", csum_impl_name());
+
 	chunkd_srv.max_workers = 10;
 	chunkd_srv.workers = g_thread_pool_new(worker_thread, NULL,
 					       chunkd_srv.max_workers,
@@ -1804,26 +2444,35 @@ int main (int argc, char *argv[])
 		goto err_out_workers;
 	}
 
-	chunkd_srv.trash_sz = 0;
-
-	if (pipe(chunkd_srv.chk_pipe) < 0) {
+	if (metacache_init(&chunkd_srv.metas, chunkd_srv.meta_cache_ents,
+			   chunkd_srv.meta_cache_csum) != 0) {
 		rc = 1;
 		goto err_out_objcache;
 	}
-	if (pipe(chunkd_srv.worker_pipe) < 0) {
+
+	if (fdcache_init(&chunkd_srv.fds, chunkd_srv.fd_cache_fds) != 0) {
 		rc = 1;
-		goto err_out_chk_pipe;
+		goto err_out_metacache;
 	}
-	event_set(&chunkd_srv.worker_ev, chunkd_srv.worker_pipe[0],
-		  EV_READ | EV_PERSIST, worker_pipe_evt, NULL);
-	if (event_add(&chunkd_srv.worker_ev, NULL) < 0) {
+
+	if (pipe(chunkd_srv.chk_pipe) < 0) {
 		rc = 1;
-		goto err_out_worker_pipe;
+		goto err_out_fdcache;
 	}
 
 	if (fs_open()) {
 		rc = 1;
-		goto err_out_worker_pipe;
+		goto err_out_chk;
+	}
+
+	if (flusher_start()) {
+		rc = 1;
+		goto err_out_fs;
+	}
+
+	if (net_threads_start()) {
+		rc = 1;
+		goto err_out_net_threads;
 	}
 
 	/* set up server networking */
@@ -1852,16 +2501,31 @@ int main (int argc, char *argv[])
 err_out_cld:
 	/* net_close(); */
 err_out_listen:
+err_out_net_threads:
+	/*
+	 * Nothing may reach the fs layer once it starts closing: stop the
+	 * net threads, so no new work comes in, then let the workers run
+	 * what is queued to completion, and wait out selfcheck.
+	 */
+	net_threads_stop();
+	g_thread_pool_free(chunkd_srv.workers, FALSE, TRUE);
+	chunkd_srv.workers = NULL;
+	net_threads_free();
+	chk_stop();
+	flusher_stop();
+err_out_fs:
 	fs_close();
-err_out_worker_pipe:
-err_out_chk_pipe:
-	cmd = CHK_CMD_EXIT;
-	write(chunkd_srv.chk_pipe[1], &cmd, 1);
+err_out_chk:
+	close(chunkd_srv.chk_pipe[0]);
 	close(chunkd_srv.chk_pipe[1]);
+err_out_fdcache:
+	fdcache_fini(&chunkd_srv.fds);
+err_out_metacache:
+	metacache_fini(&chunkd_srv.metas);
 err_out_objcache:
 	objcache_fini(&chunkd_srv.actives);
 err_out_workers:
-	if (strict_free)
+	if (strict_free && chunkd_srv.workers)
 		g_thread_pool_free(chunkd_srv.workers, TRUE, FALSE);
 err_out_session:
 	unlink(chunkd_srv.pid_file);
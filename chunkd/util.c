@@ -188,8 +188,10 @@ void hexstr(const unsigned char *buf, size_t buf_len, char *outstr)
 
 char *time2str(char *strbuf, time_t src_time)
 {
-	struct tm *tm = gmtime(&src_time);
-	strftime(strbuf, 64, "%a, %d %b %Y %H:%M:%S %z", tm);
+	struct tm tm;
+
+	gmtime_r(&src_time, &tm);
+	strftime(strbuf, 64, "%a, %d %b %Y %H:%M:%S %z", &tm);
 	return strbuf;
 }
 
@@ -22,6 +22,7 @@
 #include <stdint.h>
 
 #define CHUNKD_MAGIC "CHUNKDv1"
+#define CHUNKD_LIST_MAGIC "CHL1"		/* binary LIST body */
 
 enum {
 	CHD_MAGIC_SZ		= 8,
@@ -29,13 +30,19 @@ enum {
 	CHD_KEY_SZ		= 1024,	/* key size limit; max 65534 (fffe) */
 	CHD_CSUM_SZ		= 20,	/* == SHA_DIGEST_LENGTH */
 	CHD_SIG_SZ		= 64,
+	CHD_LIST_MAX_KEYS	= 1000,	/* max keys per paged LIST */
+	CHD_MAX_RANGES		= 64,	/* max ranges per GET_MULTI */
+	CHD_BATCH_MAX_ITEMS	= 1000,	/* max objects per PUT_BATCH */
+	CHD_BATCH_MAX_SZ	= 1024 * 1024,	/* max PUT_BATCH body */
 };
 
 enum {
 	CHUNK_BLK_ORDER		= 16,			/* 64k blocks */
 	CHUNK_BLK_SZ		= 1ULL << CHUNK_BLK_ORDER,
 	CHUNK_BLK_MASK		= CHUNK_BLK_SZ - 1ULL,
-	CHUNK_MAX_GETPART	= 4,		/* max GET_PART req: 256k */
+	CHUNK_MAX_GETPART	= 4,		/* former GET_PART cap;
+						 * no longer enforced
+						 */
 	CHUNK_MAX_GETPART_SZ	= (CHUNK_MAX_GETPART * CHUNK_BLK_SZ),
 };
 
@@ -59,6 +66,8 @@ enum chunksrv_ops {
 
 	CHO_CP			= 11,	/* local object copy (intra-table) */
 	CHO_GET_PART		= 12,	/* GET subset of object */
+	CHO_GET_MULTI		= 13,	/* GET several ranges of object */
+	CHO_PUT_BATCH		= 14,	/* PUT several small objects */
 };
 
 enum chunk_errcode {
@@ -81,6 +90,16 @@ enum chunk_flags {
 	CHF_TBL_CREAT		= (1 << 1),	/* create tbl, if needed */
 	CHF_TBL_EXCL		= (1 << 2),	/* fail, if tbl exists */
 	CHF_GET_PART_LAST	= (1 << 3),	/* true, if end-of-obj*/
+	CHF_LIST_PAGED		= (1 << 4),	/* LIST: chunksrv_req_list
+						 * follows the key (prefix)
+						 */
+	CHF_LIST_BIN		= (1 << 5),	/* LIST: binary response */
+	CHF_NOCACHE		= (1 << 6),	/* GET/PUT: bulk data, keep
+						 * it out of the page cache
+						 */
+	CHF_GETPART_CSUM	= (1 << 7),	/* GET_PART: block csums
+						 * precede the data
+						 */
 };
 
 struct chunksrv_req {
@@ -99,6 +118,43 @@ struct chunksrv_req_getpart {
 	uint64_t		offset;		/* GET_PART offset */
 };
 
+/*
+ * GET_MULTI: n_ranges chunksrv_range records follow this one.  The
+ * response header is followed by the ranges as served (lengths clamped
+ * to the object), then by the data of each range in turn; data_len
+ * counts the data only.
+ */
+struct chunksrv_req_getmulti {
+	uint16_t		n_ranges;
+	uint8_t			rsv[6];
+};
+
+struct chunksrv_range {
+	uint64_t		offset;
+	uint64_t		len;		/* 0: until end of object */
+};
+
+/*
+ * PUT_BATCH: the request body (data_len bytes, no request key) is a
+ * series of chunksrv_batch_ent records, each followed by its key and
+ * its value.  The response body is one chunk_errcode byte per record,
+ * in order; the response code itself only says whether the body was
+ * well-formed.
+ */
+struct chunksrv_batch_ent {
+	uint16_t		key_len;
+	uint8_t			rsv[6];
+	uint64_t		len;		/* value length */
+};
+
+struct chunksrv_req_list {
+	uint32_t		max_keys;	/* 0: CHD_LIST_MAX_KEYS */
+	uint16_t		marker_len;	/* list keys after marker */
+	uint8_t			rsv[2];
+
+	/* variable-length marker key */
+};
+
 struct chunksrv_resp {
 	uint8_t			magic[CHD_MAGIC_SZ];	/* CHUNKD_MAGIC */
 	uint8_t			resp_code;		/* chunk_errcode's */
@@ -110,6 +166,33 @@ struct chunksrv_resp {
 	unsigned char		rsv2[4];		/* pad for 64 bits */
 };
 
+/*
+ * Binary LIST response body: one chunksrv_list_hdr, then n_ents times a
+ * chunksrv_list_ent followed by its key.  All listed objects belong to
+ * the requesting user.
+ */
+enum chunksrv_list_flags {
+	CHLF_TRUNCATED		= (1 << 0),	/* more keys follow; continue
+						 * after the last key here
+						 */
+};
+
+struct chunksrv_list_hdr {
+	uint8_t			magic[4];	/* CHUNKD_LIST_MAGIC */
+	uint8_t			flags;		/* CHLF_xxx */
+	uint8_t			rsv[3];
+	uint32_t		n_ents;
+};
+
+struct chunksrv_list_ent {
+	uint64_t		size;
+	uint64_t		mtime;		/* seconds since the epoch */
+	unsigned char		hash[CHD_CSUM_SZ];
+	uint16_t		key_len;
+
+	/* variable-length key */
+} __attribute__ ((packed));
+
 struct chunksrv_resp_get {
 	struct chunksrv_resp	resp;
 	uint64_t		mtime;
@@ -38,6 +38,74 @@ struct st_object {
 struct st_keylist {
 	char		*name;
 	GList		*contents;
+
+	/* paged lists only */
+	bool		truncated;	/* more keys follow */
+	void		*next_marker;	/* last key, to continue from */
+	size_t		next_marker_len;
+};
+
+/* walks a table one page of keys at a time */
+struct st_keys_iter {
+	struct st_client *stc;
+	void		*prefix;
+	size_t		prefix_len;
+	void		*marker;
+	size_t		marker_len;
+	unsigned int	max_keys;
+	bool		done;
+};
+
+/* one entry of a binary key list; pointers valid during the callback */
+struct st_list_ent {
+	const void	*key;
+	size_t		key_len;
+	uint64_t	size;
+	time_t		mtime;
+	const unsigned char *hash;	/* CHD_CSUM_SZ bytes */
+};
+
+/* return false to stop; the rest of the list is then skipped */
+typedef bool (*stc_list_cb)(const struct st_list_ent *ent, void *user_data);
+
+/* incremental decoder for binary LIST bodies, fed as bytes arrive */
+struct st_list_decoder {
+	stc_list_cb	cb;
+	void		*user_data;
+
+	bool		have_hdr;
+	bool		truncated;	/* from header: more keys follow */
+	bool		stopped;	/* cb returned false */
+	uint32_t	n_ents;		/* from header */
+	uint32_t	n_seen;
+
+	size_t		buf_len;	/* partial record so far */
+	unsigned char	buf[sizeof(struct chunksrv_list_ent) + CHD_KEY_SZ];
+};
+
+/* one range of a GET_MULTI; data and data_len are filled in */
+struct st_range {
+	uint64_t	offset;
+	uint64_t	len;		/* 0: until end of object */
+
+	void		*data;		/* malloc'd; caller frees */
+	size_t		data_len;
+};
+
+/* called for each object of a batch once it is sent; 0 is success */
+typedef void (*stc_batch_cb)(const void *key, size_t key_len,
+			     int status, void *user_data);
+
+/* small objects collected for PUT_BATCH, sent whenever one is full */
+struct st_batch {
+	struct st_client *stc;
+	uint32_t	flags;		/* CHF_SYNC */
+	stc_batch_cb	cb;
+	void		*user_data;
+
+	GByteArray	*buf;		/* records not yet sent */
+	unsigned int	n_items;
+	unsigned long	n_failed;	/* objects refused, so far */
 };
 
 struct st_client {
@@ -52,10 +120,16 @@ struct st_client {
 	SSL		*ssl;
 
 	char		req_buf[sizeof(struct chunksrv_req) + CHD_KEY_SZ +
-				sizeof(struct chunksrv_req_getpart)];
+				sizeof(struct chunksrv_req_list) + CHD_KEY_SZ +
+				sizeof(struct chunksrv_req_getmulti) +
+				CHD_MAX_RANGES * sizeof(struct chunksrv_range)];
+
+	/* new fields go last; set through stc_set_nocache() */
+	bool		nocache;	/* GET and PUT with CHF_NOCACHE */
 };
 
 extern void stc_free(struct st_client *stc);
+extern void stc_set_nocache(struct st_client *stc, bool nocache);
 extern void stc_free_keylist(struct st_keylist *keylist);
 extern void stc_free_object(struct st_object *obj);
 extern void stc_init(void);
@@ -87,6 +161,13 @@ extern bool stc_get_part_start(struct st_client *stc, const void *key,
 			size_t key_len,
 			uint64_t offset, uint64_t max_len,
 			int *pfd, uint64_t *len);
+extern void *stc_get_part_verify(struct st_client *stc,
+			    const void *key, size_t key_len,
+			    uint64_t offset, uint64_t max_len,
+			    size_t *len);
+extern bool stc_get_multi(struct st_client *stc, const void *key,
+			  size_t key_len, struct st_range *ranges,
+			  unsigned int n_ranges);
 
 extern bool stc_put(struct st_client *stc, const void *key, size_t key_len,
 	     size_t (*read_cb)(void *, size_t, size_t, void *),
@@ -99,6 +180,12 @@ extern bool stc_put_sync(struct st_client *stc);
 extern bool stc_put_inline(struct st_client *stc, const void *key,
 			   size_t key_len, void *data, uint64_t len,
 			   uint32_t flags);
+extern struct st_batch *stc_batch_new(struct st_client *stc, uint32_t flags,
+				      stc_batch_cb cb, void *user_data);
+extern bool stc_batch_put(struct st_batch *batch, const void *key,
+			  size_t key_len, const void *data, uint64_t len);
+extern bool stc_batch_flush(struct st_batch *batch);
+extern void stc_batch_free(struct st_batch *batch);
 extern bool stc_cp(struct st_client *stc,
 		   const void *dest_key, size_t dest_key_len,
 		   const void *src_key, size_t src_key_len);
@@ -111,6 +198,27 @@ extern bool stc_check_status(struct st_client *stc,
 			     struct chunk_check_status *out);
 
 extern struct st_keylist *stc_keys(struct st_client *stc);
+extern struct st_keylist *stc_keys_page(struct st_client *stc,
+					const void *prefix, size_t prefix_len,
+					const void *marker, size_t marker_len,
+					unsigned int max_keys);
+extern struct st_keys_iter *stc_keys_iter_new(struct st_client *stc,
+					const void *prefix, size_t prefix_len,
+					unsigned int max_keys);
+extern bool stc_keys_iter_next(struct st_keys_iter *iter,
+			       struct st_keylist **page);
+extern void stc_keys_iter_free(struct st_keys_iter *iter);
+
+extern bool stc_keys_stream(struct st_client *stc,
+			    const void *prefix, size_t prefix_len,
+			    const void *marker, size_t marker_len,
+			    unsigned int max_keys,
+			    stc_list_cb cb, void *user_data, bool *truncated);
+extern void stc_list_decoder_init(struct st_list_decoder *dec,
+				  stc_list_cb cb, void *user_data);
+extern bool stc_list_decode(struct st_list_decoder *dec,
+			    const void *data, size_t len);
+extern bool stc_list_decoder_done(const struct st_list_decoder *dec);
 
 static inline void *stc_get_inlinez(struct st_client *stc,
 				    const char *key,
@@ -134,6 +242,22 @@ static inline void *stc_get_part_inlinez(struct st_client *stc,
 				   len);
 }
 
+static inline void *stc_get_part_verifyz(struct st_client *stc,
+				    const char *key,
+				    uint64_t offset, uint64_t max_len,
+				    size_t *len)
+{
+	return stc_get_part_verify(stc, key, strlen(key) + 1, offset, max_len,
+				   len);
+}
+
+static inline bool stc_get_multiz(struct st_client *stc, const char *key,
+				  struct st_range *ranges,
+				  unsigned int n_ranges)
+{
+	return stc_get_multi(stc, key, strlen(key) + 1, ranges, n_ranges);
+}
+
 static inline bool stc_get_part_startz(struct st_client *stc, const char *key,
 				  uint64_t offset, uint64_t max_len,
 				  int *pfd, uint64_t *len)
@@ -148,6 +272,12 @@ static inline bool stc_put_inlinez(struct st_client *stc, const char *key,
 	return stc_put_inline(stc, key, strlen(key) + 1, data, len, flags);
 }
 
+static inline bool stc_batch_putz(struct st_batch *batch, const char *key,
+				  const void *data, uint64_t len)
+{
+	return stc_batch_put(batch, key, strlen(key) + 1, data, len);
+}
+
 static inline bool stc_put_startz(struct st_client *stc, const char *key,
 				  uint64_t cont_len, int *pfd, uint32_t flags)
 {
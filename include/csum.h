@@ -0,0 +1,75 @@
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+#ifndef _CHUNKD_CSUM_H_
+#define _CHUNKD_CSUM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+enum {
+	CSUM_DIGEST_SZ		= 20,		/* SHA1 */
+	CSUM_MAX_LANES		= 8,		/* bufs hashed side by side */
+};
+
+enum csum_impl {
+	CSUM_IMPL_AUTO,				/* fastest on this CPU */
+	CSUM_IMPL_OPENSSL,			/* OpenSSL, one buf at a time */
+	CSUM_IMPL_MB,				/* multi-buffer SIMD */
+};
+
+/*
+ * Select the SHA1 implementation.  Call once at startup, before threads
+ * are running; without it, OpenSSL alone is used.  CSUM_IMPL_AUTO times
+ * the candidates on a short sample and keeps the faster one.  Returns
+ * false if the requested implementation is not available on this CPU.
+ */
+extern bool csum_init(enum csum_impl impl);
+
+/*
+ * Name of the selected implementation, for logs.
+ */
+extern const char *csum_impl_name(void);
+
+/*
+ * SHA1 of a single buffer.
+ */
+extern void csum_one(const void *buf, size_t len, unsigned char *md);
+
+/*
+ * SHA1 of n independent buffers; md receives n consecutive digests.
+ * Up to CSUM_MAX_LANES buffers are hashed in parallel where the CPU
+ * allows.  Lanes run in lock-step, so equal-length buffers work best.
+ */
+extern void csum_many(const void * const *bufs, const size_t *lens,
+		      unsigned int n, unsigned char *md);
+
+/*
+ * Split buf into consecutive blk_sz blocks (the last one may be short)
+ * and store one digest per block into md_tbl.
+ */
+extern void csum_blocks(const void *buf, size_t len, size_t blk_sz,
+			unsigned char *md_tbl);
+
+/*
+ * Like csum_blocks, but compare against md_tbl.  Returns the index of
+ * the first mismatching block, or -1 if all blocks match.
+ */
+extern long csum_verify_blocks(const void *buf, size_t len, size_t blk_sz,
+			       const unsigned char *md_tbl);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+#ifndef _CHUNKD_FDCACHE_H_
+#define _CHUNKD_FDCACHE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <elist.h>
+#include <tblkey.h>
+
+enum {
+	FDCACHE_SHARDS		= 16,		/* independently locked */
+};
+
+/*
+ * An open, read-only object file.  Users share the descriptor, so they
+ * must use pread() and friends, never the file position.
+ */
+struct fdcache_ent {
+	int			fd;
+	uint64_t		ino;		/* file identity */
+	char			*name;		/* pathname, for logs */
+
+	/* private */
+	struct list_head	lru;
+	int			ref;		/* users, +1 while cached */
+	bool			cached;
+	struct tblkey		tk;		/* tk.key is key_buf */
+	unsigned char		key_buf[0];
+};
+
+struct fdcache_shard {
+	GMutex			*lock;
+	GHashTable		*table;		/* &entry->tk -> entry */
+	struct list_head	lru;		/* most recently used first */
+	unsigned int		n_ents;
+
+	unsigned long		gen;		/* bumped by invalidation */
+
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evictions;
+};
+
+struct fdcache {
+	unsigned int		max_ents;	/* per shard; 0: disabled */
+	struct fdcache_shard	shard[FDCACHE_SHARDS];
+};
+
+struct fdcache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evictions;
+	unsigned long		entries;
+};
+
+/*
+ * Init a cache keeping at most max_fds descriptors open when idle.
+ * Descriptors in use stay open until put, even if evicted meanwhile.
+ * max_fds == 0 disables caching; fdcache_add() then only wraps the fd.
+ */
+extern int fdcache_init(struct fdcache *fc, unsigned int max_fds);
+
+/*
+ * Terminate a cache, closing the descriptors nobody is using.
+ */
+extern void fdcache_fini(struct fdcache *fc);
+
+/*
+ * Get a reference to the cached descriptor of (table_id, key), or NULL.
+ * Either way *gen receives the token for a later fdcache_add().
+ */
+extern struct fdcache_ent *fdcache_get(struct fdcache *fc, uint32_t table_id,
+				       const void *key, size_t key_len,
+				       unsigned long *gen);
+
+/*
+ * Wrap a freshly opened and validated fd, and name (malloc'd), in an
+ * entry and cache it, unless the key was invalidated since gen was
+ * obtained.  The entry owns fd and name from now on; the caller holds
+ * one reference.  Returns NULL, leaving fd and name alone, if out of
+ * memory.
+ */
+extern struct fdcache_ent *fdcache_add(struct fdcache *fc, uint32_t table_id,
+				       const void *key, size_t key_len,
+				       int fd, uint64_t ino, char *name,
+				       unsigned long gen);
+
+/*
+ * Drop a reference; the fd is closed once it is neither used nor cached.
+ */
+extern void fdcache_put(struct fdcache *fc, struct fdcache_ent *ent);
+
+/*
+ * Forget the descriptor of an object being replaced or removed.
+ */
+extern void fdcache_invalidate(struct fdcache *fc, uint32_t table_id,
+			       const void *key, size_t key_len);
+
+/*
+ * Sum the counters of all shards.
+ */
+extern void fdcache_stats(struct fdcache *fc, struct fdcache_stats *st);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+#ifndef _CHUNKD_METACACHE_H_
+#define _CHUNKD_METACACHE_H_
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+#include <elist.h>
+#include <tblkey.h>
+#include <chunk_msg.h>
+
+enum {
+	METACACHE_SHARDS	= 16,		/* independently locked */
+};
+
+/* what a GET_META needs, plus enough to tell if the file was replaced */
+struct metacache_meta {
+	uint64_t		size;		/* value length */
+	time_t			mtime;
+	uint64_t		ino;		/* file identity */
+	uint64_t		value_ofs;	/* in the file, per format */
+	unsigned char		hash[CHD_CSUM_SZ];
+	uint8_t			digest;		/* how hash was computed */
+	char			owner[CHD_USER_SZ + 1];
+};
+
+struct metacache_shard {
+	GMutex			*lock;
+	GHashTable		*table;		/* &entry->tk -> entry */
+	struct list_head	lru;		/* most recently used first */
+	unsigned int		n_ents;
+	size_t			csum_bytes;	/* csum tables held */
+
+	unsigned long		gen;		/* bumped by invalidation */
+
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evictions;
+};
+
+struct metacache {
+	unsigned int		max_ents;	/* per shard; 0: disabled */
+	size_t			max_csum;	/* per shard, bytes */
+	struct metacache_shard	shard[METACACHE_SHARDS];
+};
+
+struct metacache_stats {
+	unsigned long		hits;
+	unsigned long		misses;
+	unsigned long		evictions;
+	unsigned long		entries;
+	unsigned long		csum_bytes;
+};
+
+/*
+ * Init a cache holding at most max_ents objects, and at most
+ * max_csum_bytes of checksum tables among them.  max_ents == 0 gives a
+ * cache that never hits.  Call once; may fail since it allocates mutexes.
+ */
+extern int metacache_init(struct metacache *mc, unsigned int max_ents,
+			  size_t max_csum_bytes);
+
+/*
+ * Terminate a cache, freeing all entries.
+ */
+extern void metacache_fini(struct metacache *mc);
+
+/*
+ * Look up (table_id, key).  On a hit the metadata is copied to *meta
+ * and, if csum_tbl is not NULL, a malloc'd copy of the checksum table is
+ * returned in *csum_tbl (NULL if the table is not cached).
+ *
+ * Either way *gen receives a token for a later metacache_put(), so a
+ * fill racing with an invalidation is dropped rather than cached stale.
+ */
+extern bool metacache_get(struct metacache *mc, uint32_t table_id,
+			  const void *key, size_t key_len,
+			  struct metacache_meta *meta,
+			  void **csum_tbl, size_t *csum_len,
+			  unsigned long *gen);
+
+/*
+ * Add or replace an entry, evicting the least recently used ones as
+ * needed.  csum_tbl may be NULL; large tables are not kept.  A no-op if
+ * the key was invalidated since gen was obtained.
+ */
+extern void metacache_put(struct metacache *mc, uint32_t table_id,
+			  const void *key, size_t key_len,
+			  const struct metacache_meta *meta,
+			  const void *csum_tbl, size_t csum_len,
+			  unsigned long gen);
+
+/*
+ * Forget an entry; call whenever the object is created or removed.
+ */
+extern void metacache_invalidate(struct metacache *mc, uint32_t table_id,
+				 const void *key, size_t key_len);
+
+/*
+ * Sum the counters of all shards.
+ */
+extern void metacache_stats(struct metacache *mc, struct metacache_stats *st);
+
+#endif
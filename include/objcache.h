@@ -52,6 +52,15 @@ extern struct objcache_entry *__objcache_get(struct objcache *cache,
 extern bool objcache_test_dirty(struct objcache *cache,
 				struct objcache_entry *entry);
 
+/*
+ * Run fn(arg) unless the entry is dirty, with the cache locked, so that
+ * nobody marks it dirty meanwhile.  Keep fn short.  Returns true if fn
+ * was run.
+ */
+extern bool objcache_run_clean(struct objcache *cache,
+			       struct objcache_entry *entry,
+			       void (*fn)(void *arg), void *arg);
+
 /*
  * Put an entry (decrement and free, or an equivalent).
  */
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#ifndef _CHUNKD_TBLKEY_H_
+#define _CHUNKD_TBLKEY_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+
+/*
+ * The (table_id, key) an entry of a sharded cache is filed under, with
+ * its hash.  Used as the key of the glib tables, so a lookup needs only
+ * a probe on the stack.  Unlike objcache, collisions are resolved by
+ * comparing keys.
+ */
+struct tblkey {
+	unsigned int		hash;
+	uint32_t		table_id;
+	const void		*key;
+	size_t			key_len;
+};
+
+/* FNV-1a */
+static inline unsigned int tblkey_hash(uint32_t table_id,
+				       const void *key, size_t key_len)
+{
+	const unsigned char *p = key;
+	unsigned int hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < sizeof(table_id); i++) {
+		hash ^= (table_id >> (i * 8)) & 0xff;
+		hash *= 16777619U;
+	}
+	for (i = 0; i < key_len; i++) {
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/* key is referenced, not copied */
+static inline void tblkey_init(struct tblkey *tk, uint32_t table_id,
+			       const void *key, size_t key_len)
+{
+	tk->table_id = table_id;
+	tk->key = key;
+	tk->key_len = key_len;
+	tk->hash = tblkey_hash(table_id, key, key_len);
+}
+
+static inline guint tblkey_ghash(gconstpointer p)
+{
+	const struct tblkey *tk = p;
+
+	return tk->hash;
+}
+
+static inline gboolean tblkey_gequal(gconstpointer a, gconstpointer b)
+{
+	const struct tblkey *ta = a, *tb = b;
+
+	return ta->table_id == tb->table_id &&
+	       ta->key_len == tb->key_len &&
+	       !memcmp(ta->key, tb->key, ta->key_len);
+}
+
+/* the glib table buckets on the low bits, so shard on others */
+static inline unsigned int tblkey_shard(unsigned int hash,
+					unsigned int n_shards)
+{
+	return (hash >> 16) % n_shards;
+}
+
+#endif /* _CHUNKD_TBLKEY_H_ */
@@ -30,6 +30,7 @@
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <openssl/hmac.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
 #include <libxml/tree.h>
 #include <glib.h>
@@ -174,6 +175,15 @@ void stc_free(struct st_client *stc)
 	free(stc);
 }
 
+/*
+ * Mark all further GETs and PUTs of this client as bulk transfers, which
+ * the server keeps out of its page cache.
+ */
+void stc_set_nocache(struct st_client *stc, bool nocache)
+{
+	stc->nocache = nocache;
+}
+
 static bool stc_login(struct st_client *stc)
 {
 	struct chunksrv_resp resp;
@@ -362,6 +372,8 @@ static bool stc_get_req(struct st_client *stc, const void *key,
 	/* initialize request */
 	req_init(stc, req);
 	req->op = CHO_GET;
+	if (stc->nocache)
+		req->flags |= CHF_NOCACHE;
 	req_set_key(req, key, key_len);
 
 	/* sign request */
@@ -526,7 +538,7 @@ size_t stc_get_recv(struct st_client *stc, void *data, size_t data_len)
  */
 static bool stc_get_part_req(struct st_client *stc, const void *key,
 			size_t key_len, uint64_t offset, uint64_t max_len,
-			uint64_t *plen)
+			uint32_t flags, struct chunksrv_resp_get *pget_resp)
 {
 	struct chunksrv_resp_get get_resp;
 	struct chunksrv_req *req = (struct chunksrv_req *) stc->req_buf;
@@ -544,6 +556,7 @@ static bool stc_get_part_req(struct st_client *stc, const void *key,
 	/* initialize request */
 	req_init(stc, req);
 	req->op = CHO_GET_PART;
+	req->flags = flags;
 	req->data_len = cpu_to_le64(max_len);
 	req_set_key(req, key, key_len);
 
@@ -574,7 +587,7 @@ static bool stc_get_part_req(struct st_client *stc, const void *key,
 		      sizeof(get_resp) - sizeof(get_resp.resp)))
 		return false;
 
-	*plen = le64_to_cpu(get_resp.resp.data_len);
+	memcpy(pget_resp, &get_resp, sizeof(get_resp));
 	return true;
 }
 
@@ -583,11 +596,13 @@ bool stc_get_part(struct st_client *stc, const void *key, size_t key_len,
 	     size_t (*write_cb)(void *, size_t, size_t, void *),
 	     void *user_data)
 {
+	struct chunksrv_resp_get get_resp;
 	char netbuf[4096];
 	uint64_t content_len;
 
-	if (!stc_get_part_req(stc, key, key_len, offset, max_len, &content_len))
+	if (!stc_get_part_req(stc, key, key_len, offset, max_len, 0, &get_resp))
 		return false;
+	content_len = le64_to_cpu(get_resp.resp.data_len);
 
 	/* read response data */
 	while (content_len) {
@@ -613,10 +628,12 @@ bool stc_get_part_start(struct st_client *stc, const void *key, size_t key_len,
 		   uint64_t offset, uint64_t max_len,
 		   int *pfd, uint64_t *psize)
 {
+	struct chunksrv_resp_get get_resp;
 
-	if (!stc_get_part_req(stc, key, key_len, offset, max_len, psize))
+	if (!stc_get_part_req(stc, key, key_len, offset, max_len, 0, &get_resp))
 		return false;
 
+	*psize = le64_to_cpu(get_resp.resp.data_len);
 	*pfd = stc->fd;
 	return true;
 }
@@ -649,6 +666,189 @@ void *stc_get_part_inline(struct st_client *stc, const void *key,
 	return mem;
 }
 
+/*
+ * Like stc_get_part_inline, but have the server send the checksums of
+ * the blocks the range touches along with it, and check every block
+ * the range holds whole against them.  Blocks the range only partly
+ * covers, at its ends, cannot be checked here.
+ */
+void *stc_get_part_verify(struct st_client *stc, const void *key,
+			  size_t key_len, uint64_t offset, uint64_t max_len,
+			  size_t *len)
+{
+	struct chunksrv_resp_get get_resp;
+	unsigned char md[CHD_CSUM_SZ];
+	unsigned char *csums = NULL, *mem = NULL;
+	uint64_t length, end, blk_start, blk_end;
+	unsigned long first_blk, n_blk, i;
+	bool last;
+
+	if (!stc_get_part_req(stc, key, key_len, offset, max_len,
+			      CHF_GETPART_CSUM, &get_resp))
+		return NULL;
+
+	length = le64_to_cpu(get_resp.resp.data_len);
+
+	/*
+	 * A server without the flag sends the data alone; take it off
+	 * the connection, but there is nothing to verify it with.
+	 */
+	if (!(get_resp.resp.flags & CHF_GETPART_CSUM)) {
+		char netbuf[4096];
+		size_t xfer_len;
+
+		if (stc->verbose)
+			fprintf(stderr, "libstc: GET_PART csums not "
+				"supported by server\n");
+
+		while (length) {
+			xfer_len = MIN(length, sizeof(netbuf));
+			if (!net_read(stc, netbuf, xfer_len))
+				break;
+			length -= xfer_len;
+		}
+		return NULL;
+	}
+
+	end = offset + length;
+	last = get_resp.resp.flags & CHF_GET_PART_LAST;
+
+	first_blk = offset >> CHUNK_BLK_ORDER;
+	n_blk = length ?
+		((end - 1) >> CHUNK_BLK_ORDER) - first_blk + 1 : 0;
+
+	csums = malloc(n_blk * CHD_CSUM_SZ + 1);
+	mem = malloc(length + 1);
+	if (!csums || !mem)
+		goto err_out;
+
+	if (!net_read(stc, csums, n_blk * CHD_CSUM_SZ) ||
+	    !net_read(stc, mem, length))
+		goto err_out;
+
+	/* the response hash covers the csums sent */
+	SHA1(csums, n_blk * CHD_CSUM_SZ, md);
+	if (memcmp(md, get_resp.resp.hash, CHD_CSUM_SZ))
+		goto err_out_csum;
+
+	for (i = 0; i < n_blk; i++) {
+		blk_start = (uint64_t) (first_blk + i) << CHUNK_BLK_ORDER;
+		blk_end = blk_start + CHUNK_BLK_SZ;
+
+		/* the object's last block ends with the object */
+		if (last && blk_end > end)
+			blk_end = end;
+
+		if (blk_start < offset || blk_end > end)
+			continue;
+
+		SHA1(mem + (blk_start - offset), blk_end - blk_start, md);
+		if (memcmp(md, csums + i * CHD_CSUM_SZ, CHD_CSUM_SZ))
+			goto err_out_csum;
+	}
+
+	free(csums);
+
+	if (len)
+		*len = length;
+	return mem;
+
+err_out_csum:
+	if (stc->verbose)
+		fprintf(stderr, "libstc: GET_PART csum mismatch\n");
+err_out:
+	free(csums);
+	free(mem);
+	return NULL;
+}
+
+/*
+ * Fetch up to CHD_MAX_RANGES ranges of one object in a single request.
+ * On success, each range gets a malloc'd copy of its data, clamped to
+ * the object as for stc_get_part.
+ */
+bool stc_get_multi(struct st_client *stc, const void *key, size_t key_len,
+		   struct st_range *ranges, unsigned int n_ranges)
+{
+	struct chunksrv_resp_get get_resp;
+	struct chunksrv_req *req = (struct chunksrv_req *) stc->req_buf;
+	struct chunksrv_req_getmulti gmr;
+	struct chunksrv_range wire[CHD_MAX_RANGES];
+	void *p;
+	unsigned int i;
+
+	if (stc->verbose)
+		fprintf(stderr, "libstc: GET_MULTI(%u, %u)\n",
+			(unsigned int) key_len, n_ranges);
+
+	if (!key_valid(key, key_len))
+		return false;
+	if (n_ranges == 0 || n_ranges > CHD_MAX_RANGES)
+		return false;
+
+	for (i = 0; i < n_ranges; i++) {
+		ranges[i].data = NULL;
+		ranges[i].data_len = 0;
+		wire[i].offset = cpu_to_le64(ranges[i].offset);
+		wire[i].len = cpu_to_le64(ranges[i].len);
+	}
+
+	/* initialize request */
+	req_init(stc, req);
+	req->op = CHO_GET_MULTI;
+	req_set_key(req, key, key_len);
+
+	memset(&gmr, 0, sizeof(gmr));
+	gmr.n_ranges = GUINT16_TO_LE(n_ranges);
+	p = stc->req_buf + sizeof(struct chunksrv_req) + key_len;
+	memcpy(p, &gmr, sizeof(gmr));
+	memcpy(p + sizeof(gmr), wire, n_ranges * sizeof(wire[0]));
+
+	/* sign request */
+	chreq_sign(req, stc->key, req->sig);
+
+	/* write request */
+	if (!net_write(stc, req, req_len(req)))
+		return false;
+
+	/* read response header */
+	if (!resp_read(stc, &get_resp.resp))
+		return false;
+
+	/* check response code */
+	if (get_resp.resp.resp_code != che_Success) {
+		if (stc->verbose)
+			fprintf(stderr, "GET_MULTI resp code: %d\n",
+				get_resp.resp.resp_code);
+		return false;
+	}
+
+	/* read rest of response header, then the ranges as served */
+	if (!net_read(stc, &get_resp.mtime,
+		      sizeof(get_resp) - sizeof(get_resp.resp)) ||
+	    !net_read(stc, wire, n_ranges * sizeof(wire[0])))
+		return false;
+
+	/* and the data of each range, back to back */
+	for (i = 0; i < n_ranges; i++) {
+		ranges[i].data_len = le64_to_cpu(wire[i].len);
+		ranges[i].data = malloc(ranges[i].data_len + 1);
+		if (!ranges[i].data ||
+		    !net_read(stc, ranges[i].data, ranges[i].data_len))
+			goto err_out;
+	}
+
+	return true;
+
+err_out:
+	for (i = 0; i < n_ranges; i++) {
+		free(ranges[i].data);
+		ranges[i].data = NULL;
+		ranges[i].data_len = 0;
+	}
+	return false;
+}
+
 bool stc_table_open(struct st_client *stc, const void *key, size_t key_len,
 		    uint32_t flags)
 {
@@ -711,7 +911,9 @@ bool stc_put(struct st_client *stc, const void *key, size_t key_len,
 	/* initialize request */
 	req_init(stc, req);
 	req->op = CHO_PUT;
-	req->flags = (flags & CHF_SYNC);
+	req->flags = (flags & (CHF_SYNC | CHF_NOCACHE));
+	if (stc->nocache)
+		req->flags |= CHF_NOCACHE;
 	req->data_len = cpu_to_le64(content_len);
 	req_set_key(req, key, key_len);
 
@@ -777,7 +979,9 @@ bool stc_put_start(struct st_client *stc, const void *key, size_t key_len,
 	/* initialize request */
 	req_init(stc, req);
 	req->op = CHO_PUT;
-	req->flags = (flags & CHF_SYNC);
+	req->flags = (flags & (CHF_SYNC | CHF_NOCACHE));
+	if (stc->nocache)
+		req->flags |= CHF_NOCACHE;
 	req->data_len = cpu_to_le64(cont_len);
 	req_set_key(req, key, key_len);
 
@@ -899,6 +1103,158 @@ bool stc_put_inline(struct st_client *stc, const void *key, size_t key_len,
 	return stc_put(stc, key, key_len, read_inline_cb, len, &spi, flags);
 }
 
+/*
+ * Collect small objects to store with one PUT_BATCH request each time
+ * CHD_BATCH_MAX_SZ or CHD_BATCH_MAX_ITEMS is reached, and at the final
+ * stc_batch_flush.  Only CHF_SYNC applies to a batch, to all of it.
+ */
+struct st_batch *stc_batch_new(struct st_client *stc, uint32_t flags,
+			       stc_batch_cb cb, void *user_data)
+{
+	struct st_batch *batch;
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->buf = g_byte_array_new();
+	if (!batch->buf) {
+		free(batch);
+		return NULL;
+	}
+
+	batch->stc = stc;
+	batch->flags = flags & CHF_SYNC;
+	batch->cb = cb;
+	batch->user_data = user_data;
+
+	return batch;
+}
+
+/* objects not flushed yet are dropped */
+void stc_batch_free(struct st_batch *batch)
+{
+	if (!batch)
+		return;
+
+	g_byte_array_free(batch->buf, TRUE);
+	free(batch);
+}
+
+/*
+ * Send the objects collected so far, and report how each fared through
+ * the callback.  Returns false only if the exchange itself failed;
+ * refused objects are counted in n_failed.
+ */
+bool stc_batch_flush(struct st_batch *batch)
+{
+	struct st_client *stc = batch->stc;
+	struct chunksrv_req *req = (struct chunksrv_req *) stc->req_buf;
+	const struct chunksrv_batch_ent *ent;
+	struct chunksrv_resp resp;
+	unsigned char *status = NULL;
+	const unsigned char *p;
+	unsigned int i;
+	bool rcb = false;
+
+	if (!batch->n_items)
+		return true;
+
+	if (stc->verbose)
+		fprintf(stderr, "libstc: PUT_BATCH(%u, %u)\n",
+			batch->n_items, batch->buf->len);
+
+	/* initialize request */
+	req_init(stc, req);
+	req->op = CHO_PUT_BATCH;
+	req->flags = batch->flags;
+	req->data_len = cpu_to_le64(batch->buf->len);
+
+	/* sign request */
+	chreq_sign(req, stc->key, req->sig);
+
+	/* write request, then the records */
+	if (!net_write(stc, req, req_len(req)) ||
+	    !net_write(stc, batch->buf->data, batch->buf->len))
+		goto out;
+
+	/* read response header */
+	if (!resp_read(stc, &resp))
+		goto out;
+
+	/* check response code */
+	if (resp.resp_code != che_Success) {
+		if (stc->verbose)
+			fprintf(stderr, "PUT_BATCH resp code: %d\n",
+				resp.resp_code);
+		goto out;
+	}
+	if (le64_to_cpu(resp.data_len) != batch->n_items)
+		goto out;
+
+	/* one status byte per object */
+	status = malloc(batch->n_items);
+	if (!status || !net_read(stc, status, batch->n_items))
+		goto out;
+
+	p = batch->buf->data;
+	for (i = 0; i < batch->n_items; i++) {
+		ent = (const void *) p;
+		p += sizeof(*ent);
+
+		if (status[i] != che_Success)
+			batch->n_failed++;
+		if (batch->cb)
+			batch->cb(p, GUINT16_FROM_LE(ent->key_len), status[i],
+				  batch->user_data);
+
+		p += GUINT16_FROM_LE(ent->key_len) + le64_to_cpu(ent->len);
+	}
+
+	rcb = true;
+
+out:
+	free(status);
+	g_byte_array_set_size(batch->buf, 0);
+	batch->n_items = 0;
+	return rcb;
+}
+
+/*
+ * Add an object to the batch, sending the batch first if the object
+ * would not fit in it.  Objects too large for any batch are refused;
+ * use stc_put for those.
+ */
+bool stc_batch_put(struct st_batch *batch, const void *key, size_t key_len,
+		   const void *data, uint64_t len)
+{
+	struct chunksrv_batch_ent ent;
+	uint64_t rec_len;
+
+	if (!key_valid(key, key_len))
+		return false;
+
+	rec_len = sizeof(ent) + key_len + len;
+	if (rec_len > CHD_BATCH_MAX_SZ)
+		return false;
+
+	if ((batch->buf->len + rec_len > CHD_BATCH_MAX_SZ ||
+	     batch->n_items == CHD_BATCH_MAX_ITEMS) &&
+	    !stc_batch_flush(batch))
+		return false;
+
+	memset(&ent, 0, sizeof(ent));
+	ent.key_len = GUINT16_TO_LE(key_len);
+	ent.len = cpu_to_le64(len);
+
+	g_byte_array_append(batch->buf, (const guint8 *) &ent, sizeof(ent));
+	g_byte_array_append(batch->buf, key, key_len);
+	g_byte_array_append(batch->buf, data, len);
+	batch->n_items++;
+
+	return true;
+}
+
 bool stc_del(struct st_client *stc, const void *key, size_t key_len)
 {
 	struct chunksrv_resp resp;
@@ -957,6 +1313,7 @@ void stc_free_keylist(struct st_keylist *keylist)
 		return;
 
 	free(keylist->name);
+	free(keylist->next_marker);
 
 	tmp = keylist->contents;
 	while (tmp) {
@@ -1013,30 +1370,75 @@ static void stc_parse_key(xmlDocPtr doc, xmlNode *node,
 		node = node->next;
 	}
 
+	/* prepended; stc_keys_req puts the list back in order */
 	if (obj->name)
-		keylist->contents = g_list_append(keylist->contents, obj);
+		keylist->contents = g_list_prepend(keylist->contents, obj);
 	else
 		stc_free_object(obj);
 }
 
-struct st_keylist *stc_keys(struct st_client *stc)
+/* NextMarker is the raw key, hex-encoded */
+static void *stc_unhex(const char *s, size_t *lenp)
+{
+	size_t i, len = strlen(s) / 2;
+	unsigned char *buf;
+	unsigned int byte;
+
+	buf = malloc(len ? len : 1);
+	if (!buf)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		if (sscanf(s + (i * 2), "%2x", &byte) != 1) {
+			free(buf);
+			return NULL;
+		}
+		buf[i] = byte;
+	}
+
+	*lenp = len;
+	return buf;
+}
+
+/*
+ * Send a LIST request and read the response header.  flags may hold
+ * CHF_LIST_PAGED (prefix, marker and max_keys are sent) and CHF_LIST_BIN.
+ */
+static bool stc_list_send(struct st_client *stc, uint8_t flags,
+			  const void *prefix, size_t prefix_len,
+			  const void *marker, size_t marker_len,
+			  unsigned int max_keys, uint64_t *content_len)
 {
-	struct st_keylist *keylist;
-	xmlDocPtr doc;
-	xmlNode *node;
-	xmlChar *xs;
-	GByteArray *all_data;
-	char netbuf[4096];
 	struct chunksrv_resp resp;
-	uint64_t content_len;
 	struct chunksrv_req *req = (struct chunksrv_req *) stc->req_buf;
 
 	if (stc->verbose)
-		fprintf(stderr, "libstc: LIST-KEYS\n");
+		fprintf(stderr, "libstc: LIST-KEYS%s%s\n",
+			(flags & CHF_LIST_PAGED) ? " (paged)" : "",
+			(flags & CHF_LIST_BIN) ? " (bin)" : "");
 
 	/* initialize request */
 	req_init(stc, req);
 	req->op = CHO_LIST;
+	req->flags = flags;
+
+	if (flags & CHF_LIST_PAGED) {
+		struct chunksrv_req_list lr;
+		char *p;
+
+		if (prefix_len > CHD_KEY_SZ || marker_len > CHD_KEY_SZ)
+			return false;
+
+		memset(&lr, 0, sizeof(lr));
+		lr.max_keys = GUINT32_TO_LE(max_keys);
+		lr.marker_len = GUINT16_TO_LE(marker_len);
+
+		req_set_key(req, prefix, prefix_len);
+
+		p = stc->req_buf + sizeof(struct chunksrv_req) + prefix_len;
+		memcpy(p, &lr, sizeof(lr));
+		memcpy(p + sizeof(lr), marker, marker_len);
+	}
 
 	/* sign request */
 	chreq_sign(req, stc->key, req->sig);
@@ -1056,12 +1458,32 @@ struct st_keylist *stc_keys(struct st_client *stc)
 		return false;
 	}
 
+	*content_len = le64_to_cpu(resp.data_len);
+	return true;
+}
+
+static struct st_keylist *stc_keys_req(struct st_client *stc, bool paged,
+				       const void *prefix, size_t prefix_len,
+				       const void *marker, size_t marker_len,
+				       unsigned int max_keys)
+{
+	struct st_keylist *keylist;
+	xmlDocPtr doc;
+	xmlNode *node;
+	xmlChar *xs;
+	GByteArray *all_data;
+	char netbuf[4096];
+	uint64_t content_len;
+
+	if (!stc_list_send(stc, paged ? CHF_LIST_PAGED : 0,
+			   prefix, prefix_len, marker, marker_len, max_keys,
+			   &content_len))
+		return NULL;
+
 	all_data = g_byte_array_new();
 	if (!all_data)
 		return NULL;
 
-	content_len = le64_to_cpu(resp.data_len);
-
 	/* read response data */
 	while (content_len) {
 		size_t xfer_len;
@@ -1104,14 +1526,34 @@ struct st_keylist *stc_keys(struct st_client *stc)
 		}
 		else if (!_strcmp(node->name, "Contents"))
 			stc_parse_key(doc, node->children, keylist);
+		else if (!_strcmp(node->name, "IsTruncated")) {
+			xs = xmlNodeListGetString(doc, node->children, 1);
+			keylist->truncated = xs && !_strcmp(xs, "true");
+			xmlFree(xs);
+		}
+		else if (!_strcmp(node->name, "NextMarker")) {
+			xs = xmlNodeListGetString(doc, node->children, 1);
+			if (xs)
+				keylist->next_marker = stc_unhex((char *) xs,
+						&keylist->next_marker_len);
+			xmlFree(xs);
+		}
 
 		node = node->next;
 	}
 
+	keylist->contents = g_list_reverse(keylist->contents);
+
 	xmlFreeDoc(doc);
 	g_byte_array_free(all_data, TRUE);
 	all_data = NULL;
 
+	/* a truncated page is useless without a place to resume */
+	if (keylist->truncated && !keylist->next_marker) {
+		stc_free_keylist(keylist);
+		return NULL;
+	}
+
 	return keylist;
 
 err_out_doc:
@@ -1122,6 +1564,238 @@ err_out:
 	return NULL;
 }
 
+/*
+ * List every key of the open table in one response.  Prefer the paged
+ * calls below for tables of any size.
+ */
+struct st_keylist *stc_keys(struct st_client *stc)
+{
+	return stc_keys_req(stc, false, NULL, 0, NULL, 0, 0);
+}
+
+/*
+ * List at most max_keys keys (0: server limit, CHD_LIST_MAX_KEYS) that
+ * begin with prefix and sort after marker.  If keylist->truncated, pass
+ * keylist->next_marker as the marker of the next call.
+ */
+struct st_keylist *stc_keys_page(struct st_client *stc,
+				 const void *prefix, size_t prefix_len,
+				 const void *marker, size_t marker_len,
+				 unsigned int max_keys)
+{
+	return stc_keys_req(stc, true, prefix, prefix_len,
+			    marker, marker_len, max_keys);
+}
+
+struct st_keys_iter *stc_keys_iter_new(struct st_client *stc,
+				       const void *prefix, size_t prefix_len,
+				       unsigned int max_keys)
+{
+	struct st_keys_iter *iter;
+
+	if (prefix_len > CHD_KEY_SZ)
+		return NULL;
+
+	iter = calloc(1, sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	iter->prefix = malloc(prefix_len ? prefix_len : 1);
+	if (!iter->prefix) {
+		free(iter);
+		return NULL;
+	}
+	memcpy(iter->prefix, prefix, prefix_len);
+
+	iter->stc = stc;
+	iter->prefix_len = prefix_len;
+	iter->max_keys = max_keys;
+
+	return iter;
+}
+
+/*
+ * Fetch the next page of keys.  Returns false on error.  Otherwise
+ * *page is the next page, to be freed with stc_free_keylist(), or NULL
+ * once the listing is complete.
+ */
+bool stc_keys_iter_next(struct st_keys_iter *iter, struct st_keylist **page)
+{
+	struct st_keylist *kl;
+
+	*page = NULL;
+	if (iter->done)
+		return true;
+
+	kl = stc_keys_page(iter->stc, iter->prefix, iter->prefix_len,
+			   iter->marker, iter->marker_len, iter->max_keys);
+	if (!kl)
+		return false;
+
+	free(iter->marker);
+	iter->marker = NULL;
+	iter->marker_len = 0;
+
+	if (kl->truncated) {
+		iter->marker = g_memdup(kl->next_marker, kl->next_marker_len);
+		iter->marker_len = kl->next_marker_len;
+	} else
+		iter->done = true;
+
+	*page = kl;
+	return true;
+}
+
+void stc_keys_iter_free(struct st_keys_iter *iter)
+{
+	if (!iter)
+		return;
+
+	free(iter->prefix);
+	free(iter->marker);
+	free(iter);
+}
+
+void stc_list_decoder_init(struct st_list_decoder *dec,
+			   stc_list_cb cb, void *user_data)
+{
+	memset(dec, 0, sizeof(*dec));
+	dec->cb = cb;
+	dec->user_data = user_data;
+}
+
+/* bytes of the record being assembled, once its length is known */
+static size_t stc_list_rec_len(const struct st_list_decoder *dec)
+{
+	const struct chunksrv_list_ent *ent = (const void *) dec->buf;
+
+	if (!dec->have_hdr)
+		return sizeof(struct chunksrv_list_hdr);
+	if (dec->buf_len < sizeof(*ent))
+		return sizeof(*ent);
+	return sizeof(*ent) + GUINT16_FROM_LE(ent->key_len);
+}
+
+/*
+ * Feed the next len bytes of a binary LIST body; records may be split
+ * anywhere.  The callback runs once per complete entry.  Returns false
+ * if the body is malformed.
+ */
+bool stc_list_decode(struct st_list_decoder *dec, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len > 0) {
+		size_t rec_len = stc_list_rec_len(dec);
+		size_t n = MIN(rec_len - dec->buf_len, len);
+
+		memcpy(dec->buf + dec->buf_len, p, n);
+		dec->buf_len += n;
+		p += n;
+		len -= n;
+
+		/* fixed part just completed: validate, then read the key */
+		if (dec->have_hdr && dec->buf_len == sizeof(struct chunksrv_list_ent)) {
+			rec_len = stc_list_rec_len(dec);
+			if (rec_len == dec->buf_len ||
+			    rec_len > sizeof(dec->buf) ||
+			    dec->n_seen == dec->n_ents)
+				return false;
+		}
+
+		if (dec->buf_len < rec_len)
+			continue;
+
+		if (!dec->have_hdr) {
+			const struct chunksrv_list_hdr *hdr = (void *) dec->buf;
+
+			if (memcmp(hdr->magic, CHUNKD_LIST_MAGIC,
+				   sizeof(hdr->magic)))
+				return false;
+			dec->truncated = (hdr->flags & CHLF_TRUNCATED);
+			dec->n_ents = GUINT32_FROM_LE(hdr->n_ents);
+			dec->have_hdr = true;
+		} else {
+			const struct chunksrv_list_ent *ent = (void *) dec->buf;
+			struct st_list_ent le;
+
+			le.key = ent + 1;
+			le.key_len = GUINT16_FROM_LE(ent->key_len);
+			le.size = GUINT64_FROM_LE(ent->size);
+			le.mtime = GUINT64_FROM_LE(ent->mtime);
+			le.hash = ent->hash;
+
+			dec->n_seen++;
+			if (!dec->stopped && !dec->cb(&le, dec->user_data))
+				dec->stopped = true;
+		}
+
+		dec->buf_len = 0;
+	}
+
+	return true;
+}
+
+/* true once a complete body, every entry promised, has been decoded */
+bool stc_list_decoder_done(const struct st_list_decoder *dec)
+{
+	return dec->have_hdr && dec->buf_len == 0 &&
+	       dec->n_seen == dec->n_ents;
+}
+
+/*
+ * List keys in the compact binary encoding, handing each entry to cb as
+ * it arrives rather than building a list.  Arguments are as for
+ * stc_keys_page(), except that max_keys == 0 with no prefix and no
+ * marker lists the whole table in one response.  Returns false on
+ * error, or if cb stopped the listing.
+ */
+bool stc_keys_stream(struct st_client *stc,
+		     const void *prefix, size_t prefix_len,
+		     const void *marker, size_t marker_len,
+		     unsigned int max_keys,
+		     stc_list_cb cb, void *user_data, bool *truncated)
+{
+	struct st_list_decoder dec;
+	char netbuf[4096];
+	uint64_t content_len;
+	uint8_t flags = CHF_LIST_BIN;
+	bool ok = true;
+
+	if (prefix_len || marker_len || max_keys)
+		flags |= CHF_LIST_PAGED;
+
+	if (!stc_list_send(stc, flags, prefix, prefix_len,
+			   marker, marker_len, max_keys, &content_len))
+		return false;
+
+	stc_list_decoder_init(&dec, cb, user_data);
+
+	/* decode as we go; always drain the body, to stay in sync */
+	while (content_len) {
+		size_t xfer_len;
+
+		xfer_len = MIN(content_len, sizeof(netbuf));
+		if (!net_read(stc, netbuf, xfer_len))
+			return false;
+
+		if (ok)
+			ok = stc_list_decode(&dec, netbuf, xfer_len);
+		content_len -= xfer_len;
+	}
+
+	if (!ok || !stc_list_decoder_done(&dec)) {
+		if (stc->verbose)
+			fprintf(stderr, "LIST bad binary response\n");
+		return false;
+	}
+
+	if (truncated)
+		*truncated = dec.truncated;
+
+	return !dec.stopped;
+}
+
 bool stc_ping(struct st_client *stc)
 {
 	struct chunksrv_resp resp;
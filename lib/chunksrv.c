@@ -35,6 +35,18 @@ size_t req_len(const struct chunksrv_req *req)
 	/* FIXME: handle CHO_CP here, too */
 	if (req->op == CHO_GET_PART)
 		len += sizeof(struct chunksrv_req_getpart);
+	else if (req->op == CHO_GET_MULTI) {
+		const struct chunksrv_req_getmulti *gm = (const void *) req + len;
+
+		len += sizeof(*gm) +
+		       GUINT16_FROM_LE(gm->n_ranges) *
+		       sizeof(struct chunksrv_range);
+	}
+	else if (req->op == CHO_LIST && (req->flags & CHF_LIST_PAGED)) {
+		const struct chunksrv_req_list *lr = (const void *) req + len;
+
+		len += sizeof(*lr) + GUINT16_FROM_LE(lr->marker_len);
+	}
 
 	return len;
 }
@@ -30,6 +30,82 @@
 #include <chunkc.h>
 #include "test.h"
 
+enum {
+	LARGE_SZ		= 3 * 1024 * 1024 + 123,	/* own file */
+};
+
+static const char *key_etag(struct st_keylist *klist, const char *key)
+{
+	struct st_object *obj;
+	GList *tmp;
+
+	for (tmp = klist->contents; tmp; tmp = tmp->next) {
+		obj = tmp->data;
+		if (!strcmp(obj->name, key))
+			return obj->etag;
+	}
+	return NULL;
+}
+
+/*
+ * A copy of an object with a file of its own shares the source's data
+ * where it can, and always takes over its csums and digest.
+ */
+static void test_large(struct st_client *stc)
+{
+	static const char key[] = "cp-large";
+	static const char key2[] = "cp-large-copy";
+	struct st_keylist *klist;
+	const char *etag, *etag2;
+	unsigned char *data;
+	size_t len = 0;
+	void *mem;
+	bool rcb;
+
+	data = randmem(LARGE_SZ);
+	OK(data);
+
+	rcb = stc_put_inlinez(stc, key, data, LARGE_SZ, 0);
+	OK(rcb);
+	rcb = stc_cpz(stc, key2, key);
+	OK(rcb);
+
+	mem = stc_get_inlinez(stc, key2, &len);
+	OK(mem);
+	OK(len == LARGE_SZ);
+	OK(!memcmp(data, mem, LARGE_SZ));
+	free(mem);
+
+	/* the csums that came along must match the copied data */
+	mem = stc_get_part_verifyz(stc, key2, 0, 0, &len);
+	OK(mem);
+	OK(len == LARGE_SZ);
+	free(mem);
+
+	klist = stc_keys(stc);
+	OK(klist);
+	etag = key_etag(klist, key);
+	etag2 = key_etag(klist, key2);
+	OK(etag && etag2);
+	OK(!strcmp(etag, etag2));
+	stc_free_keylist(klist);
+
+	rcb = stc_delz(stc, key);
+	OK(rcb);
+
+	/* the copy outlives its source */
+	mem = stc_get_inlinez(stc, key2, &len);
+	OK(mem);
+	OK(len == LARGE_SZ);
+	OK(!memcmp(data, mem, LARGE_SZ));
+	free(mem);
+
+	rcb = stc_delz(stc, key2);
+	OK(rcb);
+
+	free(data);
+}
+
 static void test(bool do_encrypt)
 {
 	struct st_object *obj;
@@ -99,6 +175,8 @@ static void test(bool do_encrypt)
 	rcb = stc_delz(stc, key2);
 	OK(rcb);
 
+	test_large(stc);
+
 	stc_free(stc);
 }
 
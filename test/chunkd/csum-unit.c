@@ -0,0 +1,134 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "../../chunkd/csum.c"
+#include <sys/time.h>
+#include "test.h"
+
+enum {
+	BLK_SZ		= 64 * 1024,
+	N_BLK		= 64,		/* 4 MB of test data */
+	BENCH_LOOPS	= 32,
+};
+
+/* compare every digest against plain OpenSSL, at awkward lengths too */
+static void check_blocks(const unsigned char *data, size_t len)
+{
+	unsigned char tbl[(N_BLK + 1) * CSUM_DIGEST_SZ];
+	unsigned char md[CSUM_DIGEST_SZ];
+	size_t ofs;
+	long idx;
+	int i;
+
+	csum_blocks(data, len, BLK_SZ, tbl);
+
+	for (i = 0, ofs = 0; ofs < len; i++, ofs += BLK_SZ) {
+		size_t blen = (len - ofs < BLK_SZ) ? (len - ofs) : BLK_SZ;
+
+		SHA1(data + ofs, blen, md);
+		OK(!memcmp(md, tbl + (i * CSUM_DIGEST_SZ), CSUM_DIGEST_SZ));
+	}
+
+	OK(csum_verify_blocks(data, len, BLK_SZ, tbl) == -1);
+
+	/* damage the table for the last block, and expect to hear of it */
+	if (i > 0) {
+		tbl[(i - 1) * CSUM_DIGEST_SZ] ^= 1;
+		idx = csum_verify_blocks(data, len, BLK_SZ, tbl);
+		OK(idx == i - 1);
+	}
+}
+
+static void check_many(const unsigned char *data)
+{
+	static const size_t lens[CSUM_MAX_LANES] = {
+		0, 1, 55, 56, 64, 1000, 4097, BLK_SZ,
+	};
+	const void *bufs[CSUM_MAX_LANES];
+	unsigned char out[CSUM_MAX_LANES * CSUM_DIGEST_SZ];
+	unsigned char md[CSUM_DIGEST_SZ];
+	unsigned int i, n;
+
+	for (i = 0; i < CSUM_MAX_LANES; i++)
+		bufs[i] = data + (i * 977);
+
+	/* every lane count, with unequal lengths */
+	for (n = 1; n <= CSUM_MAX_LANES; n++) {
+		csum_many(bufs, lens, n, out);
+		for (i = 0; i < n; i++) {
+			SHA1(bufs[i], lens[i], md);
+			OK(!memcmp(md, out + (i * CSUM_DIGEST_SZ),
+				   CSUM_DIGEST_SZ));
+		}
+	}
+}
+
+static double bench(const unsigned char *data, bool blocks)
+{
+	unsigned char tbl[N_BLK * CSUM_DIGEST_SZ];
+	struct timeval ta, tb;
+	double secs;
+	int i, j;
+
+	gettimeofday(&ta, NULL);
+	for (i = 0; i < BENCH_LOOPS; i++) {
+		if (blocks)
+			csum_blocks(data, N_BLK * BLK_SZ, BLK_SZ, tbl);
+		else
+			for (j = 0; j < N_BLK; j++)
+				SHA1(data + (j * BLK_SZ), BLK_SZ,
+				     tbl + (j * CSUM_DIGEST_SZ));
+	}
+	gettimeofday(&tb, NULL);
+
+	secs = (tb.tv_sec - ta.tv_sec) + (tb.tv_usec - ta.tv_usec) / 1e6;
+	return ((double) BENCH_LOOPS * N_BLK * BLK_SZ) / secs / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned char *data;
+	size_t lens[] = { 0, 1, BLK_SZ - 1, BLK_SZ, BLK_SZ + 1,
+			  5 * BLK_SZ, 8 * BLK_SZ, 9 * BLK_SZ + 123,
+			  N_BLK * BLK_SZ };
+	static const enum csum_impl impls[] = {
+		CSUM_IMPL_OPENSSL, CSUM_IMPL_MB, CSUM_IMPL_AUTO,
+	};
+	int pass, i;
+
+	data = randmem(N_BLK * BLK_SZ);
+	OK(data != NULL);
+
+	for (pass = 0; pass < sizeof(impls) / sizeof(impls[0]); pass++) {
+		if (!csum_init(impls[pass]))
+			continue;	/* not on this CPU */
+
+		for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+			check_blocks(data, lens[i]);
+		check_many(data);
+
+		printf("csum %s%s: %.2f GB/s (OpenSSL one block at a time "
+		       "%.2f GB/s)\n",
+		       impls[pass] == CSUM_IMPL_AUTO ? "auto " : "",
+		       csum_impl_name(), bench(data, true), bench(data, false));
+	}
+
+	free(data);
+	return 0;
+}
@@ -0,0 +1,132 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "../../chunkd/fdcache.c"
+#include <stdio.h>
+#include <fcntl.h>
+#include "test.h"
+
+enum {
+	MAX_FDS		= FDCACHE_SHARDS * 2,
+	N_KEYS		= 200,
+};
+
+static int open_null(void)
+{
+	int fd = open("/dev/null", O_RDONLY);
+
+	OK(fd >= 0);
+	return fd;
+}
+
+static bool fd_is_open(int fd)
+{
+	return fcntl(fd, F_GETFD) != -1;
+}
+
+int main(int argc, char *argv[])
+{
+	static char k1[] = { 'a' };
+	static char k2[] = { 'a', '\0', 'a' };
+	struct fdcache cache;
+	struct fdcache_ent *e1, *e2, *e3;
+	struct fdcache_stats st;
+	unsigned long gen, stale_gen;
+	char key[32];
+	int fd, rc, i;
+
+	g_thread_init(NULL);
+
+	/* disabled: entries only wrap the fd, and put closes it */
+	rc = fdcache_init(&cache, 0);
+	OK(rc == 0);
+	OK(fdcache_get(&cache, 1, k1, sizeof(k1), &gen) == NULL);
+	fd = open_null();
+	e1 = fdcache_add(&cache, 1, k1, sizeof(k1), fd, 1, strdup("k1"), gen);
+	OK(e1 != NULL && e1->fd == fd);
+	OK(fdcache_get(&cache, 1, k1, sizeof(k1), &gen) == NULL);
+	fdcache_put(&cache, e1);
+	OK(!fd_is_open(fd));
+	fdcache_fini(&cache);
+
+	rc = fdcache_init(&cache, MAX_FDS);
+	OK(rc == 0);
+
+	/* the cached fd stays open after its first user is done */
+	OK(fdcache_get(&cache, 1, k1, sizeof(k1), &gen) == NULL);
+	fd = open_null();
+	e1 = fdcache_add(&cache, 1, k1, sizeof(k1), fd, 7, strdup("k1"), gen);
+	OK(e1 != NULL);
+	fdcache_put(&cache, e1);
+	OK(fd_is_open(fd));
+
+	e2 = fdcache_get(&cache, 1, k1, sizeof(k1), &gen);
+	OK(e2 == e1);
+	OK(e2->fd == fd && e2->ino == 7 && !strcmp(e2->name, "k1"));
+
+	/* other table, and keys with nul bytes, are other objects */
+	OK(fdcache_get(&cache, 2, k1, sizeof(k1), &gen) == NULL);
+	OK(fdcache_get(&cache, 1, k2, sizeof(k2), &gen) == NULL);
+
+	/* invalidation while in use: closed only when the user is done */
+	e3 = fdcache_get(&cache, 1, k1, sizeof(k1), &stale_gen);
+	OK(e3 == e1);
+	fdcache_put(&cache, e3);
+	fdcache_invalidate(&cache, 1, k1, sizeof(k1));
+	OK(fdcache_get(&cache, 1, k1, sizeof(k1), &gen) == NULL);
+	OK(fd_is_open(fd));
+	fdcache_put(&cache, e2);
+	OK(!fd_is_open(fd));
+
+	/* an add racing with invalidation is used once, not cached */
+	fd = open_null();
+	e1 = fdcache_add(&cache, 1, k1, sizeof(k1), fd, 8, strdup("k1"),
+			 stale_gen);
+	OK(e1 != NULL);
+	OK(fdcache_get(&cache, 1, k1, sizeof(k1), &gen) == NULL);
+	fdcache_put(&cache, e1);
+	OK(!fd_is_open(fd));
+
+	/* idle descriptors beyond the limit are closed */
+	for (i = 0; i < N_KEYS; i++) {
+		sprintf(key, "key-%d", i);
+		fdcache_get(&cache, 4, key, strlen(key), &gen);
+		e1 = fdcache_add(&cache, 4, key, strlen(key), open_null(), i,
+				 strdup(key), gen);
+		OK(e1 != NULL);
+		fdcache_put(&cache, e1);
+	}
+
+	fdcache_stats(&cache, &st);
+	OK(st.entries <= MAX_FDS);
+	OK(st.evictions >= N_KEYS - MAX_FDS);
+	OK(st.hits >= 2);
+	OK(st.misses >= N_KEYS);
+
+	sprintf(key, "key-%d", N_KEYS - 1);
+	e1 = fdcache_get(&cache, 4, key, strlen(key), &gen);
+	OK(e1 != NULL && e1->ino == N_KEYS - 1);
+	fd = e1->fd;
+	fdcache_put(&cache, e1);
+
+	fdcache_fini(&cache);
+	OK(!fd_is_open(fd));
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <locale.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+enum {
+	OBJ_SZ			= 1 * 1024 * 1024,
+	SMALL_SZ		= 1000,		/* packed, see server-test.cfg */
+};
+
+static unsigned char *rbuf;
+
+static void free_ranges(struct st_range *ranges, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		free(ranges[i].data);
+}
+
+static void check_ranges(struct st_client *stc, const char *key,
+			 size_t obj_len, struct st_range *ranges,
+			 unsigned int n)
+{
+	uint64_t want;
+	unsigned int i;
+	bool rcb;
+
+	rcb = stc_get_multiz(stc, key, ranges, n);
+	OK(rcb);
+
+	for (i = 0; i < n; i++) {
+		want = obj_len - ranges[i].offset;
+		if (ranges[i].len && ranges[i].len < want)
+			want = ranges[i].len;
+
+		OK(ranges[i].data);
+		OK(ranges[i].data_len == want);
+		OK(!memcmp(ranges[i].data, rbuf + ranges[i].offset, want));
+	}
+
+	free_ranges(ranges, n);
+}
+
+static void test(bool do_encrypt)
+{
+	/* a footer, then column chunks, as a columnar reader asks */
+	struct st_range ranges[] = {
+		{ OBJ_SZ - 64,		0 },
+		{ 0,			4 },
+		{ 65530,		12 },
+		{ 200000,		65536 },
+		{ 131072,		65536 },
+		{ 12345,		0x30000 },
+		{ OBJ_SZ - 10,		100 },
+		{ OBJ_SZ,		0 },
+		{ 0,			OBJ_SZ },
+	};
+	struct st_range small[] = {
+		{ SMALL_SZ - 8,		0 },
+		{ 10,			20 },
+		{ 0,			SMALL_SZ },
+	};
+	struct st_range many[CHD_MAX_RANGES];
+	struct st_range bad[2];
+	struct st_client *stc;
+	int port;
+	bool rcb;
+	int i;
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	rcb = stc_put_inlinez(stc, "get-multi", rbuf, OBJ_SZ, 0);
+	OK(rcb);
+	rcb = stc_put_inlinez(stc, "get-multi-small", rbuf, SMALL_SZ, 0);
+	OK(rcb);
+
+	check_ranges(stc, "get-multi", OBJ_SZ, ranges,
+		     sizeof(ranges) / sizeof(ranges[0]));
+	check_ranges(stc, "get-multi-small", SMALL_SZ, small,
+		     sizeof(small) / sizeof(small[0]));
+
+	/* as many ranges as one request may carry */
+	for (i = 0; i < CHD_MAX_RANGES; i++) {
+		many[i].offset = (uint64_t) i * 16381;
+		many[i].len = 1000 + i;
+	}
+	check_ranges(stc, "get-multi", OBJ_SZ, many, CHD_MAX_RANGES);
+
+	/* one range past the end fails the whole request */
+	bad[0].offset = 0;
+	bad[0].len = 100;
+	bad[1].offset = OBJ_SZ + 1;
+	bad[1].len = 100;
+	rcb = stc_get_multiz(stc, "get-multi", bad, 2);
+	OK(!rcb);
+	OK(!bad[0].data);
+
+	rcb = stc_get_multiz(stc, "get-multi-none", ranges, 1);
+	OK(!rcb);
+
+	/* the connection carries on */
+	check_ranges(stc, "get-multi", OBJ_SZ, ranges, 2);
+
+	rcb = stc_delz(stc, "get-multi");
+	OK(rcb);
+	rcb = stc_delz(stc, "get-multi-small");
+	OK(rcb);
+
+	stc_free(stc);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	rbuf = randmem(OBJ_SZ);
+	OK(rbuf);
+
+	test(false);
+	test(true);
+
+	return 0;
+}
@@ -36,6 +36,46 @@ enum {
 
 static void *rbuf;
 
+/* ranges that start and end at odd places, or at block boundaries */
+static const struct {
+	uint64_t	offset;
+	uint64_t	len;
+} parts[] = {
+	{ 0,			RBUF_SZ },
+	{ 1,			RBUF_SZ - 2 },
+	{ 65536,		65536 },
+	{ 65535,		2 },
+	{ 100000,		300000 },
+	{ RBUF_SZ - 10,		0 },
+};
+
+static void check_parts(struct st_client *stc, const char *key)
+{
+	uint64_t want;
+	size_t len;
+	void *mem;
+	int i;
+
+	for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+		want = parts[i].len ? parts[i].len : RBUF_SZ - parts[i].offset;
+
+		len = 0;
+		mem = stc_get_part_inlinez(stc, key, parts[i].offset,
+					   parts[i].len, &len);
+		OK(mem);
+		OK(len == want);
+		OK(!memcmp(rbuf + parts[i].offset, mem, len));
+		free(mem);
+
+		len = 0;
+		mem = stc_get_part_verifyz(stc, key, parts[i].offset,
+					   parts[i].len, &len);
+		OK(mem);
+		OK(len == want);
+		OK(!memcmp(rbuf + parts[i].offset, mem, len));
+		free(mem);
+	}
+}
 
 static void test(bool do_encrypt)
 {
@@ -78,14 +118,20 @@ static void test(bool do_encrypt)
 
 	stc_free_keylist(klist);
 
-	/* get object */
+	/* get object; ranges are no longer capped */
 	mem = stc_get_part_inlinez(stc, key, 0, 0, &len);
 	OK(mem);
-	OK(len == CHUNK_MAX_GETPART_SZ);
-	OK(!memcmp(rbuf, mem, CHUNK_MAX_GETPART_SZ));
+	OK(len == RBUF_SZ);
+	OK(!memcmp(rbuf, mem, RBUF_SZ));
 
 	free(mem);
 
+	check_parts(stc, key);
+
+	/* a range may not start beyond the object */
+	mem = stc_get_part_inlinez(stc, key, RBUF_SZ + 1, 0, &len);
+	OK(!mem);
+
 	/* delete object */
 	rcb = stc_delz(stc, key);
 	OK(rcb);
@@ -34,8 +34,76 @@
 enum {
 	N_BUFS		= 100,
 	BUFSZ		= 1024 * 1024,
+
+	PART_SZ		= 900 * 1024,
 };
 
+/*
+ * The object is data over and over, with the index of each block in the
+ * object stamped over the start of the block, so that no two blocks are
+ * alike: a read from the wrong offset, or checked against the csums of
+ * the wrong blocks, cannot pass.  Fill out with len bytes of it from ofs.
+ */
+static void obj_fill(char *out, const char *data, uint64_t ofs, size_t len)
+{
+	uint32_t tag;
+	size_t n, in_blk;
+
+	while (len) {
+		in_blk = ofs % CHUNK_BLK_SZ;
+		n = MIN(len, CHUNK_BLK_SZ - in_blk);
+		memcpy(out, data + (ofs % BUFSZ), n);
+
+		tag = ofs / CHUNK_BLK_SZ;
+		if (in_blk < sizeof(tag))
+			memcpy(out, (char *) &tag + in_blk,
+			       MIN(n, sizeof(tag) - in_blk));
+
+		out += n;
+		ofs += n;
+		len -= n;
+	}
+}
+
+/* ranged reads; the csum table of this object is loaded lazily */
+static void check_parts(struct st_client *stc, const char *key,
+			const char *data)
+{
+	static const uint64_t ofs[] = {
+		(N_BUFS - 1) * (uint64_t) BUFSZ + 12345,
+		70 * (uint64_t) BUFSZ + 4096,
+		3 * (uint64_t) BUFSZ,
+		N_BUFS * (uint64_t) BUFSZ - 100,
+	};
+	uint64_t want;
+	size_t len;
+	char *expect;
+	void *mem;
+	int i;
+
+	expect = malloc(PART_SZ);
+	OK(expect);
+
+	for (i = 0; i < sizeof(ofs) / sizeof(ofs[0]); i++) {
+		want = MIN(PART_SZ, N_BUFS * (uint64_t) BUFSZ - ofs[i]);
+		obj_fill(expect, data, ofs[i], want);
+
+		mem = stc_get_part_inlinez(stc, key, ofs[i], PART_SZ, &len);
+		OK(mem);
+		OK(len == want);
+		OK(!memcmp(mem, expect, len));
+		free(mem);
+
+		mem = stc_get_part_verifyz(stc, key, ofs[i], PART_SZ, &len);
+		OK(mem);
+		OK(len == want);
+		OK(!memcmp(mem, expect, len));
+		free(mem);
+	}
+
+	free(expect);
+}
+
 static bool send_buf(struct st_client *stc, int sfd, void *buf, size_t buf_len)
 {
 	int sent;
@@ -92,7 +160,7 @@ static bool recv_buf(struct st_client *stc, int rfd, void *buf, size_t buf_len)
 	return true;
 }
 
-static void test(bool do_encrypt)
+static void test(bool do_encrypt, bool nocache)
 {
 	struct st_object *obj;
 	struct st_keylist *klist;
@@ -101,19 +169,23 @@ static void test(bool do_encrypt)
 	bool rcb;
 	char key[64] = "deadbeef";
 	uint64_t len = 0;
-	char data[BUFSZ];
+	char *data, *wbuf;
 	char rbuf[BUFSZ];
 	struct timeval ta, tb;
 	int sfd, rfd;
 	int i;
 
-	memset(data, 0xdeadbeef, sizeof(data));
+	data = randmem(BUFSZ);
+	OK(data);
+	wbuf = malloc(BUFSZ);
+	OK(wbuf);
 
 	port = hail_readport(TEST_PORTFILE);
 	OK(port > 0);
 
 	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
 	OK(stc);
+	stc_set_nocache(stc, nocache);
 
 	rcb = stc_table_openz(stc, TEST_TABLE, 0);
 	OK(rcb);
@@ -126,7 +198,8 @@ static void test(bool do_encrypt)
 	rcb = stc_put_startz(stc, key, N_BUFS * BUFSZ, &sfd, 0);
 	OK(rcb);
 	for (i = 0; i < N_BUFS; i++) {
-		rcb = send_buf(stc, sfd, data, BUFSZ);
+		obj_fill(wbuf, data, i * (uint64_t) BUFSZ, BUFSZ);
+		rcb = send_buf(stc, sfd, wbuf, BUFSZ);
 		OK(rcb);
 	}
 	rcb = stc_put_sync(stc);
@@ -135,6 +208,7 @@ static void test(bool do_encrypt)
 	gettimeofday(&tb, NULL);
 
 	printdiff(&ta, &tb, N_BUFS,
+		  nocache ? "large-object nocache PUT" :
 		  do_encrypt ? "large-object SSL PUT" : "large-object PUT", "MB");
 
 	sync();
@@ -164,20 +238,26 @@ static void test(bool do_encrypt)
 	gettimeofday(&tb, NULL);
 
 	printdiff(&ta, &tb, N_BUFS,
+		  nocache ? "large-object nocache GET" :
 		  do_encrypt ? "large-object SSL GET" : "large-object GET", "MB");
 
 	/* get and verify object contents */
 	for (i = 0; i < N_BUFS; i++) {
 		rcb = recv_buf(stc, rfd, rbuf, BUFSZ);
 		OK(rcb);
-		OK(!memcmp(rbuf, data, BUFSZ));
+		obj_fill(wbuf, data, i * (uint64_t) BUFSZ, BUFSZ);
+		OK(!memcmp(rbuf, wbuf, BUFSZ));
 	}
 
+	check_parts(stc, key, data);
+
 	/* delete object */
 	rcb = stc_delz(stc, key);
 	OK(rcb);
 
 	stc_free(stc);
+	free(wbuf);
+	free(data);
 }
 
 int main(int argc, char *argv[])
@@ -188,9 +268,12 @@ int main(int argc, char *argv[])
 	SSL_library_init();
 	SSL_load_error_strings();
 
-	test(false);
+	test(false, false);
+
+	test(true, false);
 
-	test(true);
+	/* bulk transfer, kept out of the server's page cache */
+	test(false, true);
 
 	return 0;
 }
@@ -0,0 +1,190 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <locale.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+enum {
+	N_OBJS			= 40,
+	PAGE_KEYS		= 9,
+	STOP_AFTER		= 3,
+};
+
+static const char val[] = "binary list value";
+
+struct list_state {
+	char		last[64];
+	unsigned char	last_key[CHD_KEY_SZ];
+	size_t		last_key_len;
+	int		n_keys;
+	int		stop_after;
+};
+
+static bool list_cb(const struct st_list_ent *ent, void *user_data)
+{
+	struct list_state *st = user_data;
+	const char *name = ent->key;
+
+	OK(ent->key_len > 0 && ent->key_len <= sizeof(st->last));
+	OK(name[ent->key_len - 1] == 0);
+	OK(!strncmp(name, "lb-", 3));
+	OK(strcmp(st->last, name) < 0);
+	OK(ent->size == strlen(val));
+
+	strcpy(st->last, name);
+	memcpy(st->last_key, ent->key, ent->key_len);
+	st->last_key_len = ent->key_len;
+
+	st->n_keys++;
+	return st->n_keys != st->stop_after;
+}
+
+/* feed a hand-built body one byte at a time, then with damage */
+static void test_decoder(void)
+{
+	unsigned char body[sizeof(struct chunksrv_list_hdr) +
+			   2 * (sizeof(struct chunksrv_list_ent) + 8)];
+	struct chunksrv_list_hdr *hdr = (void *) body;
+	struct chunksrv_list_ent *ent;
+	struct st_list_decoder dec;
+	struct list_state st;
+	unsigned char *p;
+	size_t i;
+
+	memset(body, 0, sizeof(body));
+	memcpy(hdr->magic, CHUNKD_LIST_MAGIC, sizeof(hdr->magic));
+	hdr->flags = CHLF_TRUNCATED;
+	hdr->n_ents = GUINT32_TO_LE(2);
+
+	p = body + sizeof(*hdr);
+	for (i = 0; i < 2; i++) {
+		ent = (void *) p;
+		ent->size = GUINT64_TO_LE(strlen(val));
+		ent->key_len = GUINT16_TO_LE(8);
+		sprintf((char *) (ent + 1), "lb-%04d", (int) i);
+		p += sizeof(*ent) + 8;
+	}
+
+	memset(&st, 0, sizeof(st));
+	stc_list_decoder_init(&dec, list_cb, &st);
+	for (i = 0; i < sizeof(body); i++) {
+		OK(!stc_list_decoder_done(&dec));
+		OK(stc_list_decode(&dec, body + i, 1));
+	}
+	OK(stc_list_decoder_done(&dec));
+	OK(dec.truncated);
+	OK(st.n_keys == 2);
+
+	/* bytes past the promised entries are an error */
+	OK(!stc_list_decode(&dec, body + sizeof(*hdr),
+			    sizeof(struct chunksrv_list_ent)));
+
+	/* so is a bad magic */
+	hdr->magic[0] ^= 1;
+	stc_list_decoder_init(&dec, list_cb, &st);
+	OK(!stc_list_decode(&dec, body, sizeof(body)));
+}
+
+static void test(bool do_encrypt)
+{
+	struct st_client *stc;
+	struct list_state st;
+	int port;
+	bool rcb, truncated;
+	char key[64];
+	int i, n_pages;
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	for (i = 0; i < N_OBJS; i++) {
+		sprintf(key, "lb-%04d", i);
+		rcb = stc_put_inlinez(stc, key, (void *) val, strlen(val), 0);
+		OK(rcb);
+	}
+
+	/* one page at a time, continuing from the last key seen */
+	memset(&st, 0, sizeof(st));
+	n_pages = 0;
+	do {
+		rcb = stc_keys_stream(stc, "lb-", 3,
+				      st.last_key, st.last_key_len,
+				      PAGE_KEYS, list_cb, &st, &truncated);
+		OK(rcb);
+		n_pages++;
+	} while (truncated);
+	OK(st.n_keys == N_OBJS);
+	OK(n_pages == (N_OBJS + PAGE_KEYS - 1) / PAGE_KEYS);
+
+	/* a callback may stop early; the connection stays usable */
+	memset(&st, 0, sizeof(st));
+	st.stop_after = STOP_AFTER;
+	rcb = stc_keys_stream(stc, "lb-", 3, NULL, 0, 0, list_cb, &st,
+			      &truncated);
+	OK(!rcb);
+	OK(st.n_keys == STOP_AFTER);
+
+	rcb = stc_ping(stc);
+	OK(rcb);
+
+	for (i = 0; i < N_OBJS; i++) {
+		sprintf(key, "lb-%04d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+	}
+
+	memset(&st, 0, sizeof(st));
+	rcb = stc_keys_stream(stc, "lb-", 3, NULL, 0, 0, list_cb, &st,
+			      &truncated);
+	OK(rcb);
+	OK(st.n_keys == 0);
+	OK(!truncated);
+
+	stc_free(stc);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	test_decoder();
+	test(false);
+	test(true);
+
+	return 0;
+}
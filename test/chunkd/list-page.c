@@ -0,0 +1,164 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <locale.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+enum {
+	N_A_OBJS		= 25,
+	N_B_OBJS		= 5,
+	PAGE_KEYS		= 7,
+};
+
+static const char val[] = "paged list value";
+
+/* walk one prefix page by page, checking order and page bounds */
+static int list_prefix(struct st_client *stc, const char *prefix)
+{
+	struct st_keys_iter *iter;
+	struct st_keylist *page;
+	struct st_object *obj;
+	char last[64] = "";
+	int n_keys = 0, n_pages = 0, n;
+	GList *tmpl;
+
+	iter = stc_keys_iter_new(stc, prefix, strlen(prefix), PAGE_KEYS);
+	OK(iter);
+
+	while (1) {
+		OK(stc_keys_iter_next(iter, &page));
+		if (!page)
+			break;
+		n_pages++;
+
+		n = 0;
+		for (tmpl = page->contents; tmpl; tmpl = tmpl->next) {
+			obj = tmpl->data;
+			OK(!strncmp(obj->name, prefix, strlen(prefix)));
+			OK(strcmp(last, obj->name) < 0);
+			OK(obj->size == strlen(val));
+			strcpy(last, obj->name);
+			n++;
+		}
+
+		OK(n <= PAGE_KEYS);
+		if (page->truncated)
+			OK(n == PAGE_KEYS);
+		n_keys += n;
+
+		stc_free_keylist(page);
+	}
+
+	stc_keys_iter_free(iter);
+
+	OK(n_pages >= (n_keys + PAGE_KEYS - 1) / PAGE_KEYS);
+	return n_keys;
+}
+
+static void test(bool do_encrypt)
+{
+	struct st_keylist *klist;
+	struct st_client *stc;
+	struct st_object *obj;
+	int port;
+	bool rcb;
+	char key[64];
+	int i;
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	/* store objects under two prefixes */
+	for (i = 0; i < N_A_OBJS; i++) {
+		sprintf(key, "pl-a-%04d", i);
+		rcb = stc_put_inlinez(stc, key, (void *) val, strlen(val), 0);
+		OK(rcb);
+	}
+	for (i = 0; i < N_B_OBJS; i++) {
+		sprintf(key, "pl-b-%04d", i);
+		rcb = stc_put_inlinez(stc, key, (void *) val, strlen(val), 0);
+		OK(rcb);
+	}
+
+	/* each prefix sees exactly its own keys */
+	OK(list_prefix(stc, "pl-a-") == N_A_OBJS);
+	OK(list_prefix(stc, "pl-b-") == N_B_OBJS);
+	OK(list_prefix(stc, "pl-") == N_A_OBJS + N_B_OBJS);
+	OK(list_prefix(stc, "pl-c-") == 0);
+
+	/* a marker starts the listing after that exact key */
+	sprintf(key, "pl-a-%04d", N_A_OBJS - 2);
+	klist = stc_keys_page(stc, "pl-", 3, key, strlen(key) + 1, 2);
+	OK(klist);
+	OK(g_list_length(klist->contents) == 2);
+	obj = klist->contents->data;
+	sprintf(key, "pl-a-%04d", N_A_OBJS - 1);
+	OK(!strcmp(obj->name, key));
+	obj = klist->contents->next->data;
+	OK(!strcmp(obj->name, "pl-b-0000"));
+	OK(klist->truncated);
+	OK(klist->next_marker_len == strlen("pl-b-0000") + 1);
+	OK(!memcmp(klist->next_marker, "pl-b-0000", klist->next_marker_len));
+	stc_free_keylist(klist);
+
+	/* delete objects */
+	for (i = 0; i < N_A_OBJS; i++) {
+		sprintf(key, "pl-a-%04d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+	}
+	for (i = 0; i < N_B_OBJS; i++) {
+		sprintf(key, "pl-b-%04d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+	}
+
+	OK(list_prefix(stc, "pl-") == 0);
+
+	stc_free(stc);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	test(false);
+	test(true);
+
+	return 0;
+}
@@ -0,0 +1,136 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#include "../../chunkd/metacache.c"
+#include <stdio.h>
+#include "test.h"
+
+enum {
+	MAX_ENTS	= METACACHE_SHARDS * 4,
+	MAX_CSUM	= METACACHE_SHARDS * 8 * 1024,
+	N_KEYS		= 1000,
+};
+
+static void fill_meta(struct metacache_meta *meta, uint64_t size)
+{
+	memset(meta, 0, sizeof(*meta));
+	meta->size = size;
+	meta->mtime = 1234567890;
+	meta->ino = size + 1;
+	memset(meta->hash, (int) size, sizeof(meta->hash));
+	strcpy(meta->owner, "testuser");
+}
+
+int main(int argc, char *argv[])
+{
+	static char k1[] = { 'a' };
+	static char k2[] = { 'a', '\0', 'a' };
+	static unsigned char tbl[3 * CHD_CSUM_SZ];
+	struct metacache cache;
+	struct metacache_meta meta, out;
+	struct metacache_stats st;
+	void *csum;
+	size_t csum_len;
+	unsigned long gen, stale_gen;
+	char key[32];
+	int rc, i;
+
+	g_thread_init(NULL);
+
+	/* a disabled cache never hits */
+	rc = metacache_init(&cache, 0, 0);
+	OK(rc == 0);
+	fill_meta(&meta, 10);
+	OK(!metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	metacache_put(&cache, 1, k1, sizeof(k1), &meta, NULL, 0, gen);
+	OK(!metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	metacache_fini(&cache);
+
+	rc = metacache_init(&cache, MAX_ENTS, MAX_CSUM);
+	OK(rc == 0);
+
+	/* fill, then hit with a copy of the csum table */
+	memset(tbl, 0x5a, sizeof(tbl));
+	OK(!metacache_get(&cache, 1, k1, sizeof(k1), &out, &csum, &csum_len,
+			  &gen));
+	OK(csum == NULL);
+	metacache_put(&cache, 1, k1, sizeof(k1), &meta, tbl, sizeof(tbl), gen);
+
+	OK(metacache_get(&cache, 1, k1, sizeof(k1), &out, &csum, &csum_len,
+			 &gen));
+	OK(!memcmp(&out, &meta, sizeof(meta)));
+	OK(csum != NULL && csum_len == sizeof(tbl));
+	OK(!memcmp(csum, tbl, sizeof(tbl)));
+	free(csum);
+
+	/* same key bytes in another table, and keys with nul bytes */
+	OK(!metacache_get(&cache, 2, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	OK(!metacache_get(&cache, 1, k2, sizeof(k2), &out, NULL, NULL, &gen));
+	fill_meta(&meta, 20);
+	metacache_put(&cache, 1, k2, sizeof(k2), &meta, NULL, 0, gen);
+	OK(metacache_get(&cache, 1, k2, sizeof(k2), &out, &csum, &csum_len,
+			 &gen));
+	OK(out.size == 20);
+	OK(csum == NULL);
+
+	/* invalidation removes the entry and drops racing fills */
+	OK(metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL,
+			 &stale_gen));
+	metacache_invalidate(&cache, 1, k1, sizeof(k1));
+	OK(!metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	fill_meta(&meta, 10);
+	metacache_put(&cache, 1, k1, sizeof(k1), &meta, NULL, 0, stale_gen);
+	OK(!metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	metacache_put(&cache, 1, k1, sizeof(k1), &meta, NULL, 0, gen);
+	OK(metacache_get(&cache, 1, k1, sizeof(k1), &out, NULL, NULL, &gen));
+
+	/* a csum table too large for its share is not kept */
+	csum = calloc(1, MAX_CSUM);
+	OK(csum != NULL);
+	OK(!metacache_get(&cache, 3, k1, sizeof(k1), &out, NULL, NULL, &gen));
+	metacache_put(&cache, 3, k1, sizeof(k1), &meta, csum, MAX_CSUM, gen);
+	free(csum);
+	OK(metacache_get(&cache, 3, k1, sizeof(k1), &out, &csum, &csum_len,
+			 &gen));
+	OK(csum == NULL && csum_len == 0);
+
+	/* the size bounds hold under many fills, and the newest survive */
+	for (i = 0; i < N_KEYS; i++) {
+		sprintf(key, "key-%d", i);
+		metacache_get(&cache, 4, key, strlen(key), &out, NULL, NULL,
+			      &gen);
+		fill_meta(&meta, i);
+		metacache_put(&cache, 4, key, strlen(key), &meta,
+			      tbl, sizeof(tbl), gen);
+	}
+
+	metacache_stats(&cache, &st);
+	OK(st.entries <= MAX_ENTS);
+	OK(st.csum_bytes <= MAX_CSUM);
+	OK(st.evictions > 0);
+	OK(st.hits >= 5);
+	OK(st.misses >= N_KEYS);
+
+	sprintf(key, "key-%d", N_KEYS - 1);
+	OK(metacache_get(&cache, 4, key, strlen(key), &out, NULL, NULL, &gen));
+	OK(out.size == N_KEYS - 1);
+
+	metacache_fini(&cache);
+	return 0;
+}
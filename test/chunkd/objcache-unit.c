@@ -20,6 +20,11 @@
 #include "../../chunkd/objcache.c"
 #include "test.h"
 
+static void count_run(void *arg)
+{
+	(*(int *) arg)++;
+}
+
 int main(int argc, char *argv[])
 {
 	static char k1[] = { 'a' };
@@ -27,6 +32,7 @@ int main(int argc, char *argv[])
 	static char k3[] = { 'a', '\0', 'a' };
 	struct objcache cache;
 	struct objcache_entry *ep1, *ep2, *ep3;
+	int runs = 0;
 	int rc;
 
 	g_thread_init(NULL);
@@ -54,6 +60,16 @@ int main(int argc, char *argv[])
 	ep2 = objcache_get(&cache, k2, sizeof(k2));
 	OK(ep2 != NULL);
 	OK(ep2->ref == 1);	/* new */
+
+	/* runs while clean only, and a dirty mark sticks with the entry */
+	OK(objcache_run_clean(&cache, ep2, count_run, &runs));
+	ep3 = objcache_get_dirty(&cache, k2, sizeof(k2));
+	OK(ep3 == ep2);
+	OK(!objcache_run_clean(&cache, ep2, count_run, &runs));
+	objcache_put(&cache, ep3);
+	OK(!objcache_run_clean(&cache, ep2, count_run, &runs));
+	OK(runs == 1);
+
 	objcache_put(&cache, ep2);
 
 	rc = objcache_count(&cache);
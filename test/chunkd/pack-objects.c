@@ -0,0 +1,203 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <locale.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+/* server-test.cfg packs objects below 4096 bytes */
+enum {
+	N_TEST_OBJS		= 200,
+	SMALL_SZ		= 1000,
+	LARGE_SZ		= 64 * 1024,
+};
+
+static size_t obj_size(int i)
+{
+	/* every tenth one gets a file of its own */
+	if (i % 10 == 9)
+		return LARGE_SZ + i;
+	return 1 + (i * 37) % SMALL_SZ;
+}
+
+static void check_obj(struct st_client *stc, const char *key,
+		      const unsigned char *data, size_t len)
+{
+	size_t got_len = 0;
+	void *mem;
+
+	mem = stc_get_inlinez(stc, key, &got_len);
+	OK(mem);
+	OK(got_len == len);
+	OK(!memcmp(mem, data, len));
+	free(mem);
+}
+
+/* the server stops reading a refused PUT, so use a connection of its own */
+static void check_put_fails(int port, bool do_encrypt, const char *key,
+			    void *data, size_t len)
+{
+	struct st_client *stc;
+	bool rcb;
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+	rcb = stc_put_inlinez(stc, key, data, len, 0);
+	OK(!rcb);
+	stc_free(stc);
+}
+
+static int count_keys(struct st_client *stc)
+{
+	struct st_keylist *klist;
+	int n;
+
+	klist = stc_keys_page(stc, "pk-", 3, NULL, 0, 0);
+	OK(klist);
+	n = g_list_length(klist->contents);
+	stc_free_keylist(klist);
+	return n;
+}
+
+static void test(bool do_encrypt)
+{
+	struct st_client *stc;
+	unsigned char *data;
+	char key[64];
+	void *mem;
+	size_t len;
+	int port;
+	bool rcb;
+	int i;
+
+	data = randmem(LARGE_SZ + N_TEST_OBJS);
+	OK(data);
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	/* store a mix of packed and unpacked objects */
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pk-%04d", i);
+		rcb = stc_put_inlinez(stc, key, data + i, obj_size(i), 0);
+		OK(rcb);
+	}
+
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pk-%04d", i);
+		check_obj(stc, key, data + i, obj_size(i));
+	}
+	OK(count_keys(stc) == N_TEST_OBJS);
+
+	/* a key is taken whichever way its object is stored */
+	check_put_fails(port, do_encrypt, "pk-0000", data, SMALL_SZ);
+	check_put_fails(port, do_encrypt, "pk-0000", data, LARGE_SZ);
+	check_put_fails(port, do_encrypt, "pk-0009", data, SMALL_SZ);
+	check_obj(stc, "pk-0000", data, obj_size(0));
+	check_obj(stc, "pk-0009", data + 9, obj_size(9));
+
+	/* copies read the packed value back */
+	rcb = stc_cpz(stc, "pk-copy", "pk-0001");
+	OK(rcb);
+	check_obj(stc, "pk-copy", data + 1, obj_size(1));
+	rcb = stc_delz(stc, "pk-copy");
+	OK(rcb);
+
+	/* objects of another user stay out of reach */
+	stc_free(stc);
+	stc = stc_new(TEST_HOST, port, TEST_USER2, TEST_USER2_KEY, do_encrypt);
+	OK(stc);
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+	mem = stc_get_inlinez(stc, "pk-0001", &len);
+	OK(!mem);
+	rcb = stc_delz(stc, "pk-0001");
+	OK(!rcb);
+	stc_free(stc);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	/* delete every other object; the rest must be unharmed */
+	for (i = 0; i < N_TEST_OBJS; i += 2) {
+		sprintf(key, "pk-%04d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+		rcb = stc_delz(stc, key);
+		OK(!rcb);
+	}
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pk-%04d", i);
+		if (i % 2 == 0) {
+			mem = stc_get_inlinez(stc, key, &len);
+			OK(!mem);
+		} else
+			check_obj(stc, key, data + i, obj_size(i));
+	}
+	OK(count_keys(stc) == N_TEST_OBJS / 2);
+
+	/* a deleted key may be stored again, at another size */
+	rcb = stc_put_inlinez(stc, "pk-0000", data, SMALL_SZ - 1, 0);
+	OK(rcb);
+	check_obj(stc, "pk-0000", data, SMALL_SZ - 1);
+	rcb = stc_delz(stc, "pk-0000");
+	OK(rcb);
+
+	for (i = 1; i < N_TEST_OBJS; i += 2) {
+		sprintf(key, "pk-%04d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+	}
+	OK(count_keys(stc) == 0);
+
+	stc_free(stc);
+	free(data);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	test(false);
+	test(true);
+
+	return 0;
+}
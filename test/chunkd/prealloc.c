@@ -0,0 +1,184 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <string.h>
+#include <locale.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+/*
+ * Upload several large objects at once, interleaved in small pieces,
+ * and report how many extents their files ended up in.  Without
+ * preallocation the allocator tends to interleave them as well; run
+ * against an older chunkd for the comparison.
+ */
+
+enum {
+	N_STREAMS		= 4,
+	OBJ_SZ			= 8 * 1024 * 1024,
+	PIECE_SZ		= 64 * 1024,
+};
+
+#define TEST_CHUNK_PATH		"data/chunk"
+
+static unsigned long n_files, n_extents;
+static bool no_fiemap;
+
+static int count_extents(const char *fpath, const struct stat *sb,
+			 int typeflag, struct FTW *ftwbuf)
+{
+	struct fiemap fm;
+	int fd;
+
+	/* only the objects of this test are this large */
+	if (typeflag != FTW_F || sb->st_size < OBJ_SZ)
+		return 0;
+
+	fd = open(fpath, O_RDONLY);
+	OK(fd >= 0);
+
+	memset(&fm, 0, sizeof(fm));
+	fm.fm_length = FIEMAP_MAX_OFFSET;
+	fm.fm_flags = FIEMAP_FLAG_SYNC;
+	if (ioctl(fd, FS_IOC_FIEMAP, &fm) < 0)
+		no_fiemap = true;
+	else {
+		n_files++;
+		n_extents += fm.fm_mapped_extents;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static void put_interleaved(struct st_client **stc, const char **keys,
+			    unsigned char *data)
+{
+	size_t done, piece, sent;
+	int sfd, i;
+	bool rcb;
+	size_t rc;
+
+	for (i = 0; i < N_STREAMS; i++) {
+		rcb = stc_put_startz(stc[i], keys[i], OBJ_SZ, &sfd, 0);
+		OK(rcb);
+	}
+
+	for (done = 0; done < OBJ_SZ; done += piece) {
+		piece = MIN(PIECE_SZ, OBJ_SZ - done);
+
+		for (i = 0; i < N_STREAMS; i++) {
+			for (sent = 0; sent < piece; sent += rc) {
+				rc = stc_put_send(stc[i], data + done + sent,
+						  piece - sent);
+				OK(rc > 0);
+			}
+		}
+	}
+
+	for (i = 0; i < N_STREAMS; i++) {
+		rcb = stc_put_sync(stc[i]);
+		OK(rcb);
+	}
+}
+
+static void test(bool do_encrypt)
+{
+	static const char *keys[N_STREAMS] = {
+		"prealloc-0", "prealloc-1", "prealloc-2", "prealloc-3",
+	};
+	struct st_client *stc[N_STREAMS];
+	unsigned char *data;
+	size_t len;
+	void *mem;
+	int port;
+	bool rcb;
+	int i;
+
+	data = randmem(OBJ_SZ);
+	OK(data);
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	for (i = 0; i < N_STREAMS; i++) {
+		stc[i] = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY,
+				 do_encrypt);
+		OK(stc[i]);
+		rcb = stc_table_openz(stc[i], TEST_TABLE, 0);
+		OK(rcb);
+	}
+
+	put_interleaved(stc, keys, data);
+
+	n_files = n_extents = 0;
+	no_fiemap = false;
+	OK(nftw(TEST_CHUNK_PATH, count_extents, 16, FTW_PHYS) == 0);
+	if (no_fiemap)
+		fprintf(stderr, "      prealloc: FIEMAP not supported here\n");
+	else {
+		OK(n_files == N_STREAMS);
+		fprintf(stderr, "      prealloc%s: %.2f extents/object\n",
+			do_encrypt ? " SSL" : "",
+			(double) n_extents / n_files);
+	}
+
+	for (i = 0; i < N_STREAMS; i++) {
+		len = 0;
+		mem = stc_get_inlinez(stc[0], keys[i], &len);
+		OK(mem);
+		OK(len == OBJ_SZ);
+		OK(!memcmp(mem, data, OBJ_SZ));
+		free(mem);
+
+		rcb = stc_delz(stc[0], keys[i]);
+		OK(rcb);
+	}
+
+	for (i = 0; i < N_STREAMS; i++)
+		stc_free(stc[i]);
+	free(data);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	test(false);
+	test(true);
+
+	return 0;
+}
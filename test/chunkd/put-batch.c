@@ -0,0 +1,170 @@
+
+/*
+ * Copyright 2009 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING.  If not, write to
+ * the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ */
+
+#define _GNU_SOURCE
+#include "hail-config.h"
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <locale.h>
+#include <cld_common.h>
+#include <chunkc.h>
+#include "test.h"
+
+enum {
+	N_TEST_OBJS		= 3000,		/* several batches' worth */
+	LARGE_SZ		= 64 * 1024,	/* gets a file of its own */
+};
+
+struct batch_result {
+	unsigned long		n_ok;
+	unsigned long		n_exists;
+	unsigned long		n_other;
+};
+
+static void batch_cb(const void *key, size_t key_len, int status,
+		     void *user_data)
+{
+	struct batch_result *res = user_data;
+
+	if (status == che_Success)
+		res->n_ok++;
+	else if (status == che_KeyExists)
+		res->n_exists++;
+	else
+		res->n_other++;
+}
+
+static void check_obj(struct st_client *stc, const char *key,
+		      const void *data, size_t len)
+{
+	size_t got_len = 0;
+	void *mem;
+
+	mem = stc_get_inlinez(stc, key, &got_len);
+	OK(mem);
+	OK(got_len == len);
+	OK(!memcmp(mem, data, len));
+	free(mem);
+}
+
+static void test(bool do_encrypt, uint32_t flags)
+{
+	char val[] = "my first value";
+	struct batch_result res;
+	struct st_batch *batch;
+	struct st_keylist *klist;
+	struct st_client *stc;
+	struct timeval ta, tb;
+	unsigned char *large;
+	char key[64];
+	int port;
+	bool rcb;
+	int i;
+
+	large = randmem(LARGE_SZ);
+	OK(large);
+
+	port = hail_readport(TEST_PORTFILE);
+	OK(port > 0);
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, do_encrypt);
+	OK(stc);
+
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+
+	memset(&res, 0, sizeof(res));
+	batch = stc_batch_new(stc, flags, batch_cb, &res);
+	OK(batch);
+
+	gettimeofday(&ta, NULL);
+
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pb-%05d", i);
+		rcb = stc_batch_putz(batch, key, val, strlen(val));
+		OK(rcb);
+	}
+
+	/* a larger object, and a key already taken in this batch */
+	rcb = stc_batch_putz(batch, "pb-large", large, LARGE_SZ);
+	OK(rcb);
+	rcb = stc_batch_putz(batch, "pb-00007", large, 10);
+	OK(rcb);
+
+	rcb = stc_batch_flush(batch);
+	OK(rcb);
+
+	gettimeofday(&tb, NULL);
+
+	printdiff(&ta, &tb, N_TEST_OBJS,
+		  do_encrypt ? "put-batch SSL PUT" : "put-batch PUT", "ops");
+
+	OK(res.n_ok == N_TEST_OBJS + 1);
+	OK(res.n_exists == 1);
+	OK(res.n_other == 0);
+	OK(batch->n_failed == 1);
+
+	/* nothing left to send */
+	rcb = stc_batch_flush(batch);
+	OK(rcb);
+	OK(res.n_ok == N_TEST_OBJS + 1);
+
+	stc_batch_free(batch);
+
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pb-%05d", i);
+		check_obj(stc, key, val, strlen(val));
+	}
+	check_obj(stc, "pb-large", large, LARGE_SZ);
+
+	klist = stc_keys_page(stc, "pb-", 3, NULL, 0, 0);
+	OK(klist);
+	OK(g_list_length(klist->contents) == CHD_LIST_MAX_KEYS);
+	stc_free_keylist(klist);
+
+	for (i = 0; i < N_TEST_OBJS; i++) {
+		sprintf(key, "pb-%05d", i);
+		rcb = stc_delz(stc, key);
+		OK(rcb);
+	}
+	rcb = stc_delz(stc, "pb-large");
+	OK(rcb);
+
+	stc_free(stc);
+	free(large);
+}
+
+int main(int argc, char *argv[])
+{
+	setlocale(LC_ALL, "C");
+
+	stc_init();
+	SSL_library_init();
+	SSL_load_error_strings();
+
+	test(false, 0);
+	test(true, 0);
+	test(false, CHF_SYNC);
+
+	return 0;
+}
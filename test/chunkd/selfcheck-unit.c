@@ -34,6 +34,13 @@
 
 enum { BUFLEN = 8192 };
 
+/* the fixed part of an object header, as in chunkd/be-fs.c */
+enum {
+	OBJ_HDR_LEN		= 180,
+	OBJ_HDR_NBLK_OFS	= 16,
+	OBJ_VALUE_ALIGN		= 4096,
+};
+
 struct config_context {
 	char *text;
 
@@ -211,14 +218,63 @@ static bool be_file_damage(const char *fn)
 	return true;
 }
 
+/*
+ * Rewrite an object file the way chunkd laid objects out before CHU2:
+ * the value right after the csum table.  g_file_set_contents() renames
+ * a new file over the old one, so the server cannot mistake it for the
+ * one it has cached.
+ */
+static bool be_file_downgrade(const char *fn, size_t key_len)
+{
+	char *data;
+	gsize len;
+	uint32_t n_blk;
+	size_t meta_len, value_ofs;
+	int rc;
+
+	if (!g_file_get_contents(fn, &data, &len, NULL))
+		return false;
+	if (len < OBJ_HDR_LEN || memcmp(data, "CHU2", 4))
+		return false;
+
+	memcpy(&n_blk, data + OBJ_HDR_NBLK_OFS, sizeof(n_blk));
+	meta_len = OBJ_HDR_LEN + key_len + GUINT32_FROM_LE(n_blk) * 20;
+	value_ofs = (meta_len + OBJ_VALUE_ALIGN - 1) & ~(OBJ_VALUE_ALIGN - 1);
+	if (len < value_ofs)
+		return false;
+
+	memcpy(data, "CHU1", 4);
+	memmove(data + meta_len, data + value_ofs, len - value_ofs);
+
+	rc = g_file_set_contents(fn, data, len - (value_ofs - meta_len), NULL);
+
+	g_free(data);
+	return rc;
+}
+
+static bool be_file_is_chu2(const char *fn)
+{
+	char magic[4];
+	int fd;
+	ssize_t rcs;
+
+	fd = open(fn, O_RDONLY);
+	if (fd < 0)
+		return false;
+	rcs = read(fd, magic, sizeof(magic));
+	close(fd);
+	return rcs == sizeof(magic) && !memcmp(magic, "CHU2", 4);
+}
+
 int main(int argc, char *argv[])
 {
 	static char key[] = "selfcheck-test-key";
+	static char cvt_key[] = "selfcheck-convert-key";
 	int port;
 	char *buf;
 	struct config_context ctx;
 	struct st_client *stc;
-	char *fn;
+	char *fn, *cvt_fn;
 	size_t len;
 	void *mem;
 	struct chunk_check_status status1, status2;
@@ -253,6 +309,8 @@ int main(int argc, char *argv[])
 	OK(rcb);
 	rcb = stc_put_inline(stc, key, sizeof(key), buf, BUFLEN, 0);
 	OK(rcb);
+	rcb = stc_put_inline(stc, cvt_key, sizeof(cvt_key), buf, BUFLEN, 0);
+	OK(rcb);
 	stc_free(stc);
 
 	/*
@@ -273,6 +331,27 @@ int main(int argc, char *argv[])
 	rcb = be_file_damage(fn);
 	OK(rcb);
 
+	/*
+	 * Step 3a: turn the other object into an old format one, which
+	 * the server must still read, and self-check must convert
+	 */
+	cvt_fn = fs_obj_pathname(ctx.path, 1, cvt_key, sizeof(cvt_key));
+	OK(cvt_fn);
+	rcb = be_file_downgrade(cvt_fn, sizeof(cvt_key));
+	OK(rcb);
+	OK(!be_file_is_chu2(cvt_fn));
+
+	stc = stc_new(TEST_HOST, port, TEST_USER, TEST_USER_KEY, false);
+	OK(stc);
+	rcb = stc_table_openz(stc, TEST_TABLE, 0);
+	OK(rcb);
+	mem = stc_get_inline(stc, cvt_key, sizeof(cvt_key), &len);
+	OK(mem);
+	OK(len == BUFLEN);
+	OK(!memcmp(mem, buf, BUFLEN));
+	free(mem);
+	stc_free(stc);
+
 	/*
 	 * Step 4: force self-check and make sure it runs
 	 */
@@ -317,6 +396,19 @@ int main(int argc, char *argv[])
 	OK(rcb);
 	mem = stc_get_inline(stc, key, sizeof(key), &len);
 	OK(!mem);
+
+	/*
+	 * Step 7: the old format object is converted, and reads the same
+	 */
+	OK(be_file_is_chu2(cvt_fn));
+	mem = stc_get_inline(stc, cvt_key, sizeof(cvt_key), &len);
+	OK(mem);
+	OK(len == BUFLEN);
+	OK(!memcmp(mem, buf, BUFLEN));
+	free(mem);
+	rcb = stc_del(stc, cvt_key, sizeof(cvt_key));
+	OK(rcb);
+	free(cvt_fn);
 	stc_free(stc);
 
 	return 0;